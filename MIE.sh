@@ -5,7 +5,7 @@
 # Definir a lista de iterações, porcentagens e métodos
 iterations=(50)
 percentages=(1 2 5 10 20 30 50)
-methods=(--avg --idw --msh)
+methods=(--avg --idw --msh --okr)
 
 arq1=$1
 arq2=$2
@@ -40,7 +40,7 @@ done
 
 # Extrair os resultados
 echo "Extraindo os resultados"
-echo "iterations, percentage, method, RMSE, MAE, MSE, PERROR" > results.dat
+echo "iterations, percentage, method, RMSE, MAE, MSE, PERROR, RMSE_CI, MAE_CI, MSE_CI, PERROR_CI, RUNS" > results.dat
 for iteration in "${iterations[@]}"; do
     for percentage in "${percentages[@]}"; do
         for method in "${methods[@]}"; do
@@ -11,6 +11,21 @@
 
 #define ERROR (0.000001) // Erro permitido (float)
 
+// identificação do arquivo esparso (8 bytes no início do arquivo)
+#define SPARSE_MAGIC "CTLSPRS1"
+#define SPARSE_MAGIC_SIZE 8
+
+// Cabeçalho do arquivo esparso, seguido por
+// offset[tdef+1] (uint64), idx[nnz] (uint32) e val[nnz] (datatype)
+typedef struct sparse_header_struct{
+    char magic[SPARSE_MAGIC_SIZE];
+    uint32_t dsize;     // sizeof(datatype) usado na escrita
+    uint32_t reserved;
+    uint64_t x, y, t;
+    uint64_t nnz;
+    double undef;
+} sparse_header;
+
 void saferFree(void **pp){
 	if(pp != NULL && *pp != NULL){
 		free(*pp);
@@ -18,6 +33,16 @@ void saferFree(void **pp){
 	}
 }
 
+const char* isa_variant(void){
+#if ISA_DISPATCH
+	// mesma prioridade do resolvedor gerado para target_clones
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return "avx512f";
+	if (__builtin_cpu_supports("avx2")) return "avx2";
+#endif
+	return "default";
+}
+
 int check_dim(binary_data *f1, binary_data *f2){
 	size_t d1 = f1->info.tdef * f1->info.x.def * f1->info.y.def;
 	size_t d2 = f2->info.tdef * f2->info.x.def * f2->info.y.def;
@@ -278,10 +303,151 @@ binary_data *aloca_bin(size_t x, size_t y, size_t t) {
         safeFree(bin_data);
         return NULL;
     }
+    bin_data->sparse = NULL;
+
+    return bin_data;
+}
+
+// libera os vetores da representação esparsa
+static void free_sparse(sparse_data *sparse) {
+    if (sparse) {
+        safeFree(sparse->offset);
+        safeFree(sparse->idx);
+        safeFree(sparse->val);
+        free(sparse);
+    }
+}
+
+// aloca a representação esparsa com 'nnz' valores e 't' tempos
+static sparse_data *aloca_sparse(size_t t, size_t nnz) {
+    sparse_data *sparse;
+
+    if (!(sparse = calloc(1, sizeof(sparse_data)))) {
+        fprintf(stderr, "Erro ao alocar memória para dado esparso (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    sparse->nnz = nnz;
+    sparse->offset = calloc(t + 1, sizeof(size_t));
+    // ao menos 1 elemento para não confundir com erro de alocação
+    sparse->idx = malloc((nnz ? nnz : 1) * sizeof(uint32_t));
+    sparse->val = malloc((nnz ? nnz : 1) * sizeof(datatype));
+
+    if (!sparse->offset || !sparse->idx || !sparse->val) {
+        fprintf(stderr, "Erro ao alocar memória para dado esparso (%s:%d).\n", __FILE__, __LINE__);
+        free_sparse(sparse);
+        return NULL;
+    }
+
+    return sparse;
+}
+
+// lê o arquivo esparso já aberto em 'bin_file'
+static binary_data *read_sparse(FILE *bin_file, size_t x, size_t y, size_t t) {
+    sparse_header header;
+    binary_data *bin_data;
+    uint64_t *offset;
+
+    if (fread(&header, sizeof(sparse_header), 1, bin_file) < 1 ||
+        header.dsize != sizeof(datatype) ||
+        header.x != x || header.y != y || header.t != t) {
+        fprintf(stderr, "ERRO: cabeçalho do arquivo esparso inválido ou incompatível com o ctl (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    if (!(bin_data = malloc(sizeof(binary_data)))) {
+        fprintf(stderr, "Erro ao alocar memória para bin_data (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    bin_data->data = NULL;
+    bin_data->sparse = NULL;
+
+    offset = malloc((t + 1) * sizeof(uint64_t));
+
+    if (!offset || !(bin_data->sparse = aloca_sparse(t, header.nnz)) ||
+        fread(offset, sizeof(uint64_t), t + 1, bin_file) < t + 1 ||
+        fread(bin_data->sparse->idx, sizeof(uint32_t), header.nnz, bin_file) < header.nnz ||
+        fread(bin_data->sparse->val, sizeof(datatype), header.nnz, bin_file) < header.nnz) {
+        fprintf(stderr, "ERRO: arquivo esparso incompleto (%s:%d).\n", __FILE__, __LINE__);
+        safeFree(offset);
+        return free_bin(bin_data);
+    }
+
+    for (size_t i = 0; i <= t; i++)
+        bin_data->sparse->offset[i] = offset[i];
 
+    safeFree(offset);
     return bin_data;
 }
 
+int is_sparse_file(char *name) {
+    char magic[SPARSE_MAGIC_SIZE];
+    FILE *bin_file = fopen(name, "r");
+    int sparse;
+
+    if (!bin_file)
+        return 0;
+
+    sparse = fread(magic, 1, SPARSE_MAGIC_SIZE, bin_file) == SPARSE_MAGIC_SIZE &&
+             !memcmp(magic, SPARSE_MAGIC, SPARSE_MAGIC_SIZE);
+
+    fclose(bin_file);
+    return sparse;
+}
+
+int bin_to_dense(binary_data *bin_data) {
+    sparse_data *sparse = bin_data->sparse;
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t tdef = bin_data->info.tdef;
+
+    if (!sparse)
+        return 1;
+
+    if (!(bin_data->data = malloc(dxy * tdef * sizeof(datatype)))) {
+        fprintf(stderr, "Erro ao alocar memória para bin_data->data (%s:%d).\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    get_pos_range(bin_data, 0, dxy * tdef, bin_data->data);
+
+    free_sparse(sparse);
+    bin_data->sparse = NULL;
+
+    return 1;
+}
+
+void get_pos_range(binary_data *bin_data, size_t start, size_t n, datatype *dest) {
+    sparse_data *sparse = bin_data->sparse;
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t end = start + n;
+
+    if (!sparse) {
+        memcpy(dest, bin_data->data + start, n * sizeof(datatype));
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        dest[i] = bin_data->info.undef;
+
+    for (size_t t = start / dxy; t < bin_data->info.tdef && t * dxy < end; t++) {
+        uint32_t first = (start > t * dxy) ? start - t * dxy : 0;
+        size_t last = (end - t * dxy < dxy) ? end - t * dxy : dxy;
+
+        // busca binária do primeiro valor do tempo t dentro do trecho
+        size_t lo = sparse->offset[t], hi = sparse->offset[t + 1];
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (sparse->idx[mid] < first)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for (size_t k = lo; k < sparse->offset[t + 1] && sparse->idx[k] < last; k++)
+            dest[t * dxy + sparse->idx[k] - start] = sparse->val[k];
+    }
+}
+
 // Abre um arquivo o .bin 'name' com as informações passadas por parametro
 // Retorna o ponteiro para a struct de dado, ou NULL em erro
 binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
@@ -297,6 +463,17 @@ binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
             name,__FILE__, __LINE__);
         return NULL;
     }
+    // arquivo esparso
+    char magic[SPARSE_MAGIC_SIZE];
+    if (fread(magic, 1, SPARSE_MAGIC_SIZE, bin_file) == SPARSE_MAGIC_SIZE &&
+        !memcmp(magic, SPARSE_MAGIC, SPARSE_MAGIC_SIZE)) {
+        rewind(bin_file);
+        bin_data = read_sparse(bin_file, x, y, t);
+        fclose(bin_file);
+        return bin_data;
+    }
+    rewind(bin_file);
+
     // alocando estrutura
     if (!(bin_data = aloca_bin(x, y, t))) {
         fclose(bin_file);
@@ -315,7 +492,10 @@ binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
 
 // Libera a alocação de 'bin_data'
 binary_data *free_bin(binary_data *bin_data) {
+    if (!bin_data)
+        return NULL;
     safeFree(bin_data->data);
+    free_sparse(bin_data->sparse);
     safeFree(bin_data);
 
     return NULL;
@@ -4,6 +4,7 @@
 #ifndef _CCTL_
 #define _CCTL_
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -13,6 +14,17 @@
 #define DATATYPE float
 #endif
 
+// Variantes por conjunto de instruções: funções marcadas com ISA_CLONES são compiladas para AVX-512, AVX2
+// e a genérica (SSE2 no x86-64); a variante é escolhida uma vez, na carga do programa (ifunc/cpuid),
+// então o mesmo binário usa o que cada máquina tem. `gcc -DNO_ISA_CLONES` compila só a genérica.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) && !defined(NO_ISA_CLONES)
+#define ISA_DISPATCH 1
+#define ISA_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define ISA_DISPATCH 0
+#define ISA_CLONES
+#endif
+
 // https://stackoverflow.com/questions/40591312/c-macro-how-to-get-an-integer-value-into-a-string-literal
 #define STR_IMPL_(x) #x      //stringify argument
 #define STR(x) STR_IMPL_(x)  //indirection to expand argument macros
@@ -71,15 +83,29 @@ typedef struct info_ctl_struct{
     char dump[BUFF_SIZE];   // restante do arquivo 
 } info_ctl;
 
+// Representação esparsa (arquivos escritos por `compose --sparse`): apenas os valores
+// diferentes de undef, ordenados pela posição (x,y) dentro de cada tempo t
+typedef struct sparse_data_struct{
+    size_t nnz;         // quantidade de valores guardados
+    size_t* offset;     // início de cada tempo t em 'idx' e 'val' (tdef+1 posições)
+    uint32_t* idx;      // posição x + x.def*y dentro do tempo, em ordem crescente
+    datatype* val;      // valores guardados
+} sparse_data;
+
 // Armazena todas as informações de um arquivo de dados binários
 typedef struct binary_data_struct{
-    datatype* data;
+    datatype* data;         // matriz densa (NULL quando esparso)
+    sparse_data* sparse;    // representação esparsa (NULL quando denso)
     info_ctl info;
 } binary_data;
 
 int check_dim(binary_data *f1, binary_data *f2);
 
 void saferFree(void **pp);
+
+// Nome da variante (ISA_CLONES) escolhida para esta CPU: "avx512f", "avx2" ou "default"
+const char* isa_variant(void);
+
 /* Abre o arquivo ctl 'name' e salva as informações em 'info_field'
  * retorna 1 em sucesso ou 0 em erro
 **/
@@ -101,10 +127,24 @@ binary_data* open_bin_ctl(char* name);
 binary_data* open_bin_info(info_ctl* info);
 
 /* Abre um arquivo o .bin 'name' com as informações passadas por parametro
+ * Arquivos esparsos são detectados pelo cabeçalho e ficam na representação esparsa.
  * Retorna o ponteiro para a struct de dado, ou NULL em erro
 **/
 binary_data* open_bin(char* name, size_t x, size_t y, size_t t);
 
+// Retorna 1 se o arquivo 'name' está no formato esparso, 0 caso contrário
+int is_sparse_file(char* name);
+
+/* Converte 'bin_data' da representação esparsa para a densa.
+ * Retorna 1 em sucesso ou 0 em erro
+**/
+int bin_to_dense(binary_data* bin_data);
+
+/* Copia para 'dest' os 'n' valores a partir da posição 'start' do vetor (ver 'get_pos'),
+ * seja o dado denso ou esparso (posições sem valor guardado recebem o undef de 'bin_data')
+**/
+void get_pos_range(binary_data* bin_data, size_t start, size_t n, datatype* dest);
+
 // Função para abrir arquivos .ctl e .bin associados
 // ctl_file: caminho para o arquivo .ctl
 // info: ponteiro para a estrutura de informações do arquivo .ctl
@@ -1,88 +1,929 @@
+#define _GNU_SOURCE // getopt_long
+#include <getopt.h>
+#include <unistd.h>     // pread
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "error_metrics.h"
+#if ISA_DISPATCH
+#include <immintrin.h> // variantes SSE2, AVX2 e AVX-512 das somas por bloco
+#endif
+
+// Pontos de cada trecho percorrido por block_errors_multi (múltiplo de ERR_LANES)
+#define MULTI_SPAN 512
+
+// soma os parciais 'b' em 'a'
+static void sums_add(ErrorSums *a, const ErrorSums *b) {
+    a->squared_error += b->squared_error;
+    a->absolute_error += b->absolute_error;
+    a->percentage_error += b->percentage_error;
+    a->count += b->count;
+}
+
+void reduction_init(ErrorReduction *r) {
+    r->top = 0;
+}
+
+void reduction_push(ErrorReduction *r, const ErrorSums *block) {
+    r->partial[r->top] = *block;
+    r->level[r->top] = 0;
+    r->top++;
+
+    // dois parciais do mesmo nível formam um nó da árvore
+    while (r->top >= 2 && r->level[r->top - 1] == r->level[r->top - 2]) {
+        sums_add(&(r->partial[r->top - 2]), &(r->partial[r->top - 1]));
+        r->level[r->top - 2]++;
+        r->top--;
+    }
+}
+
+ErrorSums reduction_result(const ErrorReduction *r) {
+    ErrorSums result = {0.0, 0.0, 0.0, 0};
+
+    // subárvores restantes, da menor (mais recente) para a maior
+    for (int i = r->top - 1; i >= 0; i--) {
+        ErrorSums partial = r->partial[i];
+        sums_add(&partial, &result);
+        result = partial;
+    }
+
+    return result;
+}
+
+// Acumuladores independentes de um bloco: o ponto i vai para o acumulador i % ERR_LANES e cada
+// acumulador soma seus pontos em ordem. As variantes abaixo fazem exatamente as mesmas operações
+// (só muda quantos acumuladores cabem em uma instrução), então o resultado é o mesmo em qualquer CPU.
+// A contagem fica em double: é exata, um bloco tem no máximo METRIC_BLOCK pontos.
+typedef struct {
+    double squared_error[ERR_LANES];
+    double absolute_error[ERR_LANES];
+    double percentage_error[ERR_LANES];
+    double count[ERR_LANES];
+} LaneSums;
+
+// Assinatura das variantes
+typedef void (*lane_fn)(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                        datatype undef_original, datatype undef_predicted);
+
+// Variante em C puro, referência das demais: acumula os 'n' pontos (múltiplo de ERR_LANES).
+// Sem desvios: pontos indefinidos somam zero
+static void lanes_generic(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                          datatype undef_original, datatype undef_predicted) {
+    for (size_t i = 0; i < n; i += ERR_LANES) {
+        for (size_t l = 0; l < ERR_LANES; l++) {
+            datatype orig_val = original[i + l], pred_val = predicted[i + l];
+            int valid = (orig_val != undef_original) & (pred_val != undef_predicted);
+            int valid_percentage = valid & (fabs(orig_val) > FLT_EPSILON); // Evita divisão por zero
+            double diff = valid ? (double)orig_val - (double)pred_val : 0.0;
+
+            lanes->squared_error[l] += diff * diff;
+            lanes->absolute_error[l] += fabs(diff);
+            lanes->percentage_error[l] += valid_percentage ? fabs(diff) / fabs((double)orig_val) : 0.0;
+            lanes->count[l] += valid;
+        }
+    }
+}
+
+#if ISA_DISPATCH
+// Variantes vetoriais, para datatype float (com outro tipo apenas lanes_generic é usada).
+// As seleções são feitas em float, antes da conversão (exata) para double: um ponto descartado
+// vira 0 - 0 e a sua divisão do percentual vira 0 / 1, ambos somam zero como na referência.
+
+// SSE2 (todo x86-64): 4 instruções de 2 acumuladores.
+// Aqui as máscaras são estendidas para 64 bits (cada float repetido) e as seleções feitas em double
+static void lanes_sse2(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                       datatype undef_original, datatype undef_predicted) {
+    const __m128 undef_o = _mm_set1_ps(undef_original), undef_p = _mm_set1_ps(undef_predicted);
+    const __m128 eps = _mm_set1_ps(FLT_EPSILON);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+    __m128d squared[4], absolute[4], percentage[4], count[4];
+
+    for (int q = 0; q < 4; q++) {
+        squared[q] = _mm_loadu_pd(lanes->squared_error + 2 * q);
+        absolute[q] = _mm_loadu_pd(lanes->absolute_error + 2 * q);
+        percentage[q] = _mm_loadu_pd(lanes->percentage_error + 2 * q);
+        count[q] = _mm_loadu_pd(lanes->count + 2 * q);
+    }
+
+    for (size_t i = 0; i < n; i += ERR_LANES) {
+        for (int h = 0; h < 2; h++) {
+            __m128 orig = _mm_loadu_ps((const float *)original + i + 4 * h);
+            __m128 pred = _mm_loadu_ps((const float *)predicted + i + 4 * h);
+            __m128 valid = _mm_and_ps(_mm_cmpneq_ps(orig, undef_o), _mm_cmpneq_ps(pred, undef_p));
+            __m128 valid_pct = _mm_and_ps(valid, _mm_cmpgt_ps(_mm_and_ps(orig, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))), eps));
+
+            // parte baixa: acumuladores 4h, 4h+1; parte alta: 4h+2, 4h+3
+            for (int p = 0; p < 2; p++) {
+                int q = 2 * h + p;
+                __m128d valid_d = _mm_castps_pd(p ? _mm_unpackhi_ps(valid, valid) : _mm_unpacklo_ps(valid, valid));
+                __m128d pct_d = _mm_castps_pd(p ? _mm_unpackhi_ps(valid_pct, valid_pct) : _mm_unpacklo_ps(valid_pct, valid_pct));
+                __m128d orig_d = _mm_cvtps_pd(p ? _mm_movehl_ps(orig, orig) : orig);
+                __m128d pred_d = _mm_cvtps_pd(p ? _mm_movehl_ps(pred, pred) : pred);
+                __m128d diff = _mm_and_pd(_mm_sub_pd(orig_d, pred_d), valid_d);
+                __m128d abs_diff = _mm_and_pd(diff, abs_mask);
+                __m128d divisor = _mm_or_pd(_mm_and_pd(pct_d, _mm_and_pd(orig_d, abs_mask)), _mm_andnot_pd(pct_d, one));
+
+                squared[q] = _mm_add_pd(squared[q], _mm_mul_pd(diff, diff));
+                absolute[q] = _mm_add_pd(absolute[q], abs_diff);
+                percentage[q] = _mm_add_pd(percentage[q], _mm_div_pd(_mm_and_pd(abs_diff, pct_d), divisor));
+                count[q] = _mm_add_pd(count[q], _mm_and_pd(valid_d, one));
+            }
+        }
+    }
+
+    for (int q = 0; q < 4; q++) {
+        _mm_storeu_pd(lanes->squared_error + 2 * q, squared[q]);
+        _mm_storeu_pd(lanes->absolute_error + 2 * q, absolute[q]);
+        _mm_storeu_pd(lanes->percentage_error + 2 * q, percentage[q]);
+        _mm_storeu_pd(lanes->count + 2 * q, count[q]);
+    }
+}
+
+// Metade 'h' (acumuladores 4h..4h+3) de 8 floats
+__attribute__((target("avx2")))
+static inline __m128 half_ps(__m256 v, int h) {
+    return h ? _mm256_extractf128_ps(v, 1) : _mm256_castps256_ps128(v);
+}
+
+// Máscara de 4 floats estendida para 4 doubles
+__attribute__((target("avx2")))
+static inline __m256d wide_mask(__m128 mask) {
+    return _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_castps_si128(mask)));
+}
+
+// AVX2: 2 instruções de 4 acumuladores
+__attribute__((target("avx2")))
+static void lanes_avx2(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                       datatype undef_original, datatype undef_predicted) {
+    const __m256 undef_o = _mm256_set1_ps(undef_original), undef_p = _mm256_set1_ps(undef_predicted);
+    const __m256 eps = _mm256_set1_ps(FLT_EPSILON);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d abs_mask_d = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d squared[2], absolute[2], percentage[2], count[2];
+
+    for (int h = 0; h < 2; h++) {
+        squared[h] = _mm256_loadu_pd(lanes->squared_error + 4 * h);
+        absolute[h] = _mm256_loadu_pd(lanes->absolute_error + 4 * h);
+        percentage[h] = _mm256_loadu_pd(lanes->percentage_error + 4 * h);
+        count[h] = _mm256_loadu_pd(lanes->count + 4 * h);
+    }
+
+    for (size_t i = 0; i < n; i += ERR_LANES) {
+        __m256 orig = _mm256_loadu_ps((const float *)original + i), pred = _mm256_loadu_ps((const float *)predicted + i);
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(orig, undef_o, _CMP_NEQ_UQ), _mm256_cmp_ps(pred, undef_p, _CMP_NEQ_UQ));
+        __m256 valid_pct = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_and_ps(orig, abs_mask), eps, _CMP_GT_OQ));
+
+        for (int h = 0; h < 2; h++) {
+            __m256d valid_d = wide_mask(half_ps(valid, h)), pct_d = wide_mask(half_ps(valid_pct, h));
+            __m256d orig_d = _mm256_cvtps_pd(half_ps(orig, h));
+            __m256d diff = _mm256_and_pd(_mm256_sub_pd(orig_d, _mm256_cvtps_pd(half_ps(pred, h))), valid_d);
+            __m256d abs_diff = _mm256_and_pd(diff, abs_mask_d);
+            __m256d divisor = _mm256_blendv_pd(one, _mm256_and_pd(orig_d, abs_mask_d), pct_d);
+
+            squared[h] = _mm256_add_pd(squared[h], _mm256_mul_pd(diff, diff));
+            absolute[h] = _mm256_add_pd(absolute[h], abs_diff);
+            percentage[h] = _mm256_add_pd(percentage[h], _mm256_div_pd(_mm256_and_pd(abs_diff, pct_d), divisor));
+            count[h] = _mm256_add_pd(count[h], _mm256_and_pd(valid_d, one));
+        }
+    }
+
+    for (int h = 0; h < 2; h++) {
+        _mm256_storeu_pd(lanes->squared_error + 4 * h, squared[h]);
+        _mm256_storeu_pd(lanes->absolute_error + 4 * h, absolute[h]);
+        _mm256_storeu_pd(lanes->percentage_error + 4 * h, percentage[h]);
+        _mm256_storeu_pd(lanes->count + 4 * h, count[h]);
+    }
+}
+
+// AVX-512: 1 instrução com os 8 acumuladores
+__attribute__((target("avx512f")))
+static void lanes_avx512(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                         datatype undef_original, datatype undef_predicted) {
+    const __m256 undef_o = _mm256_set1_ps(undef_original), undef_p = _mm256_set1_ps(undef_predicted);
+    const __m256 eps = _mm256_set1_ps(FLT_EPSILON), one = _mm256_set1_ps(1.0f);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m512d squared = _mm512_loadu_pd(lanes->squared_error);
+    __m512d absolute = _mm512_loadu_pd(lanes->absolute_error);
+    __m512d percentage = _mm512_loadu_pd(lanes->percentage_error);
+    __m512d count = _mm512_loadu_pd(lanes->count);
+
+    for (size_t i = 0; i < n; i += ERR_LANES) {
+        __m256 orig = _mm256_loadu_ps((const float *)original + i), pred = _mm256_loadu_ps((const float *)predicted + i);
+        __m256 orig_abs = _mm256_and_ps(orig, abs_mask);
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(orig, undef_o, _CMP_NEQ_UQ), _mm256_cmp_ps(pred, undef_p, _CMP_NEQ_UQ));
+        __m256 valid_pct = _mm256_and_ps(valid, _mm256_cmp_ps(orig_abs, eps, _CMP_GT_OQ));
+        __m512d diff = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_and_ps(orig, valid)), _mm512_cvtps_pd(_mm256_and_ps(pred, valid)));
+        __m512d diff_pct = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_and_ps(orig, valid_pct)), _mm512_cvtps_pd(_mm256_and_ps(pred, valid_pct)));
+        __m512d divisor = _mm512_cvtps_pd(_mm256_blendv_ps(one, orig_abs, valid_pct));
+
+        squared = _mm512_add_pd(squared, _mm512_mul_pd(diff, diff));
+        absolute = _mm512_add_pd(absolute, _mm512_abs_pd(diff));
+        percentage = _mm512_add_pd(percentage, _mm512_div_pd(_mm512_abs_pd(diff_pct), divisor));
+        count = _mm512_add_pd(count, _mm512_cvtps_pd(_mm256_and_ps(valid, one)));
+    }
+
+    _mm512_storeu_pd(lanes->squared_error, squared);
+    _mm512_storeu_pd(lanes->absolute_error, absolute);
+    _mm512_storeu_pd(lanes->percentage_error, percentage);
+    _mm512_storeu_pd(lanes->count, count);
+}
+
+// Escolhe a variante na carga do programa (ifunc), na mesma ordem de isa_variant
+static lane_fn resolve_lanes(void) {
+    if (sizeof(datatype) != sizeof(float)) return lanes_generic;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return lanes_avx512;
+    if (__builtin_cpu_supports("avx2")) return lanes_avx2;
+    return lanes_sse2;
+}
+
+static void lanes_add(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                      datatype undef_original, datatype undef_predicted) __attribute__((ifunc("resolve_lanes")));
+#else
+#define lanes_add lanes_generic
+#endif
+
+// Soma os acumuladores, sempre na mesma ordem
+static ErrorSums lane_result(const LaneSums *lanes) {
+    ErrorSums sums = {0.0, 0.0, 0.0, 0};
+
+    for (size_t l = 0; l < ERR_LANES; l++) {
+        sums.squared_error += lanes->squared_error[l];
+        sums.absolute_error += lanes->absolute_error[l];
+        sums.percentage_error += lanes->percentage_error[l];
+        sums.count += (size_t)lanes->count[l];
+    }
+    return sums;
+}
+
+// Acumula os 'n' (< ERR_LANES) últimos pontos, completados com indefinidos que somam zero
+static void lanes_tail(LaneSums *lanes, const datatype *original, const datatype *predicted, size_t n,
+                       datatype undef_original, datatype undef_predicted) {
+    datatype orig_tail[ERR_LANES], pred_tail[ERR_LANES];
+
+    for (size_t l = 0; l < ERR_LANES; l++) {
+        orig_tail[l] = (l < n) ? original[l] : undef_original;
+        pred_tail[l] = (l < n) ? predicted[l] : undef_predicted;
+    }
+    lanes_add(lanes, orig_tail, pred_tail, ERR_LANES, undef_original, undef_predicted);
+}
+
+ErrorSums block_errors(const datatype *original, const datatype *predicted, size_t n, datatype undef_original, datatype undef_predicted) {
+    LaneSums lanes;
+    size_t full = n - n % ERR_LANES;
+
+    memset(&lanes, 0, sizeof(lanes));
+    lanes_add(&lanes, original, predicted, full, undef_original, undef_predicted);
+    lanes_tail(&lanes, original + full, predicted + full, n - full, undef_original, undef_predicted);
+
+    return lane_result(&lanes);
+}
+
+void block_errors_multi(const datatype *original, const datatype *const *predicted, size_t n_pred, size_t n,
+                        datatype undef_original, const datatype *undef_predicted, ErrorSums *out) {
+    LaneSums lanes[n_pred];
+    size_t full = n - n % ERR_LANES;
+
+    memset(lanes, 0, sizeof(lanes));
+
+    // trechos curtos do original, percorridos para todos os previstos enquanto estão no cache;
+    // para cada previsto os acumuladores recebem os pontos na mesma ordem de block_errors
+    for (size_t start = 0; start < full; start += MULTI_SPAN) {
+        size_t len = (full - start < MULTI_SPAN) ? full - start : MULTI_SPAN;
+
+        for (size_t k = 0; k < n_pred; k++) {
+            lanes_add(&(lanes[k]), original + start, predicted[k] + start, len, undef_original, undef_predicted[k]);
+        }
+    }
+
+    for (size_t k = 0; k < n_pred; k++) {
+        lanes_tail(&(lanes[k]), original + full, predicted[k] + full, n - full, undef_original, undef_predicted[k]);
+        out[k] = lane_result(&(lanes[k]));
+    }
+}
+
+ErrorMetrics metrics_from_sums(const ErrorSums *sums) {
+    ErrorMetrics metrics = {0.0, 0.0, 0.0, 0.0};
+
+    if (sums->count > 0) {
+        metrics.rmse = sqrt(sums->squared_error / sums->count);
+        metrics.mae = sums->absolute_error / sums->count;
+        metrics.mse = sums->squared_error / sums->count;
+        metrics.percentage_error = (sums->percentage_error / sums->count) * 100;
+    }
+
+    return metrics;
+}
 
 ErrorMetrics calculate_all_errors(binary_data *original, binary_data *predicted) {
-    float sum_squared_error = 0.0;
-    float sum_absolute_error = 0.0;
-    float sum_percentage_error = 0.0;
-    size_t count = 0;
     size_t total_elements = original->info.x.def * original->info.y.def * original->info.tdef;
-    float *original_data = original->data;
-    float *predicted_data = predicted->data;
-    float undef_original = original->info.undef;
-    float undef_predicted = predicted->info.undef;
+    size_t n_blocks = (total_elements + METRIC_BLOCK - 1) / METRIC_BLOCK;
+    ErrorSums *blocks = malloc(n_blocks * sizeof(ErrorSums));
+    ErrorReduction reduction;
+
+    if (!blocks) {
+        fprintf(stderr, "Erro ao alocar memória para a redução (%s:%d).\n", __FILE__, __LINE__);
+        exit(1);
+    }
+
+    // cada bloco tem tamanho fixo e é somado por uma única thread,
+    // a divisão entre threads não altera nenhum parcial
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < n_blocks; b++) {
+        size_t start = b * METRIC_BLOCK;
+        size_t n = (total_elements - start < METRIC_BLOCK) ? total_elements - start : METRIC_BLOCK;
+
+        blocks[b] = block_errors(original->data + start, predicted->data + start, n,
+                                 original->info.undef, predicted->info.undef);
+    }
+
+    // árvore de soma aos pares sobre os blocos, sempre na mesma ordem
+    reduction_init(&reduction);
+    for (size_t b = 0; b < n_blocks; b++) {
+        reduction_push(&reduction, &(blocks[b]));
+    }
 
-    #pragma omp parallel
+    free(blocks);
+
+    ErrorSums sums = reduction_result(&reduction);
+    return metrics_from_sums(&sums);
+}
+
+static int compare_int(const void *a, const void *b) {
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+void free_zonal_stats(ZonalStats *zones) {
+    if (!zones) return;
+    free(zones->labels);
+    free(zones->zone_of);
+    free(zones->block_start);
+    free(zones->block_zone);
+    free(zones->sums);
+    free(zones);
+}
+
+// Índice da região do elemento 'i' dos dados (-1 = ignorado)
+static inline int zone_at(const ZonalStats *zones, size_t i) {
+    return zones->zone_of[zones->broadcast ? i % zones->n_cells : i];
+}
+
+// Regiões presentes no bloco 'b' dos dados ('total' elementos), na ordem em que aparecem.
+// Se 'out' não é NULL as regiões são escritas nele. 'seen' (n_labels posições) guarda
+// o último bloco em que cada região apareceu.
+// Retorna a quantidade de regiões do bloco
+static size_t block_zones(const ZonalStats *zones, size_t b, size_t total, size_t *seen, int *out) {
+    size_t start = b * METRIC_BLOCK;
+    size_t end = (start + METRIC_BLOCK < total) ? start + METRIC_BLOCK : total;
+    size_t n = 0;
+
+    for (size_t i = start; i < end; i++) {
+        int z = zone_at(zones, i);
+        if (z < 0 || seen[z] == b) continue;
+        seen[z] = b;
+        if (out) out[n] = z;
+        n++;
+    }
+    return n;
+}
+
+ZonalStats *prepare_zones(binary_data *labels, info_ctl *data, size_t n_pred) {
+    size_t n_cells = data->x.def * data->y.def;
+    size_t total_elements = n_cells * data->tdef;
+    size_t n_blocks = (total_elements + METRIC_BLOCK - 1) / METRIC_BLOCK;
+    size_t n_label_cells = n_cells * labels->info.tdef;
+    int broadcast = (labels->info.tdef == 1);
+
+    if (labels->info.x.def != data->x.def || labels->info.y.def != data->y.def ||
+        (!broadcast && labels->info.tdef != data->tdef)) {
+        fprintf(stderr, "ERRO: grade de rótulos incompatível com os dados (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    ZonalStats *zones = calloc(1, sizeof(ZonalStats));
+
+    if (!zones || !(zones->zone_of = malloc(n_label_cells * sizeof(int))) ||
+        !(zones->labels = malloc(n_label_cells * sizeof(int))) ||
+        !(zones->block_start = malloc((n_blocks + 1) * sizeof(size_t)))) {
+        fprintf(stderr, "ERRO: não foi possível alocar memória (%s:%d).\n", __FILE__, __LINE__);
+        free_zonal_stats(zones);
+        return NULL;
+    }
+    zones->n_cells = n_cells;
+    zones->broadcast = broadcast;
+    zones->n_pred = n_pred;
+
+    // rótulos distintos, em ordem crescente
+    size_t n = 0;
+    for (size_t i = 0; i < n_label_cells; i++) {
+        if (labels->data[i] != labels->info.undef) zones->labels[n++] = (int)labels->data[i];
+    }
+    qsort(zones->labels, n, sizeof(int), compare_int);
+
+    size_t n_labels = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!n_labels || zones->labels[n_labels - 1] != zones->labels[i])
+            zones->labels[n_labels++] = zones->labels[i];
+    }
+    zones->n_labels = n_labels;
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n_label_cells; i++) {
+        int label = (int)labels->data[i];
+        int *found = (labels->data[i] == labels->info.undef) ? NULL :
+                     bsearch(&label, zones->labels, n_labels, sizeof(int), compare_int);
+        zones->zone_of[i] = found ? (int)(found - zones->labels) : -1;
+    }
+
+    int ok = (zones->sums = calloc(n_pred * (n_labels ? n_labels : 1), sizeof(ErrorSums))) != NULL;
+
+    // regiões de cada bloco: quantidade, posição de cada lista e depois as listas
+    #pragma omp parallel reduction(&&:ok)
     {
-        float local_sum_squared_error = 0.0;
-        float local_sum_absolute_error = 0.0;
-        float local_sum_percentage_error = 0.0;
-        size_t local_count = 0;
-
-        #pragma omp for nowait
-        for (size_t i = 0; i < total_elements; i++) {
-            float orig_val = original_data[i];
-            float pred_val = predicted_data[i];
-
-            if (orig_val != undef_original && pred_val != undef_predicted) {
-                float diff = orig_val - pred_val;
-
-                local_sum_squared_error += diff * diff;
-                local_sum_absolute_error += fabs(diff);
-                if (fabs(orig_val) > FLT_EPSILON) { // Evita divisão por zero
-                    local_sum_percentage_error += fabs(diff) / fabs(orig_val);
-                }
-                local_count++;
-            }
+        size_t *seen = malloc((n_labels ? n_labels : 1) * sizeof(size_t));
+        ok = ok && seen;
+
+        for (size_t z = 0; seen && z < n_labels; z++) seen[z] = SIZE_MAX;
+
+        #pragma omp for schedule(static)
+        for (size_t b = 0; b < n_blocks; b++) {
+            zones->block_start[b + 1] = seen ? block_zones(zones, b, total_elements, seen, NULL) : 0;
         }
 
-        #pragma omp critical
+        #pragma omp single
         {
-            sum_squared_error += local_sum_squared_error;
-            sum_absolute_error += local_sum_absolute_error;
-            sum_percentage_error += local_sum_percentage_error;
-            count += local_count;
+            zones->block_start[0] = 0;
+            for (size_t b = 0; b < n_blocks; b++) zones->block_start[b + 1] += zones->block_start[b];
+            zones->block_zone = malloc((zones->block_start[n_blocks] ? zones->block_start[n_blocks] : 1) * sizeof(int));
+        }
+
+        for (size_t z = 0; seen && z < n_labels; z++) seen[z] = SIZE_MAX;
+
+        #pragma omp for schedule(static)
+        for (size_t b = 0; b < n_blocks; b++) {
+            if (seen && zones->block_zone) block_zones(zones, b, total_elements, seen, zones->block_zone + zones->block_start[b]);
         }
+
+        free(seen);
     }
 
-    ErrorMetrics metrics = {0.0, 0.0, 0.0, 0.0};
-    if (count > 0) {
-        metrics.rmse = sqrt(sum_squared_error / count);
-        metrics.mae = sum_absolute_error / count;
-        metrics.mse = sum_squared_error / count;
-        metrics.percentage_error = (sum_percentage_error / count) * 100;
+    if (!ok || !zones->block_zone) {
+        fprintf(stderr, "ERRO: não foi possível alocar memória (%s:%d).\n", __FILE__, __LINE__);
+        free_zonal_stats(zones);
+        return NULL;
     }
 
-    return metrics;
+    return zones;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <original_file> <interpolated_file>\n", argv[0]);
-        return 1;
+// Somas por região do bloco 'b' dos dados ('n' elementos) para 'n_pred' previstos:
+// 'out[k * n_present + j]' recebe as somas do previsto k na j-ésima região presente no bloco.
+// 'slot' (n_labels posições) guarda a posição de cada região dentro do bloco.
+static void block_zone_errors(const ZonalStats *zones, size_t b, const datatype *original, const datatype *const *predicted,
+                              size_t n_pred, size_t n, datatype undef_original, const datatype *undef_predicted,
+                              int *slot, ErrorSums *out) {
+    const int *present = zones->block_zone + zones->block_start[b];
+    size_t n_present = zones->block_start[b + 1] - zones->block_start[b];
+    size_t first = b * METRIC_BLOCK;
+
+    for (size_t j = 0; j < n_present; j++) slot[present[j]] = (int)j;
+    memset(out, 0, n_pred * n_present * sizeof(ErrorSums));
+
+    for (size_t k = 0; k < n_pred; k++) {
+        ErrorSums *acc = out + k * n_present;
+
+        for (size_t i = 0; i < n; i++) {
+            int z = zone_at(zones, first + i);
+            if (z < 0) continue;
+            add_point_error(&(acc[slot[z]]), original[i], predicted[k][i], undef_original, undef_predicted[k]);
+        }
     }
+}
 
-    const char *original_file = argv[1];
-    const char *interpolated_file = argv[2];
+// Arquivo lido em fluxo: o .bin aberto em 'fd' ou, se o arquivo for esparso, os valores
+// guardados já na memória (apenas os diferentes de undef), expandidos a cada pedaço
+typedef struct {
+    int fd;
+    binary_data *sparse;
+} StreamSource;
 
-    info_ctl original_info, interpolated_info;
-    binary_data *original_bin_data, *interpolated_bin_data;
+// Lê 'n' valores a partir do elemento 'start' de 'src'
+// Retorna 1 em sucesso ou 0 em erro
+static int read_values(StreamSource *src, datatype *buffer, size_t start, size_t n) {
+    char *dest = (char *)buffer;
+    size_t bytes = n * sizeof(datatype);
+    off_t offset = (off_t)(start * sizeof(datatype));
 
-    if (!open_files(original_file, &original_info, &original_bin_data) ||
-        !open_files(interpolated_file, &interpolated_info, &interpolated_bin_data)) {
-        free(original_bin_data);
-        free(interpolated_bin_data);
+    if (src->sparse) {
+        get_pos_range(src->sparse, start, n, buffer);
         return 1;
     }
 
-    ErrorMetrics metrics = calculate_all_errors(original_bin_data, interpolated_bin_data);
+    for (size_t done = 0; done < bytes;) {
+        ssize_t r = pread(src->fd, dest + done, bytes - done, offset + done);
+        if (r <= 0) return 0;
+        done += r;
+    }
+    return 1;
+}
+
+// Abre o .bin de 'info' para leitura e confere se tem ao menos 'total' valores
+// Retorna 1 em sucesso ou 0 em erro
+static int open_stream(info_ctl *info, size_t total, StreamSource *src) {
+    struct stat st;
+
+    src->fd = -1;
+    src->sparse = NULL;
+
+    if (is_sparse_file(info->bin_filename)) {
+        return (src->sparse = open_bin_info(info)) != NULL;
+    }
+
+    int fd = open(info->bin_filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "ERRO: não foi possível abrir %s (%s:%d).\n", info->bin_filename, __FILE__, __LINE__);
+        return 0;
+    }
+    if (fstat(fd, &st) || (size_t)st.st_size < total * sizeof(datatype)) {
+        fprintf(stderr, "ERRO: %s menor que o indicado no .ctl (%s:%d).\n", info->bin_filename, __FILE__, __LINE__);
+        close(fd);
+        return 0;
+    }
+    src->fd = fd;
+    return 1;
+}
+
+// Fecha o arquivo (ou libera os valores) de 'src'
+static void close_stream(StreamSource *src) {
+    if (src->sparse) free_bin(src->sparse);
+    else close(src->fd);
+}
+
+// Trecho de um bloco dentro de um único tempo
+typedef struct {
+    size_t start;
+    size_t n;
+    size_t t;
+} StreamSegment;
+
+// Quantidade de valores do pedaço que começa em 'start'
+static size_t chunk_length(size_t start, size_t chunk_size, size_t total) {
+    return (total - start < chunk_size) ? total - start : chunk_size;
+}
+
+int stream_errors(info_ctl *original, info_ctl *predicted, size_t n_pred, size_t chunk_blocks, ErrorSums *sums, ErrorSums **time_sums, ZonalStats *zones) {
+    size_t n_cells = original->x.def * original->y.def;
+    size_t total_elements = n_cells * original->tdef;
+    size_t chunk_size = chunk_blocks * METRIC_BLOCK;
+    size_t n_chunks = (total_elements + chunk_size - 1) / chunk_size;
+    // cada fronteira de tempo dentro do pedaço divide um bloco em dois trechos
+    size_t max_segments = chunk_blocks + chunk_size / n_cells + 2;
+    size_t n_files = n_pred + 1;    // arquivo 0 é o original
+
+    StreamSource *src = malloc(n_files * sizeof(StreamSource));
+    datatype **buffers = calloc(2 * n_files, sizeof(datatype *));  // [buffer][arquivo]
+    datatype *undef_predicted = malloc(n_pred * sizeof(datatype));
+    ErrorSums *blocks = malloc(chunk_blocks * n_pred * sizeof(ErrorSums));
+    ErrorReduction *reduction = malloc(n_pred * sizeof(ErrorReduction));
+    ErrorReduction *time_reduction = time_sums ? malloc(n_pred * sizeof(ErrorReduction)) : NULL;
+    StreamSegment *segments = time_sums ? malloc(max_segments * sizeof(StreamSegment)) : NULL;
+    ErrorSums *segment_sums = time_sums ? malloc(max_segments * n_pred * sizeof(ErrorSums)) : NULL;
+    size_t n_open = 0;
+
+    // somas por região dos blocos de um pedaço, apenas das regiões presentes em cada bloco
+    size_t total_blocks = (total_elements + METRIC_BLOCK - 1) / METRIC_BLOCK;
+    size_t zone_cap = 1;
+    for (size_t b0 = 0; zones && b0 < total_blocks; b0 += chunk_blocks) {
+        size_t b1 = (b0 + chunk_blocks < total_blocks) ? b0 + chunk_blocks : total_blocks;
+        if (zones->block_start[b1] - zones->block_start[b0] > zone_cap) zone_cap = zones->block_start[b1] - zones->block_start[b0];
+    }
+    ErrorSums *zone_partial = zones ? malloc(zone_cap * n_pred * sizeof(ErrorSums)) : NULL;
+    int *zone_slot = zones ? malloc(omp_get_max_threads() * (zones->n_labels ? zones->n_labels : 1) * sizeof(int)) : NULL;
 
+    int ok = src && buffers && undef_predicted && blocks && reduction &&
+             (!time_sums || (time_reduction && segments && segment_sums)) &&
+             (!zones || (zone_partial && zone_slot));
+
+    for (size_t f = 0; ok && f < 2 * n_files; f++) {
+        ok = (buffers[f] = malloc(chunk_size * sizeof(datatype))) != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "ERRO: não foi possível alocar memória (%s:%d).\n", __FILE__, __LINE__);
+    }
+
+    for (; ok && n_open < n_files; n_open++) {
+        ok = open_stream(n_open ? &(predicted[n_open - 1]) : original, total_elements, &(src[n_open]));
+    }
+    if (!ok && n_open) n_open--;    // o último não foi aberto
+
+    for (size_t k = 0; ok && k < n_pred; k++) {
+        undef_predicted[k] = predicted[k].undef;
+        reduction_init(&(reduction[k]));
+        if (time_sums) reduction_init(&(time_reduction[k]));
+    }
+    size_t current_t = 0;
+
+    size_t first = chunk_length(0, chunk_size, total_elements);
+    for (size_t f = 0; ok && f < n_files; f++) {
+        if (!read_values(&(src[f]), buffers[f], 0, first)) {
+            fprintf(stderr, "ERRO: falha de leitura (%s:%d).\n", __FILE__, __LINE__);
+            ok = 0;
+        }
+    }
+
+    for (size_t c = 0; ok && c < n_chunks; c++) {
+        datatype **cur = buffers + (c % 2) * n_files;
+        datatype **next = buffers + ((c + 1) % 2) * n_files;
+        size_t chunk_start = c * chunk_size;
+        size_t first_block = chunk_start / METRIC_BLOCK;
+        size_t n = chunk_length(chunk_start, chunk_size, total_elements);
+        size_t n_blocks = (n + METRIC_BLOCK - 1) / METRIC_BLOCK;
+        size_t n_segments = 0;
+        int read_ok = 1;
+
+        // trechos de cada tempo, na ordem do arquivo
+        if (time_sums) {
+            for (size_t b = 0; b < n_blocks; b++) {
+                size_t start = b * METRIC_BLOCK;
+                size_t end = (start + METRIC_BLOCK < n) ? start + METRIC_BLOCK : n;
+
+                while (start < end) {
+                    size_t t = (chunk_start + start) / n_cells;
+                    size_t t_end = (t + 1) * n_cells - chunk_start;
+                    size_t seg_end = (t_end < end) ? t_end : end;
+
+                    segments[n_segments++] = (StreamSegment){start, seg_end - start, t};
+                    start = seg_end;
+                }
+            }
+        }
+
+        #pragma omp parallel
+        {
+            // uma thread lê o próximo pedaço enquanto as demais calculam o atual
+            #pragma omp master
+            if (c + 1 < n_chunks) {
+                size_t next_start = chunk_start + chunk_size;
+                size_t next_n = chunk_length(next_start, chunk_size, total_elements);
+
+                for (size_t f = 0; f < n_files && read_ok; f++) {
+                    read_ok = read_values(&(src[f]), next[f], next_start, next_n);
+                }
+            }
+
+            #pragma omp for schedule(dynamic) nowait
+            for (size_t b = 0; b < n_blocks; b++) {
+                size_t start = b * METRIC_BLOCK;
+                size_t len = (n - start < METRIC_BLOCK) ? n - start : METRIC_BLOCK;
+                const datatype *pred_ptr[n_pred];
+
+                for (size_t k = 0; k < n_pred; k++) pred_ptr[k] = cur[k + 1] + start;
+                block_errors_multi(cur[0] + start, pred_ptr, n_pred, len, original->undef, undef_predicted, blocks + b * n_pred);
+
+                // regiões no mesmo percurso, com o bloco ainda no cache
+                if (zones) {
+                    size_t gb = first_block + b;
+                    block_zone_errors(zones, gb, cur[0] + start, pred_ptr, n_pred, len, original->undef, undef_predicted,
+                                      zone_slot + omp_get_thread_num() * zones->n_labels,
+                                      zone_partial + (zones->block_start[gb] - zones->block_start[first_block]) * n_pred);
+                }
+            }
+
+            #pragma omp for schedule(dynamic)
+            for (size_t s = 0; s < n_segments; s++) {
+                size_t start = segments[s].start;
+                const datatype *pred_ptr[n_pred];
+
+                for (size_t k = 0; k < n_pred; k++) pred_ptr[k] = cur[k + 1] + start;
+                block_errors_multi(cur[0] + start, pred_ptr, n_pred, segments[s].n, original->undef, undef_predicted, segment_sums + s * n_pred);
+            }
+        }
+
+        // mesma sequência de blocos da versão em memória
+        for (size_t b = 0; b < n_blocks; b++) {
+            for (size_t k = 0; k < n_pred; k++) {
+                reduction_push(&(reduction[k]), &(blocks[b * n_pred + k]));
+            }
+        }
+
+        // regiões: somas dos blocos na ordem do arquivo
+        for (size_t b = 0; zones && b < n_blocks; b++) {
+            size_t gb = first_block + b;
+            const int *present = zones->block_zone + zones->block_start[gb];
+            size_t n_present = zones->block_start[gb + 1] - zones->block_start[gb];
+            const ErrorSums *part = zone_partial + (zones->block_start[gb] - zones->block_start[first_block]) * n_pred;
+
+            for (size_t k = 0; k < n_pred; k++) {
+                for (size_t j = 0; j < n_present; j++) {
+                    sums_add(&(zones->sums[k * zones->n_labels + present[j]]), &(part[k * n_present + j]));
+                }
+            }
+        }
+
+        for (size_t s = 0; s < n_segments; s++) {
+            if (segments[s].t != current_t) {
+                for (size_t k = 0; k < n_pred; k++) {
+                    time_sums[k][current_t] = reduction_result(&(time_reduction[k]));
+                    reduction_init(&(time_reduction[k]));
+                }
+                current_t = segments[s].t;
+            }
+            for (size_t k = 0; k < n_pred; k++) {
+                reduction_push(&(time_reduction[k]), &(segment_sums[s * n_pred + k]));
+            }
+        }
+
+        if (!read_ok) {
+            fprintf(stderr, "ERRO: falha de leitura (%s:%d).\n", __FILE__, __LINE__);
+            ok = 0;
+        }
+    }
+
+    for (size_t k = 0; ok && k < n_pred; k++) {
+        sums[k] = reduction_result(&(reduction[k]));
+        if (time_sums) time_sums[k][current_t] = reduction_result(&(time_reduction[k]));
+    }
+
+    for (size_t f = 0; f < n_open; f++) close_stream(&(src[f]));
+    for (size_t f = 0; buffers && f < 2 * n_files; f++) free(buffers[f]);
+    free(src);
+    free(buffers);
+    free(undef_predicted);
+    free(blocks);
+    free(reduction);
+    free(time_reduction);
+    free(segments);
+    free(segment_sums);
+    free(zone_partial);
+    free(zone_slot);
+
+    return ok;
+}
+
+#define USAGE "Usage: %s [-t] [-c blocks] [-l labels.ctl] <original_file> <interpolated_file> [interpolated_file ...]\n"
+
+// Imprime as métricas de 'sums' no formato de uma linha da tabela
+static void print_row(const ErrorSums *sums) {
+    ErrorMetrics m = metrics_from_sums(sums);
+    printf("%zu, %f, %f, %f, %f\n", sums->count, m.rmse, m.mae, m.mse, m.percentage_error);
+}
+
+static void print_metrics(ErrorMetrics metrics) {
     printf("RMSE: %f\n", metrics.rmse);
     printf("MAE: %f\n", metrics.mae);
     printf("MSE: %f\n", metrics.mse);
     printf("Percentage Error: %f%%\n", metrics.percentage_error);
+}
+
+// Compara 'n_pred' arquivos com o original em fluxo e imprime as métricas.
+// Com um único previsto mantém o formato de saída original, com mais de um
+// imprime uma linha por arquivo. Com 'labels_file' imprime também as métricas
+// de cada região, calculadas na mesma leitura.
+// Retorna 0 em sucesso ou 1 em erro
+static int stream_report(char *original_file, char **interpolated_files, size_t n_pred, size_t chunk_blocks, int per_time, const char *labels_file) {
+    info_ctl original_info, labels_info;
+    binary_data *labels = NULL;
+    ZonalStats *zones = NULL;
+    info_ctl *pred_info = malloc(n_pred * sizeof(info_ctl));
+    ErrorSums *sums = malloc(n_pred * sizeof(ErrorSums));
+    ErrorSums **time_sums = per_time ? calloc(n_pred, sizeof(ErrorSums *)) : NULL;
+    int ok = 1;
+
+    if (!pred_info || !sums || (per_time && !time_sums)) {
+        fprintf(stderr, "ERRO: não foi possível alocar memória (%s:%d).\n", __FILE__, __LINE__);
+        ok = 0;
+    }
+
+    if (ok && !open_ctl(&original_info, original_file)) {
+        fprintf(stderr, "Error reading .ctl file %s (%s:%d).\n", original_file, __FILE__, __LINE__);
+        ok = 0;
+    }
 
-    free_bin(original_bin_data);
-    free_bin(interpolated_bin_data);
+    for (size_t k = 0; ok && k < n_pred; k++) {
+        if (!open_ctl(&(pred_info[k]), interpolated_files[k])) {
+            fprintf(stderr, "Error reading .ctl file %s (%s:%d).\n", interpolated_files[k], __FILE__, __LINE__);
+            ok = 0;
+        } else if (original_info.x.def != pred_info[k].x.def || original_info.y.def != pred_info[k].y.def ||
+                   original_info.tdef != pred_info[k].tdef) {
+            fprintf(stderr, "ERRO: dimensões de %s diferentes do original (%s:%d).\n", interpolated_files[k], __FILE__, __LINE__);
+            ok = 0;
+        } else if (per_time && !(time_sums[k] = calloc(original_info.tdef, sizeof(ErrorSums)))) {
+            fprintf(stderr, "ERRO: não foi possível alocar memória (%s:%d).\n", __FILE__, __LINE__);
+            ok = 0;
+        }
+    }
+
+    // apenas a grade de rótulos fica inteira na memória
+    if (ok && labels_file) {
+        ok = open_files(labels_file, &labels_info, &labels) && bin_to_dense(labels) &&
+             (zones = prepare_zones(labels, &original_info, n_pred)) != NULL;
+        if (labels) free_bin(labels);
+    }
+
+    // apenas os pedaços sendo comparados ficam na memória
+    ok = ok && stream_errors(&original_info, pred_info, n_pred, chunk_blocks, sums, time_sums, zones);
+
+    if (ok && n_pred == 1) {
+        print_metrics(metrics_from_sums(&(sums[0])));
+
+        if (per_time) {
+            printf("\nt, count, RMSE, MAE, MSE, PERROR\n");
+            for (size_t t = 0; t < original_info.tdef; t++) {
+                printf("%zu, ", t + 1);
+                print_row(&(time_sums[0][t]));
+            }
+        }
+    } else if (ok) {
+        printf("file, count, RMSE, MAE, MSE, PERROR\n");
+        for (size_t k = 0; k < n_pred; k++) {
+            printf("%s, ", interpolated_files[k]);
+            print_row(&(sums[k]));
+        }
+
+        if (per_time) {
+            printf("\nfile, t, count, RMSE, MAE, MSE, PERROR\n");
+            for (size_t k = 0; k < n_pred; k++) {
+                for (size_t t = 0; t < original_info.tdef; t++) {
+                    printf("%s, %zu, ", interpolated_files[k], t + 1);
+                    print_row(&(time_sums[k][t]));
+                }
+            }
+        }
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (ok && zones) {
+        printf((n_pred == 1) ? "\nlabel, count, RMSE, MAE, MSE, PERROR\n" : "\nfile, label, count, RMSE, MAE, MSE, PERROR\n");
+        for (size_t k = 0; k < n_pred; k++) {
+            for (size_t z = 0; z < zones->n_labels; z++) {
+                if (n_pred > 1) printf("%s, ", interpolated_files[k]);
+                printf("%d, ", zones->labels[z]);
+                print_row(&(zones->sums[k * zones->n_labels + z]));
+            }
+        }
+    }
+
+    free_zonal_stats(zones);
+    for (size_t k = 0; time_sums && k < n_pred; k++) free(time_sums[k]);
+    free(time_sums);
+    free(sums);
+    free(pred_info);
+    return !ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *labels_file = NULL;
+    size_t chunk_blocks = STREAM_BLOCKS;
+    int per_time = 0;
+
+    static struct option long_options[] = {
+        {"labels", required_argument, NULL, 'l'},
+        {"per-time", no_argument, NULL, 't'},
+        {"chunk", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {"print-isa", no_argument, NULL, 'I'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:tc:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'l':
+                labels_file = optarg;
+                break;
+            case 't':
+                per_time = 1;
+                break;
+            case 'c':
+                chunk_blocks = atol(optarg);
+                break;
+            case 'h':
+                fprintf(stderr, USAGE, argv[0]);
+                fprintf(stderr, "  Vários interpolados são comparados ao original em uma única leitura.\n");
+                fprintf(stderr, "  -t, --per-time            Métricas também de cada tempo\n");
+                fprintf(stderr, "  -c, --chunk N             Blocos de %d valores lidos por vez (padrão %d)\n", METRIC_BLOCK, STREAM_BLOCKS);
+                fprintf(stderr, "  -l, --labels labels.ctl   Métricas também por região (rótulos inteiros, tdef 1 ou igual ao dos dados),\n");
+                fprintf(stderr, "                            na mesma leitura (apenas a grade de rótulos fica na memória)\n");
+                fprintf(stderr, "      --print-isa           Mostra a variante das somas vetorizadas escolhida para esta CPU\n");
+                return 0;
+            case 'I':
+                printf("%s\n", isa_variant());
+                return 0;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+    }
+
+    int n_pred = argc - optind - 1;
+    if (n_pred < 1 || !chunk_blocks) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    return stream_report(argv[optind], argv + optind + 1, n_pred, chunk_blocks, per_time, labels_file);
+}
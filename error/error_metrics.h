@@ -8,7 +8,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <omp.h> // Para paralelização
-#include <immintrin.h> // Para SIMD
+
+// Quantidade de elementos de cada bloco da redução.
+// O formato da árvore de soma depende apenas deste valor, nunca da quantidade de threads.
+#ifndef METRIC_BLOCK
+#define METRIC_BLOCK 4096
+#endif
+
+// Acumuladores independentes de cada bloco, somados em paralelo pelas variantes vetoriais.
+// Também fixo (as variantes assumem 8): mudar este valor muda os arredondamentos das somas.
+#define ERR_LANES 8
 
 // Estrutura para armazenar as métricas de erro
 typedef struct {
@@ -18,10 +27,103 @@ typedef struct {
     float percentage_error;
 } ErrorMetrics;
 
+// Somas parciais (em double) de um bloco ou de um conjunto de blocos
+typedef struct {
+    double squared_error;
+    double absolute_error;
+    double percentage_error;
+    size_t count;
+} ErrorSums;
+
+// Redução em árvore binária (soma aos pares) das somas de blocos consecutivos.
+// Funciona como um contador binário: dois parciais de mesmo nível são somados
+// assim que existem, então o resultado depende apenas da sequência de blocos.
+typedef struct {
+    ErrorSums partial[64];
+    int level[64];
+    int top;
+} ErrorReduction;
+
+// Inicializa a redução 'r' vazia
+void reduction_init(ErrorReduction *r);
+
+// Adiciona as somas do próximo bloco da sequência à redução 'r'
+void reduction_push(ErrorReduction *r, const ErrorSums *block);
+
+// Retorna a soma de todos os blocos adicionados à redução 'r'
+ErrorSums reduction_result(const ErrorReduction *r);
+
+// Somas dos erros de um bloco de 'n' elementos (n <= METRIC_BLOCK), em double e em ERR_LANES acumuladores
+// de ordem fixa: idênticas em todas as variantes (SSE2, AVX2, AVX-512) e quantidades de threads
+ErrorSums block_errors(const datatype *original, const datatype *predicted, size_t n, datatype undef_original, datatype undef_predicted);
+
+// Converte as somas em métricas de erro (zero se não houver pontos válidos)
+ErrorMetrics metrics_from_sums(const ErrorSums *sums);
+
 // Função para calcular todas as métricas de erro entre dados originais e previstos
 // original: ponteiro para os dados binários originais
 // predicted: ponteiro para os dados binários previstos
+// O resultado é idêntico (bit a bit) para qualquer quantidade de threads.
 // Retorna uma estrutura ErrorMetrics contendo todas as métricas calculadas
 ErrorMetrics calculate_all_errors(binary_data *original, binary_data *predicted);
 
-#endif // ERROR_METRICS_H
\ No newline at end of file
+// Quantidade padrão de blocos (METRIC_BLOCK) lidos por vez na comparação em fluxo.
+// A memória usada é de 2 buffers deste tamanho por arquivo, independente do tamanho dos arquivos.
+#ifndef STREAM_BLOCKS
+#define STREAM_BLOCKS 256
+#endif
+
+// Somas dos erros de um bloco de 'n' elementos para 'n_pred' dados previstos de uma vez.
+// Cada trecho do original é percorrido para todos os previstos enquanto está no cache.
+// 'out[k]' recebe as somas do previsto 'k', idênticas às de block_errors.
+void block_errors_multi(const datatype *original, const datatype *const *predicted, size_t n_pred, size_t n,
+                        datatype undef_original, const datatype *undef_predicted, ErrorSums *out);
+
+// Regiões de uma grade de rótulos (rótulos inteiros com tdef 1, repetida em todos os tempos,
+// ou o mesmo tdef dos dados). Quadrículas com rótulo indefinido são ignoradas.
+// As somas de cada região são acumuladas por bloco (METRIC_BLOCK) e somadas na ordem
+// dos blocos, então também não dependem da quantidade de threads nem do tamanho dos pedaços.
+typedef struct {
+    size_t n_labels;
+    int *labels;        // rótulos encontrados, em ordem crescente
+    int *zone_of;       // índice do rótulo de cada quadrícula da grade de rótulos (-1 = ignorada)
+    size_t n_cells;     // quadrículas de um tempo
+    int broadcast;      // grade de rótulos com um único tempo
+    size_t *block_start;    // início das regiões de cada bloco dos dados em 'block_zone' (blocos + 1 posições)
+    int *block_zone;        // regiões presentes em cada bloco, na ordem em que aparecem
+    size_t n_pred;
+    ErrorSums *sums;    // somas do previsto k e do rótulo z em sums[k * n_labels + z]
+} ZonalStats;
+
+// Prepara as regiões de 'labels' para comparar 'n_pred' previstos com dados de grade 'data'
+// Retorna NULL em erro
+ZonalStats *prepare_zones(binary_data *labels, info_ctl *data, size_t n_pred);
+
+// Libera a alocação de 'zones'
+void free_zonal_stats(ZonalStats *zones);
+
+// Compara os arquivos .bin de 'n_pred' dados previstos com o de 'original' sem carregar
+// as grades, lendo pedaços de 'chunk_blocks' blocos. Cada pedaço do original é lido uma
+// única vez para todos os previstos, e a leitura do próximo pedaço ocorre enquanto o
+// atual é calculado (buffer duplo).
+// 'sums[k]' recebe as somas totais do previsto 'k', idênticas (bit a bit) às de calculate_all_errors.
+// Se 'time_sums' não é NULL, 'time_sums[k]' recebe as somas de cada tempo (tdef posições).
+// Se 'zones' não é NULL, 'zones->sums' recebe as somas de cada região, no mesmo percurso de cada bloco.
+// Retorna 1 em sucesso ou 0 em erro
+int stream_errors(info_ctl *original, info_ctl *predicted, size_t n_pred, size_t chunk_blocks, ErrorSums *sums, ErrorSums **time_sums, ZonalStats *zones);
+
+// Acumula o erro de um ponto em 'sums' (ignora pontos indefinidos)
+static inline void add_point_error(ErrorSums *sums, datatype orig_val, datatype pred_val, datatype undef_original, datatype undef_predicted) {
+    if (orig_val != undef_original && pred_val != undef_predicted) {
+        double diff = (double)orig_val - (double)pred_val;
+
+        sums->squared_error += diff * diff;
+        sums->absolute_error += fabs(diff);
+        if (fabs(orig_val) > FLT_EPSILON) { // Evita divisão por zero
+            sums->percentage_error += fabs(diff) / fabs((double)orig_val);
+        }
+        sums->count++;
+    }
+}
+
+#endif // ERROR_METRICS_H
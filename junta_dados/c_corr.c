@@ -0,0 +1,328 @@
+#include "c_corr.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDEF_ERR (0.00001) // Erro permitido ao comparar com undef
+
+
+size_t radius_offsets(info_ctl* info, size_t y, double radius, double (*dist)(double,double,double,double), corr_offset* out){
+    double lon = info->x.i;
+    double lat = info->y.i + y * info->y.size;
+
+    // quantidade de passos em cada direção que cabem no raio
+    double width = dist(lon, lat, lon + info->x.size, lat);
+    double height = dist(lon, lat, lon, lat + info->y.size);
+    long steps_x = (width > 0) ? (long)(radius / width) : (long)info->x.def;
+    long steps_y = (height > 0) ? (long)(radius / height) : 0;
+
+    if (steps_x > (long)info->x.def) steps_x = info->x.def;
+
+    size_t n = 0;
+    for (long j = -steps_y; j <= steps_y; j++){
+        for (long i = -steps_x; i <= steps_x; i++){
+            double d = dist(lon, lat, lon + i * info->x.size, lat + j * info->y.size);
+
+            if (d < radius || (i == 0 && j == 0)){
+                if (out) out[n] = (corr_offset){i, j, d};
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+
+// correlação de Pearson a partir das somas, NAN se indefinida
+static float pearson(corr_sums* s){
+    if (s->n < CORR_MIN_PAIRS) return NAN;
+
+    double cov = s->n * s->sxy - s->sx * s->sy;
+    double var_x = s->n * s->sxx - s->sx * s->sx;
+    double var_y = s->n * s->syy - s->sy * s->sy;
+
+    if (var_x <= 0 || var_y <= 0) return NAN;
+
+    return cov / sqrt(var_x * var_y);
+}
+
+
+// aloca a tabela com os vizinhos de cada linha, 'max_k' recebe a maior quantidade de vizinhos
+static corr_table* alloc_corr_table(info_ctl* info, double radius, double (*dist)(double,double,double,double), size_t* max_k){
+    size_t x_def = info->x.def, y_def = info->y.def;
+
+    corr_table* table = calloc(1, sizeof(corr_table));
+    if (!table) return NULL;
+
+    table->x = x_def;
+    table->y = y_def;
+    table->t = info->tdef;
+
+    table->off_start = calloc(y_def + 1, sizeof(size_t));
+    table->cell_start = calloc(y_def + 1, sizeof(size_t));
+    if (!table->off_start || !table->cell_start){
+        free_corr_table(table);
+        return NULL;
+    }
+
+    *max_k = 0;
+    for (size_t y = 0; y < y_def; y++){
+        size_t k = radius_offsets(info, y, radius, dist, NULL);
+        if (k > *max_k) *max_k = k;
+
+        table->off_start[y + 1] = table->off_start[y] + k;
+        table->cell_start[y + 1] = table->cell_start[y] + x_def * k;
+    }
+
+    table->off = malloc(table->off_start[y_def] * sizeof(corr_offset));
+    table->corr = malloc(table->cell_start[y_def] * sizeof(float));
+    if (!table->off || !table->corr){
+        free_corr_table(table);
+        return NULL;
+    }
+
+    for (size_t y = 0; y < y_def; y++)
+        radius_offsets(info, y, radius, dist, table->off + table->off_start[y]);
+
+    return table;
+}
+
+// índice da k-ésima vizinha da quadrícula (x,y), -1 se estiver fora do dado
+static inline long neighbor(corr_table* table, corr_offset* off, size_t x, size_t y){
+    long xb = (long)x + off->dx, yb = (long)y + off->dy;
+
+    if (xb < 0 || yb < 0 || xb >= (long)table->x || yb >= (long)table->y) return -1;
+    return yb * table->x + xb;
+}
+
+
+corr_table* corr_full(binary_data* data, double radius, double (*dist)(double,double,double,double)){
+    info_ctl* info = &(data->info);
+    size_t x_def = info->x.def, y_def = info->y.def, tdef = info->tdef;
+    size_t n_xy = x_def * y_def;
+    size_t max_k;
+
+    corr_table* table = alloc_corr_table(info, radius, dist, &max_k);
+    if (!table) return NULL;
+
+    // séries de cada quadrícula em sequência: valor (0 se undef) e validade (0 ou 1)
+    float* series = malloc(n_xy * tdef * sizeof(float));
+    float* valid = malloc(n_xy * tdef * sizeof(float));
+
+    if (!series || !valid){
+        free(series);
+        free(valid);
+        free_corr_table(table);
+        return NULL;
+    }
+
+    #pragma omp parallel for
+    for (size_t c = 0; c < n_xy; c++){
+        for (size_t t = 0; t < tdef; t++){
+            datatype v = get_pos_val(data, t * n_xy + c);
+            int ok = fabs(v - info->undef) >= UNDEF_ERR;
+
+            series[c * tdef + t] = ok ? v : 0;
+            valid[c * tdef + t] = ok;
+        }
+    }
+
+    int ok = 1;
+
+    #pragma omp parallel reduction(&&:ok)
+    {
+        corr_sums* acc = malloc((max_k + 1) * sizeof(corr_sums));
+        ok = (acc != NULL);
+
+        #pragma omp for schedule(dynamic)
+        for (size_t a = 0; a < n_xy; a++){
+            if (!acc) continue;
+
+            size_t xa = a % x_def, ya = a / x_def;
+            size_t n_k = table->off_start[ya + 1] - table->off_start[ya];
+            corr_offset* off = table->off + table->off_start[ya];
+
+            memset(acc, 0, n_k * sizeof(corr_sums));
+
+            // blocos de tempo: a série de 'a' fica na cache enquanto percorre os vizinhos
+            for (size_t t0 = 0; t0 < tdef; t0 += CORR_BLOCK){
+                size_t t1 = (t0 + CORR_BLOCK < tdef) ? t0 + CORR_BLOCK : tdef;
+                const float* sa = series + a * tdef;
+                const float* va = valid + a * tdef;
+
+                for (size_t k = 0; k < n_k; k++){
+                    long b = neighbor(table, &off[k], xa, ya);
+                    if (b < 0) continue;
+
+                    const float* sb = series + b * tdef;
+                    const float* vb = valid + b * tdef;
+                    double n = 0, sx = 0, sy = 0, sxy = 0, sxx = 0, syy = 0;
+
+                    // valores indefinidos são 0, então basta multiplicar pela validade do outro
+                    #pragma omp simd reduction(+:n,sx,sy,sxy,sxx,syy)
+                    for (size_t t = t0; t < t1; t++){
+                        double x = sa[t], y = sb[t];
+                        n   += va[t] * vb[t];
+                        sx  += x * vb[t];
+                        sy  += y * va[t];
+                        sxy += x * y;
+                        sxx += x * x * vb[t];
+                        syy += y * y * va[t];
+                    }
+
+                    acc[k].n += n;
+                    acc[k].sx += sx;
+                    acc[k].sy += sy;
+                    acc[k].sxy += sxy;
+                    acc[k].sxx += sxx;
+                    acc[k].syy += syy;
+                }
+            }
+
+            float* corr = table->corr + table->cell_start[ya] + xa * n_k;
+            for (size_t k = 0; k < n_k; k++) corr[k] = pearson(&acc[k]);
+        }
+
+        free(acc);
+    }
+
+    free(series);
+    free(valid);
+
+    if (!ok){
+        free_corr_table(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+
+void free_corr_table(corr_table* table){
+    if (table){
+        free(table->off_start);
+        free(table->off);
+        free(table->cell_start);
+        free(table->corr);
+        free(table);
+    }
+}
+
+
+corr_window* corr_window_init(binary_data* data, double radius, double (*dist)(double,double,double,double), size_t window){
+    info_ctl* info = &(data->info);
+    size_t n_xy = info->x.def * info->y.def, tdef = info->tdef;
+    size_t max_k;
+
+    corr_window* win = calloc(1, sizeof(corr_window));
+    if (!win) return NULL;
+
+    win->half = window / 2;
+    win->t = -1;
+
+    if (!(win->table = alloc_corr_table(info, radius, dist, &max_k))){
+        free(win);
+        return NULL;
+    }
+
+    size_t pairs = win->table->cell_start[info->y.def];
+    win->sums = malloc(pairs * sizeof(corr_sums));
+    win->series = malloc(n_xy * tdef * sizeof(float));
+    win->valid = malloc(n_xy * tdef);
+
+    if (!win->sums || !win->series || !win->valid){
+        free_corr_window(win);
+        return NULL;
+    }
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < n_xy * tdef; i++){
+        datatype v = get_pos_val(data, i);
+        int ok = fabs(v - info->undef) >= UNDEF_ERR;
+
+        win->series[i] = ok ? v : 0;
+        win->valid[i] = ok;
+    }
+
+    return win;
+}
+
+
+// soma (sign = 1) ou retira (sign = -1) o tempo t das somas da quadrícula a
+static inline void window_update(corr_window* win, size_t a, size_t t, double sign){
+    corr_table* table = win->table;
+    size_t n_xy = table->x * table->y;
+    size_t xa = a % table->x, ya = a / table->x;
+
+    const float* series = win->series + t * n_xy;
+    const unsigned char* valid = win->valid + t * n_xy;
+
+    if (!valid[a]) return;
+
+    size_t n_k = table->off_start[ya + 1] - table->off_start[ya];
+    corr_offset* off = table->off + table->off_start[ya];
+    corr_sums* sums = win->sums + table->cell_start[ya] + xa * n_k;
+    double x = series[a];
+
+    for (size_t k = 0; k < n_k; k++){
+        long b = neighbor(table, &off[k], xa, ya);
+        if (b < 0 || !valid[b]) continue;
+
+        double y = series[b];
+        sums[k].n   += sign;
+        sums[k].sx  += sign * x;
+        sums[k].sy  += sign * y;
+        sums[k].sxy += sign * x * y;
+        sums[k].sxx += sign * x * x;
+        sums[k].syy += sign * y * y;
+    }
+}
+
+
+void corr_window_seek(corr_window* win, size_t t){
+    corr_table* table = win->table;
+    size_t n_xy = table->x * table->y;
+    long half = win->half, tdef = table->t;
+    long t_in = (long)t + half, t_out = (long)t - half - 1;
+
+    if (win->t == (long)t) return;
+
+    int slide = (win->t >= 0 && win->t + 1 == (long)t);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t a = 0; a < n_xy; a++){
+        size_t xa = a % table->x, ya = a / table->x;
+        size_t n_k = table->off_start[ya + 1] - table->off_start[ya];
+        corr_sums* sums = win->sums + table->cell_start[ya] + xa * n_k;
+
+        if (slide){
+            // um tempo entra e outro sai da janela
+            if (t_in < tdef) window_update(win, a, t_in, 1);
+            if (t_out >= 0) window_update(win, a, t_out, -1);
+        }
+        else{
+            memset(sums, 0, n_k * sizeof(corr_sums));
+
+            long t0 = (long)t - half, t1 = (long)t + half;
+            for (long i = (t0 < 0 ? 0 : t0); i <= t1 && i < tdef; i++) window_update(win, a, i, 1);
+        }
+
+        float* corr = table->corr + table->cell_start[ya] + xa * n_k;
+        for (size_t k = 0; k < n_k; k++) corr[k] = pearson(&sums[k]);
+    }
+
+    win->t = t;
+}
+
+
+void free_corr_window(corr_window* win){
+    if (win){
+        free_corr_table(win->table);
+        free(win->sums);
+        free(win->series);
+        free(win->valid);
+        free(win);
+    }
+}
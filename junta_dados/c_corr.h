@@ -0,0 +1,94 @@
+// Correlações entre séries temporais de quadrículas vizinhas
+// Para cada quadrícula do dado, guarda a correlação de Pearson da sua série
+// com a série de cada quadrícula dentro de um raio (incluindo ela mesma).
+// Os vizinhos dependem apenas da linha (latitude), então os deslocamentos
+// são guardados uma vez por linha e a tabela é indexada por (quadrícula, vizinho).
+
+#ifndef _CCORR_
+#define _CCORR_
+
+#include <stddef.h>
+#include "c_ctl.h"
+
+
+// tempos processados de cada vez por quadrícula (mantém as séries na cache)
+#ifndef CORR_BLOCK
+#define CORR_BLOCK      256
+#endif
+
+// quantidade mínima de tempos com as duas séries definidas para haver correlação
+#ifndef CORR_MIN_PAIRS
+#define CORR_MIN_PAIRS  3
+#endif
+
+
+// Deslocamento até uma quadrícula vizinha e sua distância
+typedef struct corr_offset_struct{
+    int dx, dy;
+    double d;
+} corr_offset;
+
+// Somas de um par de séries sobre os tempos em que as duas estão definidas
+typedef struct corr_sums_struct{
+    double n, sx, sy, sxy, sxx, syy;
+} corr_sums;
+
+// Tabela de correlações
+typedef struct corr_table_struct{
+    size_t x, y, t;         // dimensões do dado
+
+    size_t* off_start;      // início dos vizinhos de cada linha em 'off' (y+1 posições)
+    corr_offset* off;
+
+    size_t* cell_start;     // início na tabela da primeira quadrícula de cada linha (y+1 posições)
+    float* corr;            // correlação com cada vizinho, NAN se não há tempos suficientes
+} corr_table;
+
+
+// Correlações sobre uma janela móvel de tempos
+// As somas de cada par são atualizadas ao deslizar a janela: um tempo entra, outro sai
+typedef struct corr_window_struct{
+    corr_table* table;      // correlações da janela atual
+    corr_sums* sums;        // somas de cada par (mesmo layout de table->corr)
+
+    float* series;          // valores em ordem de tempo [t][quadrícula], 0 se undef
+    unsigned char* valid;   // validade [t][quadrícula]
+
+    size_t half;            // a janela vai de t - half até t + half
+    long t;                 // centro da janela atual (-1 antes do primeiro posicionamento)
+} corr_window;
+
+
+/* Deslocamentos (dx,dy) das quadrículas a menos de 'radius' da quadrícula da linha y de 'info'.
+ * Se 'out' for NULL apenas conta. Retorna a quantidade de deslocamentos.
+**/
+size_t radius_offsets(info_ctl* info, size_t y, double radius, double (*dist)(double,double,double,double), corr_offset* out);
+
+/* Correlações sobre toda a série de 'data' entre quadrículas a menos de 'radius'.
+ * Retorna NULL em erro de alocação.
+**/
+corr_table* corr_full(binary_data* data, double radius, double (*dist)(double,double,double,double));
+
+/* Correlação da quadrícula (x,y) com seu k-ésimo vizinho (da linha y)
+**/
+static inline float corr_get(corr_table* table, size_t x, size_t y, size_t k){
+    size_t n = table->off_start[y + 1] - table->off_start[y];
+    return table->corr[table->cell_start[y] + x * n + k];
+}
+
+void free_corr_table(corr_table* table);
+
+/* Prepara as correlações de 'data' em janelas de 'window' tempos entre quadrículas a menos de 'radius'.
+ * Retorna NULL em erro de alocação.
+**/
+corr_window* corr_window_init(binary_data* data, double radius, double (*dist)(double,double,double,double), size_t window);
+
+/* Centraliza a janela no tempo t e atualiza 'table'.
+ * Se t for o tempo seguinte ao atual, apenas o tempo que entra e o que sai são considerados
+ * (O(1) por par), caso contrário as somas são refeitas.
+**/
+void corr_window_seek(corr_window* win, size_t t);
+
+void free_corr_window(corr_window* win);
+
+#endif
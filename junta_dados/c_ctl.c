@@ -10,6 +10,22 @@
 #include <unistd.h>
 
 #define ERROR (0.000001) // Erro permitido (float)
+#define UNDEF_ERR (0.00001) // Erro permitido ao comparar com undef (mapa de validade)
+
+// identificação do arquivo esparso (8 bytes no início do arquivo)
+#define SPARSE_MAGIC "CTLSPRS1"
+#define SPARSE_MAGIC_SIZE 8
+
+// Cabeçalho do arquivo esparso, seguido por
+// offset[tdef+1] (uint64), idx[nnz] (uint32) e val[nnz] (datatype)
+typedef struct sparse_header_struct{
+    char magic[SPARSE_MAGIC_SIZE];
+    uint32_t dsize;     // sizeof(datatype) usado na escrita
+    uint32_t reserved;
+    uint64_t x, y, t;
+    uint64_t nnz;
+    double undef;
+} sparse_header;
 
 void saferFree(void **pp){
 	if(pp != NULL && *pp != NULL){
@@ -18,6 +34,16 @@ void saferFree(void **pp){
 	}
 }
 
+const char* isa_variant(void){
+#if ISA_DISPATCH
+	// mesma prioridade do resolvedor gerado para target_clones
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return "avx512f";
+	if (__builtin_cpu_supports("avx2")) return "avx2";
+#endif
+	return "default";
+}
+
 int check_dim(binary_data *f1, binary_data *f2){
 	size_t d1 = f1->info.tdef * f1->info.x.def * f1->info.y.def;
 	size_t d2 = f2->info.tdef * f2->info.x.def * f2->info.y.def;
@@ -257,10 +283,292 @@ binary_data *aloca_bin(size_t x, size_t y, size_t t) {
         safeFree(bin_data);
         return NULL;
     }
+    bin_data->sparse = NULL;
+    bin_data->valid = NULL;
+
+    return bin_data;
+}
+
+// libera os vetores da representação esparsa
+static void free_sparse(sparse_data *sparse) {
+    if (sparse) {
+        safeFree(sparse->offset);
+        safeFree(sparse->idx);
+        safeFree(sparse->val);
+        free(sparse);
+    }
+}
+
+// aloca a representação esparsa com 'nnz' valores e 't' tempos
+static sparse_data *aloca_sparse(size_t t, size_t nnz) {
+    sparse_data *sparse;
+
+    if (!(sparse = calloc(1, sizeof(sparse_data)))) {
+        fprintf(stderr, "Erro ao alocar memória para dado esparso (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    sparse->nnz = nnz;
+    sparse->offset = calloc(t + 1, sizeof(size_t));
+    // ao menos 1 elemento para não confundir com erro de alocação
+    sparse->idx = malloc((nnz ? nnz : 1) * sizeof(uint32_t));
+    sparse->val = malloc((nnz ? nnz : 1) * sizeof(datatype));
+
+    if (!sparse->offset || !sparse->idx || !sparse->val) {
+        fprintf(stderr, "Erro ao alocar memória para dado esparso (%s:%d).\n", __FILE__, __LINE__);
+        free_sparse(sparse);
+        return NULL;
+    }
+
+    return sparse;
+}
+
+// lê o arquivo esparso já aberto em 'bin_file'
+static binary_data *read_sparse(FILE *bin_file, size_t x, size_t y, size_t t) {
+    sparse_header header;
+    binary_data *bin_data;
+    uint64_t *offset;
+
+    if (fread(&header, sizeof(sparse_header), 1, bin_file) < 1 ||
+        header.dsize != sizeof(datatype) ||
+        header.x != x || header.y != y || header.t != t) {
+        fprintf(stderr, "ERRO: cabeçalho do arquivo esparso inválido ou incompatível com o ctl (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    if (!(bin_data = malloc(sizeof(binary_data)))) {
+        fprintf(stderr, "Erro ao alocar memória para bin_data (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+    bin_data->data = NULL;
+    bin_data->sparse = NULL;
+    bin_data->valid = NULL;
+
+    offset = malloc((t + 1) * sizeof(uint64_t));
+
+    if (!offset || !(bin_data->sparse = aloca_sparse(t, header.nnz)) ||
+        fread(offset, sizeof(uint64_t), t + 1, bin_file) < t + 1 ||
+        fread(bin_data->sparse->idx, sizeof(uint32_t), header.nnz, bin_file) < header.nnz ||
+        fread(bin_data->sparse->val, sizeof(datatype), header.nnz, bin_file) < header.nnz) {
+        fprintf(stderr, "ERRO: arquivo esparso incompleto (%s:%d).\n", __FILE__, __LINE__);
+        safeFree(offset);
+        return free_bin(bin_data);
+    }
 
+    for (size_t i = 0; i <= t; i++)
+        bin_data->sparse->offset[i] = offset[i];
+
+    safeFree(offset);
     return bin_data;
 }
 
+// escreve a representação esparsa de 'bin_data' em 'bin_file'
+static int write_sparse(FILE *bin_file, binary_data *bin_data) {
+    sparse_data *sparse = bin_data->sparse;
+    sparse_header header;
+    size_t t = bin_data->info.tdef;
+    uint64_t *offset;
+
+    memset(&header, 0, sizeof(sparse_header));
+    memcpy(header.magic, SPARSE_MAGIC, SPARSE_MAGIC_SIZE);
+    header.dsize = sizeof(datatype);
+    header.x = bin_data->info.x.def;
+    header.y = bin_data->info.y.def;
+    header.t = t;
+    header.nnz = sparse->nnz;
+    header.undef = bin_data->info.undef;
+
+    if (!(offset = malloc((t + 1) * sizeof(uint64_t))))
+        return 0;
+
+    for (size_t i = 0; i <= t; i++)
+        offset[i] = sparse->offset[i];
+
+    int ok = fwrite(&header, sizeof(sparse_header), 1, bin_file) == 1 &&
+             fwrite(offset, sizeof(uint64_t), t + 1, bin_file) == t + 1 &&
+             fwrite(sparse->idx, sizeof(uint32_t), sparse->nnz, bin_file) == sparse->nnz &&
+             fwrite(sparse->val, sizeof(datatype), sparse->nnz, bin_file) == sparse->nnz;
+
+    safeFree(offset);
+    return ok;
+}
+
+int bin_to_sparse(binary_data *bin_data) {
+    sparse_data *sparse;
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t tdef = bin_data->info.tdef;
+    datatype undef = bin_data->info.undef;
+    size_t *count;
+
+    if (bin_data->sparse)
+        return 1;
+
+    if (dxy > UINT32_MAX) {
+        fprintf(stderr, "ERRO: grade muito grande para representação esparsa (%s:%d).\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    if (!(count = calloc(tdef + 1, sizeof(size_t))))
+        return 0;
+
+    // quantidade de valores definidos em cada tempo
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++) {
+        datatype *slice = bin_data->data + t * dxy;
+        size_t n = 0;
+        for (size_t i = 0; i < dxy; i++)
+            n += !(fabs(slice[i] - undef) < ERROR);
+        count[t + 1] = n;
+    }
+
+    for (size_t t = 0; t < tdef; t++)
+        count[t + 1] += count[t];
+
+    if (!(sparse = aloca_sparse(tdef, count[tdef]))) {
+        safeFree(count);
+        return 0;
+    }
+
+    memcpy(sparse->offset, count, (tdef + 1) * sizeof(size_t));
+    safeFree(count);
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++) {
+        datatype *slice = bin_data->data + t * dxy;
+        size_t k = sparse->offset[t];
+        for (size_t i = 0; i < dxy; i++) {
+            if (!(fabs(slice[i] - undef) < ERROR)) {
+                sparse->idx[k] = i;
+                sparse->val[k] = slice[i];
+                k++;
+            }
+        }
+    }
+
+    safeFree(bin_data->data);
+    bin_data->sparse = sparse;
+
+    return 1;
+}
+
+int bin_to_dense(binary_data *bin_data) {
+    sparse_data *sparse = bin_data->sparse;
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t tdef = bin_data->info.tdef;
+
+    if (!sparse)
+        return 1;
+
+    if (!(bin_data->data = malloc(dxy * tdef * sizeof(datatype)))) {
+        fprintf(stderr, "Erro ao alocar memória para bin_data->data (%s:%d).\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++) {
+        datatype *slice = bin_data->data + t * dxy;
+        for (size_t i = 0; i < dxy; i++)
+            slice[i] = bin_data->info.undef;
+        for (size_t k = sparse->offset[t]; k < sparse->offset[t + 1]; k++)
+            slice[sparse->idx[k]] = sparse->val[k];
+    }
+
+    free_sparse(sparse);
+    bin_data->sparse = NULL;
+
+    return 1;
+}
+
+datatype get_pos_val(binary_data *bin_data, size_t pos) {
+    sparse_data *sparse = bin_data->sparse;
+
+    if (!sparse)
+        return bin_data->data[pos];
+
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t t = pos / dxy;
+    uint32_t i = pos % dxy;
+
+    // busca binária entre os valores do tempo t
+    size_t lo = sparse->offset[t], hi = sparse->offset[t + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sparse->idx[mid] < i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < sparse->offset[t + 1] && sparse->idx[lo] == i)
+        return sparse->val[lo];
+
+    return bin_data->info.undef;
+}
+
+// Palavras de validade dos 'n' valores densos de 'slice' em 'row'
+// uma palavra de cada vez, sem desvio por quadrícula
+static ISA_CLONES void valid_scan(const datatype *slice, size_t n, datatype undef, uint64_t *row) {
+    size_t words = (n + 63) / 64;
+
+    for (size_t w = 0; w < words; w++) {
+        size_t c0 = w * 64, nb = (n - c0 < 64) ? n - c0 : 64;
+        uint64_t word = 0;
+
+        for (size_t b = 0; b < nb; b++)
+            word |= (uint64_t)!(fabs(slice[c0 + b] - undef) < UNDEF_ERR) << b;
+
+        row[w] = word;
+    }
+}
+
+int build_valid(binary_data *bin_data) {
+    size_t dxy = bin_data->info.x.def * bin_data->info.y.def;
+    size_t tdef = bin_data->info.tdef;
+    size_t words = valid_words(&(bin_data->info));
+    datatype undef = bin_data->info.undef;
+    uint64_t *valid;
+
+    if (!(valid = calloc(words * tdef + 1, sizeof(uint64_t)))) {
+        fprintf(stderr, "Erro ao alocar memória para o mapa de validade (%s:%d).\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    sparse_data *sparse = bin_data->sparse;
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++) {
+        uint64_t *row = valid + t * words;
+
+        // esparso: os bits são as posições guardadas
+        if (sparse) {
+            for (size_t k = sparse->offset[t]; k < sparse->offset[t + 1]; k++)
+                if (!(fabs(sparse->val[k] - undef) < UNDEF_ERR))
+                    row[sparse->idx[k] / 64] |= 1ULL << (sparse->idx[k] % 64);
+            continue;
+        }
+
+        valid_scan(bin_data->data + t * dxy, dxy, undef, row);
+    }
+
+    safeFree(bin_data->valid);
+    bin_data->valid = valid;
+    return 1;
+}
+
+size_t count_valid(binary_data *bin_data) {
+    if (!bin_data->valid && !build_valid(bin_data))
+        return 0;
+
+    size_t n_words = valid_words(&(bin_data->info)) * bin_data->info.tdef;
+    size_t n = 0;
+
+    #pragma omp parallel for reduction(+:n)
+    for (size_t w = 0; w < n_words; w++)
+        n += __builtin_popcountll(bin_data->valid[w]);
+
+    return n;
+}
+
 // Abre um arquivo o .bin 'name' com as informações passadas por parametro
 // Retorna o ponteiro para a struct de dado, ou NULL em erro
 binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
@@ -276,6 +584,17 @@ binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
             name,__FILE__, __LINE__);
         return NULL;
     }
+    // arquivo esparso
+    char magic[SPARSE_MAGIC_SIZE];
+    if (fread(magic, 1, SPARSE_MAGIC_SIZE, bin_file) == SPARSE_MAGIC_SIZE &&
+        !memcmp(magic, SPARSE_MAGIC, SPARSE_MAGIC_SIZE)) {
+        rewind(bin_file);
+        bin_data = read_sparse(bin_file, x, y, t);
+        fclose(bin_file);
+        return bin_data;
+    }
+    rewind(bin_file);
+
     // alocando estrutura
     if (!(bin_data = aloca_bin(x, y, t))) {
         fclose(bin_file);
@@ -294,7 +613,11 @@ binary_data *open_bin(char *name, size_t x, size_t y, size_t t) {
 
 // Libera a alocação de 'bin_data'
 binary_data *free_bin(binary_data *bin_data) {
+    if (!bin_data)
+        return NULL;
     safeFree(bin_data->data);
+    free_sparse(bin_data->sparse);
+    safeFree(bin_data->valid);
     safeFree(bin_data);
 
     return NULL;
@@ -308,7 +631,7 @@ void print_bin(binary_data *bin_data) {
             for (size_t x = 0; x < bin_data->info.x.def; x++) {
                 pos = get_pos(&(bin_data->info), x, y, t);
                 printf("[%3ld,%3ld,%5ld] %10.6f\n", (x + 1), (y + 1), (t + 1),
-                       bin_data->data[pos]);
+                       get_pos_val(bin_data, pos));
             }
         }
     }
@@ -325,6 +648,16 @@ int write_bin(binary_data *bin_data) {
         return 0;
     }
 
+    if (bin_data->sparse) {
+        if (!write_sparse(bin_file, bin_data)) {
+            fprintf(stderr, "Erro ao escrever binario esparso. (%s:%d).\n", __FILE__, __LINE__);
+            fclose(bin_file);
+            return 0;
+        }
+        fclose(bin_file);
+        return 1;
+    }
+
     // quantidade de elementos do arquivo
     size_t dims = bin_data->info.x.def * bin_data->info.y.def * bin_data->info.tdef;
     
@@ -380,11 +713,11 @@ datatype get_data_val(binary_data *ref, binary_data *src, int x, int y, int t) {
 
     // retorna o valor da quadrícula equivalente a
     // ref->data[get_pos(&(ref->info),x,y,t)]
-    return src->data[get_pos(&(src->info), x_src, y_src, t_src)];
+    return get_pos_val(src, get_pos(&(src->info), x_src, y_src, t_src));
 }
 
 datatype set_data_val(binary_data *dest, int x, int y, int t, datatype value) {
-    if (!contains(dest, x, y, t))
+    if (!contains(dest, x, y, t) || dest->sparse)
         return dest->info.undef;
     return dest->data[get_pos(&(dest->info), x, y, t)] = value;
 }
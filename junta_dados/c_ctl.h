@@ -4,6 +4,7 @@
 #ifndef _CCTL_
 #define _CCTL_
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -13,6 +14,17 @@
 #define DATATYPE float
 #endif
 
+// Variantes por conjunto de instruções: funções marcadas com ISA_CLONES são compiladas para AVX-512, AVX2
+// e a genérica (SSE2 no x86-64); a variante é escolhida uma vez, na carga do programa (ifunc/cpuid),
+// então o mesmo binário usa o que cada máquina tem. `gcc -DNO_ISA_CLONES` compila só a genérica.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) && !defined(NO_ISA_CLONES)
+#define ISA_DISPATCH 1
+#define ISA_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define ISA_DISPATCH 0
+#define ISA_CLONES
+#endif
+
 // https://stackoverflow.com/questions/40591312/c-macro-how-to-get-an-integer-value-into-a-string-literal
 #define STR_IMPL_(x) #x      //stringify argument
 #define STR(x) STR_IMPL_(x)  //indirection to expand argument macros
@@ -71,15 +83,30 @@ typedef struct info_ctl_struct{
     char dump[BUFF_SIZE];   // restante do arquivo 
 } info_ctl;
 
+// Representação esparsa: apenas os valores diferentes de undef,
+// ordenados pela posição (x,y) dentro de cada tempo t
+typedef struct sparse_data_struct{
+    size_t nnz;         // quantidade de valores guardados
+    size_t* offset;     // início de cada tempo t em 'idx' e 'val' (tdef+1 posições)
+    uint32_t* idx;      // posição x + x.def*y dentro do tempo, em ordem crescente
+    datatype* val;      // valores guardados
+} sparse_data;
+
 // Armazena todas as informações de um arquivo de dados binários
 typedef struct binary_data_struct{
-    datatype* data;
+    datatype* data;         // matriz densa (NULL quando esparso)
+    sparse_data* sparse;    // representação esparsa (NULL quando denso)
+    uint64_t* valid;        // mapa de bits de validade (ver 'build_valid'), NULL se não foi montado
     info_ctl info;
 } binary_data;
 
 int check_dim(binary_data *f1, binary_data *f2);
 
 void saferFree(void **pp);
+
+// Nome da variante (ISA_CLONES) escolhida para esta CPU: "avx512f", "avx2" ou "default"
+const char* isa_variant(void);
+
 /* Abre o arquivo ctl 'name' e salva as informações em 'info_field'
  * retorna 1 em sucesso ou 0 em erro
 **/
@@ -101,6 +128,8 @@ binary_data* open_bin_ctl(char* name);
 binary_data* open_bin_info(info_ctl* info);
 
 /* Abre um arquivo o .bin 'name' com as informações passadas por parametro
+ * Arquivos esparsos (escritos a partir de um dado esparso) são detectados
+ * pelo cabeçalho e carregados na representação esparsa.
  * Retorna o ponteiro para a struct de dado, ou NULL em erro
 **/
 binary_data* open_bin(char* name, size_t x, size_t y, size_t t);
@@ -115,8 +144,43 @@ binary_data* aloca_bin(size_t x, size_t y, size_t t);
 void print_bin(binary_data* bin_data);
 
 // Escreve um arquivo binário para a matriz 'bin_data'
+// Se 'bin_data' está na representação esparsa o arquivo também é esparso
 int write_bin(binary_data* bin_data);
 
+/* Converte 'bin_data' para a representação esparsa, guardando apenas
+ * os valores diferentes de undef. A matriz densa é liberada.
+ * Retorna 1 em sucesso ou 0 em erro
+**/
+int bin_to_sparse(binary_data* bin_data);
+
+/* Converte 'bin_data' da representação esparsa para a densa.
+ * Retorna 1 em sucesso ou 0 em erro
+**/
+int bin_to_dense(binary_data* bin_data);
+
+// Retorna o valor da posição 'pos' do vetor (ver 'get_pos'), seja o dado denso ou esparso
+datatype get_pos_val(binary_data* bin_data, size_t pos);
+
+/* Monta o mapa de bits de validade de 'bin_data': um bit por quadrícula (1 se diferente de undef),
+ * a quadrícula c = x + x.def*y no bit c%64 da palavra c/64, e cada tempo começando em uma palavra nova.
+ * O mapa é uma cópia: não acompanha alterações posteriores do dado.
+ * Retorna 1 em sucesso ou 0 em erro de alocação
+**/
+int build_valid(binary_data* bin_data);
+
+// Palavras de 64 bits de cada tempo no mapa de validade
+static inline size_t valid_words(info_ctl* info){
+    return (info->x.def * info->y.def + 63) / 64;
+}
+
+// 1 se a quadrícula c (x + x.def*y) está definida no tempo t, pelo mapa de validade
+static inline int is_valid(binary_data* bin_data, size_t t, size_t c){
+    return (bin_data->valid[t * valid_words(&(bin_data->info)) + c / 64] >> (c % 64)) & 1;
+}
+
+// Quantidade de quadrículas definidas: contagem de bits do mapa de validade, montado se preciso (0 em erro)
+size_t count_valid(binary_data* bin_data);
+
 // Escreve um arquivo binário para a matriz 'bin_data' e arquivo ctl de nome 'name'
 int write_files(binary_data* bin_data, char* name, char* title);
 
@@ -129,6 +193,7 @@ datatype get_data_val(binary_data* ref, binary_data* src, int x, int y, int t);
 
 // O valor de dest->data na posição (x,y,t) recebe 'value'
 // Retorna o valor atribuído ou 'dest->info.undef' se (x,y,t) está fora da matriz
+// (dados esparsos são apenas para leitura, nesse caso retorna 'dest->info.undef')
 datatype set_data_val(binary_data* dest, int x, int y, int t, datatype value);
 
 // Copia as informações de 'src' para 'dest'
@@ -158,6 +223,14 @@ int contains(binary_data* bin_data, int x, int y, int t);
 // Retorna a quantidade de t's desde 01/01/0001 até a data inicial da estação (ctl->date_i)
 int date_to_t(info_ctl* ctl);
 
+/* Lê a data no formato ddmmmaaaa (ex.: 01jan1980) para 'dest'.
+ * Retorna 0 se o mês não for reconhecido.
+**/
+int str_to_date(struct tm* dest, char* str);
+
+// Retorna o T_TYPE do incremento em texto (ex.: 1mo), 0 se não for reconhecido
+int str_to_ttype(char* str);
+
 
 /* Verifica se dois grids são compatíveis.
  * Retorna 1 se os dois são compatíveis, retorna 0 caso contrário.
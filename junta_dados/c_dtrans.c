@@ -0,0 +1,142 @@
+#include "c_dtrans.h"
+#include <math.h>
+#include <stdlib.h>
+
+
+dist_map* alloc_dist_map(info_ctl* info, double radius, double (*dist)(double,double,double,double)){
+    size_t x_def = info->x.def, y_def = info->y.def;
+    size_t n = x_def * y_def;
+    size_t line = ((x_def > y_def) ? x_def : y_def) + 1;
+
+    dist_map* m = calloc(1, sizeof(dist_map));
+    if (!m) return NULL;
+
+    m->x = x_def;
+    m->y = y_def;
+
+    m->row_w = malloc(y_def * sizeof(double));
+    m->d     = malloc(n * sizeof(float));
+    m->mask  = malloc(n);
+    m->g     = malloc(n * sizeof(double));
+    m->f     = malloc(line * sizeof(double));
+    m->out   = malloc(line * sizeof(double));
+    m->arg   = malloc(line * sizeof(long));
+    m->v     = malloc(line * sizeof(long));
+    m->z     = malloc(line * sizeof(double));
+
+    double* width = malloc(y_def * sizeof(double));
+
+    if (!m->row_w || !m->d || !m->mask || !m->g || !m->f || !m->out || !m->arg || !m->v || !m->z || !width){
+        free(width);
+        free_dist_map(m);
+        return NULL;
+    }
+
+    // largura e altura das quadrículas de cada linha
+    double lon = info->x.i;
+    m->h = INFINITY;
+    for (size_t y = 0; y < y_def; y++){
+        double lat = info->y.i + y * info->y.size;
+        double h = dist(lon, lat, lon, lat + info->y.size);
+
+        width[y] = dist(lon, lat, lon + info->x.size, lat);
+        if (h < m->h) m->h = h;
+    }
+
+    // linhas que podem estar a menos de 'radius': a geodésica entre elas passa por latitudes
+    // dessas linhas, então a menor largura entre elas não aumenta a distância
+    long steps = (m->h > 0) ? (long)ceil(radius / m->h) + 1 : (long)y_def;
+
+    for (long y = 0; y < (long)y_def; y++){
+        m->row_w[y] = width[y];
+        for (long j = y - steps; j <= y + steps; j++)
+            if (j >= 0 && j < (long)y_def && width[j] < m->row_w[y]) m->row_w[y] = width[j];
+    }
+
+    free(width);
+    return m;
+}
+
+
+/* Envelope inferior das parábolas f[q] + s2*(p-q)², ignorando f[q] infinito.
+ * 'out' recebe o mínimo em cada p e 'arg' o q que o atinge (-1 se todos são infinitos).
+**/
+static void envelope(const double* f, long n, double s2, double* out, long* arg, long* v, double* z){
+    long k = -1;
+
+    for (long q = 0; q < n; q++){
+        if (isinf(f[q])) continue;
+
+        double s = -INFINITY;
+        while (k >= 0){
+            long r = v[k];
+            s = ((f[q] + s2 * q * q) - (f[r] + s2 * r * r)) / (2 * s2 * (q - r));
+            if (s > z[k]) break;
+            k--;
+        }
+
+        k++;
+        v[k] = q;
+        z[k] = (k == 0) ? -INFINITY : s;
+    }
+
+    if (k < 0){
+        for (long p = 0; p < n; p++){
+            out[p] = INFINITY;
+            arg[p] = -1;
+        }
+        return;
+    }
+
+    long j = 0;
+    for (long p = 0; p < n; p++){
+        while (j < k && z[j + 1] < p) j++;
+
+        out[p] = f[v[j]] + s2 * (p - v[j]) * (p - v[j]);
+        arg[p] = v[j];
+    }
+}
+
+
+void dist_transform(dist_map* m, long t){
+    long x_def = m->x, y_def = m->y;
+
+    // ao longo de cada linha, com a largura da linha
+    for (long y = 0; y < y_def; y++){
+        double s2 = m->row_w[y] * m->row_w[y];
+
+        for (long x = 0; x < x_def; x++) m->f[x] = m->mask[y * x_def + x] ? 0 : INFINITY;
+
+        envelope(m->f, x_def, s2, m->g + y * x_def, m->arg, m->v, m->z);
+    }
+
+    // ao longo de cada coluna, somando a distância vertical
+    double s2 = m->h * m->h;
+    for (long x = 0; x < x_def; x++){
+        for (long y = 0; y < y_def; y++) m->f[y] = m->g[y * x_def + x];
+
+        envelope(m->f, y_def, s2, m->out, m->arg, m->v, m->z);
+
+        for (long y = 0; y < y_def; y++)
+            m->d[y * x_def + x] = (m->arg[y] < 0) ? INFINITY : sqrt(m->out[y]);
+    }
+
+    m->t = t;
+    m->ready = 1;
+}
+
+
+void free_dist_map(dist_map* m){
+    if (m){
+        free(m->row_w);
+        free(m->d);
+        free(m->mask);
+        free(m->g);
+        free(m->f);
+        free(m->out);
+        free(m->arg);
+        free(m->v);
+        free(m->z);
+        free(m);
+    }
+}
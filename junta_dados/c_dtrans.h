@@ -0,0 +1,58 @@
+// Transformada de distância da máscara de quadrículas definidas
+// Para cada quadrícula do grid, a distância até a quadrícula definida mais próxima,
+// em O(N) com duas passadas separáveis (linhas e colunas)
+// pelo envelope inferior de parábolas (Felzenszwalb & Huttenlocher).
+// A largura das quadrículas muda com a latitude: cada linha usa a menor largura entre
+// as linhas a menos de 'radius' dela, então até 'radius' a distância calculada nunca
+// passa da distância real (é um limite inferior, a menos da curvatura, ver DT_SLACK).
+
+#ifndef _CDTRANS_
+#define _CDTRANS_
+
+#include <stddef.h>
+#include "c_ctl.h"
+
+
+// fator aplicado à distância da transformada antes de compará-la com distâncias reais
+// (cobre a diferença entre o grid plano e a geodésica)
+#ifndef DT_SLACK
+#define DT_SLACK    0.99
+#endif
+
+
+// Transformada de um grid, reutilizada a cada máscara
+typedef struct dist_map_struct{
+    size_t x, y;            // dimensões do grid
+    long t;                 // tempo da máscara atual (sem significado se 'ready' for 0)
+    int ready;
+
+    double* row_w;          // largura (limite inferior) das quadrículas de cada linha
+    double h;               // altura (limite inferior) das quadrículas
+
+    float* d;               // distância até a quadrícula definida mais próxima, INFINITY se não há
+
+    unsigned char* mask;    // máscara a ser transformada, preenchida por quem chama
+
+    // áreas de trabalho das passadas
+    double* g;              // distância² ao longo da linha
+    double* f;
+    double* out;
+    long* arg;
+    long* v;
+    double* z;
+} dist_map;
+
+
+/* Prepara a transformada do grid de 'info', com distâncias válidas (limite inferior) até 'radius'.
+ * Retorna NULL em erro de alocação.
+**/
+dist_map* alloc_dist_map(info_ctl* info, double radius, double (*dist)(double,double,double,double));
+
+/* Calcula a transformada de 'mask' (mask[y*x + x] != 0 se a quadrícula está definida)
+ * e marca a transformada como sendo do tempo t.
+**/
+void dist_transform(dist_map* m, long t);
+
+void free_dist_map(dist_map* m);
+
+#endif
@@ -0,0 +1,68 @@
+#include "c_halo.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERIOD_ERR (0.01)   // fração de quadrícula de folga ao comparar a largura do grid com 360
+
+
+halo_grid* alloc_halo(size_t x, size_t y, size_t t, size_t hx, size_t hy, int periodic, datatype undef){
+    halo_grid* h = calloc(1, sizeof(halo_grid));
+    if (!h) return NULL;
+
+    // mais que isso só repetiria quadrículas (periódico) ou ficaria fora do grid
+    if (x < 3) periodic = 0;
+    if (periodic && hx > (x - 1) / 2) hx = (x - 1) / 2;
+    if (hx > x) hx = x;
+    if (hy > y) hy = y;
+
+    h->x = x;
+    h->y = y;
+    h->t = t;
+    h->hx = hx;
+    h->hy = hy;
+    h->nx = x + 2 * hx;
+    h->ny = y + 2 * hy;
+    h->periodic = periodic;
+    h->undef = undef;
+
+    size_t n = h->nx * h->ny * t;
+    h->data = malloc(n * sizeof(datatype));
+    if (!h->data) return free_halo(h);
+
+    for (size_t i = 0; i < n; i++) h->data[i] = undef;
+
+    h->origin = h->data + hy * h->nx + hx;
+
+    return h;
+}
+
+
+void wrap_halo(halo_grid* h){
+    if (!h->periodic || !h->hx) return;
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < h->t; t++){
+        for (size_t y = 0; y < h->y; y++){
+            datatype* row = halo_ptr(h, 0, y, t);
+
+            // colunas à esquerda vêm do fim da linha, à direita do início
+            memcpy(row - h->hx, row + h->x - h->hx, h->hx * sizeof(datatype));
+            memcpy(row + h->x, row, h->hx * sizeof(datatype));
+        }
+    }
+}
+
+
+int periodic_grid(info_ctl* info){
+    return fabs(info->x.def * info->x.size - 360) < PERIOD_ERR * info->x.size;
+}
+
+
+halo_grid* free_halo(halo_grid* h){
+    if (h){
+        free(h->data);
+        free(h);
+    }
+    return NULL;
+}
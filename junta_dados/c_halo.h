@@ -0,0 +1,49 @@
+// Cópia do dado primário com borda (halo)
+// O grid é guardado com 'hx' colunas e 'hy' linhas a mais de cada lado, então um vizinho
+// (x+dx, y+dy) com |dx| <= hx e |dy| <= hy é lido sem testar os limites do grid.
+// A borda é indefinida ou, em grids globais, uma cópia das colunas do outro lado do grid
+// (continuidade na longitude 0/360), de modo que os vizinhos atravessam a emenda.
+
+#ifndef _CHALO_
+#define _CHALO_
+
+#include <stddef.h>
+#include "c_ctl.h"
+
+
+typedef struct halo_grid_struct{
+    datatype* data;         // (t, y, x) com borda
+    datatype* origin;       // posição (0,0,0) sem borda dentro de 'data'
+    size_t x, y, t;         // dimensões sem borda
+    size_t hx, hy;          // largura da borda
+    size_t nx, ny;          // dimensões com borda
+    int periodic;           // borda em x copiada do outro lado do grid
+    datatype undef;
+} halo_grid;
+
+
+/* Aloca o grid x*y*t com borda hx, hy, todo indefinido (em x no máximo o próprio grid,
+ * ou metade dele se for periódico). Retorna NULL em erro de alocação.
+**/
+halo_grid* alloc_halo(size_t x, size_t y, size_t t, size_t hx, size_t hy, int periodic, datatype undef);
+
+/* Com o interior preenchido, copia as colunas da borda do outro lado do grid (apenas se periódico)
+**/
+void wrap_halo(halo_grid* h);
+
+/* 1 se o grid de 'info' dá a volta no globo (x.def * x.size = 360)
+**/
+int periodic_grid(info_ctl* info);
+
+// posição (x,y) no tempo t, com -hx <= x < x+hx e -hy <= y < y+hy
+static inline datatype* halo_ptr(halo_grid* h, long x, long y, size_t t){
+    return h->origin + ((long)(t * h->ny) + y) * (long)h->nx + x;
+}
+
+static inline datatype halo_val(halo_grid* h, long x, long y, size_t t){
+    return *halo_ptr(h, x, y, t);
+}
+
+halo_grid* free_halo(halo_grid* h);
+
+#endif
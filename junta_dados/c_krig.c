@@ -0,0 +1,226 @@
+#include "c_krig.h"
+#include "c_corr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDEF_ERR (0.00001) // Erro permitido ao comparar com undef
+
+// alcances testados no ajuste, de KRIG_RANGE_MIN*radius até KRIG_RANGE_MAX*radius
+#define KRIG_RANGES     40
+#define KRIG_RANGE_MIN  0.02
+#define KRIG_RANGE_MAX  3.0
+
+// acrescentado à diagonal (relativo a C(0)) para o sistema continuar definido com pontos repetidos
+#define KRIG_JITTER     1e-9
+
+
+// ajusta nugget e sill (>= 0) para um alcance fixo por mínimos quadrados ponderados, retorna o erro
+static double fit_linear(const double* h, const double* g, const double* n, int bins, double range, double* nugget, double* sill){
+    double sn = 0, sf = 0, sff = 0, sg = 0, sfg = 0;
+
+    for (int b = 0; b < bins; b++){
+        if (n[b] <= 0) continue;
+
+        double f = 1 - exp(-h[b] / range);
+        sn += n[b];
+        sf += n[b] * f;
+        sff += n[b] * f * f;
+        sg += n[b] * g[b];
+        sfg += n[b] * f * g[b];
+    }
+
+    double det = sn * sff - sf * sf;
+    double c0 = 0, c1 = 0;
+
+    if (det > 0){
+        c0 = (sff * sg - sf * sfg) / det;
+        c1 = (sn * sfg - sf * sg) / det;
+    }
+
+    if (det <= 0 || c0 < 0 || c1 < 0){
+        // melhor solução com um dos dois em 0
+        double a0 = 0, a1 = (sff > 0) ? sfg / sff : 0;
+        double b0 = sg / sn, b1 = 0;
+        double ea = 0, eb = 0;
+
+        if (a1 < 0) a1 = 0;
+
+        for (int b = 0; b < bins; b++){
+            if (n[b] <= 0) continue;
+
+            double f = 1 - exp(-h[b] / range);
+            ea += n[b] * (g[b] - a0 - a1 * f) * (g[b] - a0 - a1 * f);
+            eb += n[b] * (g[b] - b0 - b1 * f) * (g[b] - b0 - b1 * f);
+        }
+
+        if (ea <= eb){ c0 = a0; c1 = a1; }
+        else{ c0 = b0; c1 = b1; }
+    }
+
+    double err = 0;
+    for (int b = 0; b < bins; b++){
+        if (n[b] <= 0) continue;
+
+        double r = g[b] - c0 - c1 * (1 - exp(-h[b] / range));
+        err += n[b] * r * r;
+    }
+
+    *nugget = c0;
+    *sill = c1;
+    return err;
+}
+
+
+int fit_variogram(binary_data* data, double radius, double (*dist)(double,double,double,double), variogram* v){
+    info_ctl* info = &(data->info);
+    size_t x_def = info->x.def, y_def = info->y.def, tdef = info->tdef;
+    size_t n_xy = x_def * y_def;
+
+    // sem pares: patamar unitário e alcance de um terço do raio
+    *v = (variogram){0, 1, radius / 3};
+
+    // vizinhos de cada linha (só metade deles, cada par é contado uma vez)
+    size_t* off_start = calloc(y_def + 1, sizeof(size_t));
+    if (!off_start) return 0;
+
+    for (size_t y = 0; y < y_def; y++)
+        off_start[y + 1] = off_start[y] + radius_offsets(info, y, radius, dist, NULL);
+
+    corr_offset* off = malloc(off_start[y_def] * sizeof(corr_offset));
+    if (!off){
+        free(off_start);
+        return 0;
+    }
+
+    for (size_t y = 0; y < y_def; y++)
+        radius_offsets(info, y, radius, dist, off + off_start[y]);
+
+    // amostra de tempos e de quadrículas
+    size_t step_t = (tdef > KRIG_FIT_T) ? tdef / KRIG_FIT_T : 1;
+    size_t n_t = (tdef + step_t - 1) / step_t;
+    double pairs = (double)off_start[y_def] * x_def * n_t / 2;
+    size_t step_c = (pairs > KRIG_FIT_PAIRS) ? (size_t)(pairs / KRIG_FIT_PAIRS) + 1 : 1;
+
+    double sum_h[KRIG_BINS] = {0}, sum_g[KRIG_BINS] = {0}, cnt[KRIG_BINS] = {0};
+
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:sum_h[:KRIG_BINS],sum_g[:KRIG_BINS],cnt[:KRIG_BINS])
+    for (size_t a = 0; a < n_xy; a += step_c){
+        long xa = a % x_def, ya = a / x_def;
+
+        for (size_t k = off_start[ya]; k < off_start[ya + 1]; k++){
+            if (off[k].dy < 0 || (off[k].dy == 0 && off[k].dx <= 0)) continue;
+
+            long xb = xa + off[k].dx, yb = ya + off[k].dy;
+            if (xb < 0 || yb < 0 || xb >= (long)x_def || yb >= (long)y_def) continue;
+
+            size_t b = yb * x_def + xb;
+            int bin = (int)(off[k].d / radius * KRIG_BINS);
+            if (bin >= KRIG_BINS) bin = KRIG_BINS - 1;
+
+            for (size_t t = 0; t < tdef; t += step_t){
+                datatype va = get_pos_val(data, t * n_xy + a);
+                datatype vb = get_pos_val(data, t * n_xy + b);
+
+                if (fabs(va - info->undef) < UNDEF_ERR || fabs(vb - info->undef) < UNDEF_ERR) continue;
+
+                sum_h[bin] += off[k].d;
+                sum_g[bin] += 0.5 * (va - vb) * (va - vb);
+                cnt[bin]++;
+            }
+        }
+    }
+
+    free(off_start);
+    free(off);
+
+    double h[KRIG_BINS], g[KRIG_BINS];
+    int used = 0;
+
+    for (int b = 0; b < KRIG_BINS; b++){
+        if (cnt[b] > 0){
+            h[b] = sum_h[b] / cnt[b];
+            g[b] = sum_g[b] / cnt[b];
+            used++;
+        }
+    }
+
+    if (!used) return 1;
+
+    // alcance por busca em grade (escala logarítmica), nugget e sill lineares
+    double best = INFINITY;
+
+    for (int i = 0; i < KRIG_RANGES; i++){
+        double range = radius * KRIG_RANGE_MIN * pow(KRIG_RANGE_MAX / KRIG_RANGE_MIN, i / (double)(KRIG_RANGES - 1));
+        double nugget, sill;
+        double err = fit_linear(h, g, cnt, KRIG_BINS, range, &nugget, &sill);
+
+        if (err < best && nugget + sill > 0){
+            best = err;
+            *v = (variogram){nugget, sill, range};
+        }
+    }
+
+    return 1;
+}
+
+
+// resolve L L^T x = b (L triangular inferior em a, n*n)
+static void chol_solve(const double* a, int n, const double* b, double* x){
+    for (int i = 0; i < n; i++){
+        double s = b[i];
+        for (int k = 0; k < i; k++) s -= a[i * n + k] * x[k];
+        x[i] = s / a[i * n + i];
+    }
+
+    for (int i = n - 1; i >= 0; i--){
+        double s = x[i];
+        for (int k = i + 1; k < n; k++) s -= a[k * n + i] * x[k];
+        x[i] = s / a[i * n + i];
+    }
+}
+
+
+int krig_weights(const variogram* v, const double* d, const double* d0, int n, double* lambda){
+    if (n < 1 || n > KRIG_MAX_N) return 0;
+
+    double a[KRIG_MAX_N * KRIG_MAX_N], c0[KRIG_MAX_N], one[KRIG_MAX_N], w[KRIG_MAX_N], u[KRIG_MAX_N];
+    double diag = vario_cov(v, 0) * (1 + KRIG_JITTER);
+
+    // Cholesky da matriz de covariâncias (só a parte inferior é usada)
+    for (int j = 0; j < n; j++){
+        double s = diag;
+        for (int k = 0; k < j; k++) s -= a[j * n + k] * a[j * n + k];
+        if (!(s > 0)) return 0;
+
+        a[j * n + j] = sqrt(s);
+
+        for (int i = j + 1; i < n; i++){
+            double r = vario_cov(v, d[i * n + j]);
+            for (int k = 0; k < j; k++) r -= a[i * n + k] * a[j * n + k];
+            a[i * n + j] = r / a[j * n + j];
+        }
+    }
+
+    for (int i = 0; i < n; i++){
+        c0[i] = vario_cov(v, d0[i]);
+        one[i] = 1;
+    }
+
+    // C w = c0 e C u = 1; a restrição (soma dos pesos = 1) entra pelo multiplicador de Lagrange
+    chol_solve(a, n, c0, w);
+    chol_solve(a, n, one, u);
+
+    double sw = 0, su = 0;
+    for (int i = 0; i < n; i++){
+        sw += w[i];
+        su += u[i];
+    }
+
+    if (!(su > 0)) return 0;
+
+    double mu = (1 - sw) / su;
+    for (int i = 0; i < n; i++) lambda[i] = w[i] + mu * u[i];
+
+    return 1;
+}
@@ -0,0 +1,58 @@
+// Krigagem ordinária
+// O variograma (modelo exponencial) é ajustado às semivariâncias empíricas do dado:
+// pares de quadrículas a menos de um raio, agrupados por distância, em uma amostra de tempos.
+// Os pesos de cada lacuna vêm de um sistema pequeno (poucos vizinhos) na forma de covariância,
+// que é simétrica e positiva definida, resolvido com Cholesky.
+
+#ifndef _CKRIG_
+#define _CKRIG_
+
+#include <math.h>
+#include "c_ctl.h"
+
+
+// faixas de distância das semivariâncias empíricas
+#ifndef KRIG_BINS
+#define KRIG_BINS       15
+#endif
+
+// quantidade máxima de tempos usados no ajuste (espaçados ao longo da série)
+#ifndef KRIG_FIT_T
+#define KRIG_FIT_T      64
+#endif
+
+// quantidade aproximada máxima de pares usados no ajuste (quadrículas são amostradas acima disso)
+#ifndef KRIG_FIT_PAIRS
+#define KRIG_FIT_PAIRS  20000000
+#endif
+
+// maior quantidade de vizinhos em um sistema
+#ifndef KRIG_MAX_N
+#define KRIG_MAX_N      32
+#endif
+
+
+// Variograma exponencial: gamma(h) = nugget + sill*(1 - e^(-h/range)) para h > 0
+typedef struct variogram_struct{
+    double nugget, sill, range;
+} variogram;
+
+
+/* Ajusta o variograma de 'data' com pares a menos de 'radius'.
+ * Retorna 0 em erro de alocação.
+**/
+int fit_variogram(binary_data* data, double radius, double (*dist)(double,double,double,double), variogram* v);
+
+/* Covariância na distância h (C(0) - gamma(h))
+**/
+static inline double vario_cov(const variogram* v, double h){
+    return (h <= 0) ? v->nugget + v->sill : v->sill * exp(-h / v->range);
+}
+
+/* Pesos da krigagem ordinária de n vizinhos (n <= KRIG_MAX_N).
+ * 'd' tem as distâncias entre os vizinhos (n*n) e 'd0' as distâncias até o ponto estimado.
+ * Retorna 0 se o sistema for singular.
+**/
+int krig_weights(const variogram* v, const double* d, const double* d0, int n, double* lambda);
+
+#endif
@@ -0,0 +1,330 @@
+#include "c_oper.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cabeçalho do cache (mesmo layout no disco)
+// seguido pelos registros, um por operador
+typedef struct oper_header_struct{
+    char magic[OPER_MAGIC_SIZE];
+    uint32_t ssize;     // sizeof(size_t) usado na escrita
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t words;
+    uint64_t n_ops;
+} oper_header;
+
+// Início de cada registro, seguido por:
+// mask[words], row_ptr[n_rows+1], cell[n_rows], w_sum[n_rows], min_w[n_rows],
+// col[nnz], val[nnz] e qt[n_rows] (completado até múltiplo de 8 bytes)
+typedef struct oper_record_struct{
+    uint64_t hash;
+    uint64_t n_rows;
+    uint64_t nnz;
+} oper_record;
+
+
+// tamanho de um registro no arquivo
+static size_t record_size(size_t words, size_t n_rows, size_t nnz){
+    size_t qt = (n_rows * sizeof(int) + 7) / 8 * 8;
+
+    return sizeof(oper_record) + words * sizeof(uint64_t)
+        + (2 * n_rows + 1) * sizeof(size_t) + 2 * n_rows * sizeof(double)
+        + nnz * (sizeof(size_t) + sizeof(double)) + qt;
+}
+
+// escreve 'n' bytes na posição 'pos' e avança a posição
+static int write_at(int fd, const void* data, size_t n, size_t* pos){
+    const char* buf = data;
+
+    while (n > 0){
+        ssize_t w = pwrite(fd, buf, n, *pos);
+        if (w <= 0) return 0;
+
+        buf += w;
+        n -= w;
+        *pos += w;
+    }
+
+    return 1;
+}
+
+// espera o lock (flock) 'op' do arquivo
+static int lock_cache(int fd, int op){
+    while (flock(fd, op) != 0)
+        if (errno != EINTR) return 0;
+
+    return 1;
+}
+
+// recria o arquivo apenas com o cabeçalho (com o lock exclusivo do arquivo atual)
+// O arquivo novo é escrito ao lado e renomeado sobre 'name', assim outros processos
+// que mapearam o arquivo antigo continuam lendo o mapa sem que ele seja truncado.
+static int reset_cache(oper_cache* cache, const char* name){
+    oper_header header = {OPER_MAGIC, sizeof(size_t), 0, cache->key, cache->words, 0};
+    size_t pos = 0;
+
+    char* tmp_name = malloc(strlen(name) + 8);
+    if (!tmp_name) return 0;
+    sprintf(tmp_name, "%s.XXXXXX", name);
+
+    int fd = mkstemp(tmp_name);
+    int ok = (fd >= 0) && (fchmod(fd, 0644) == 0)
+        && write_at(fd, &header, sizeof(oper_header), &pos)
+        && (rename(tmp_name, name) == 0);
+
+    if (!ok){
+        if (fd >= 0){
+            close(fd);
+            unlink(tmp_name);
+        }
+        free(tmp_name);
+        return 0;
+    }
+    free(tmp_name);
+
+    close(cache->fd);
+    cache->fd = fd;
+    cache->end = pos;
+    cache->n_file = 0;
+    return 1;
+}
+
+// avança 'pos' do início do registro 'from' até o fim do registro 'to' - 1, lendo os registros do arquivo
+// Retorna 0 se algum registro não couber no arquivo.
+static int records_end(int fd, size_t words, size_t from, size_t to, size_t* pos){
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    size_t size = st.st_size;
+
+    for (size_t i = from; i < to; i++){
+        oper_record rec;
+        if (pread(fd, &rec, sizeof(oper_record), *pos) != sizeof(oper_record)) return 0;
+        if (rec.n_rows > size / sizeof(size_t) || rec.nnz > size / sizeof(size_t)) return 0;
+        if (*pos + record_size(words, rec.n_rows, rec.nnz) > size) return 0;
+
+        *pos += record_size(words, rec.n_rows, rec.nnz);
+    }
+
+    return 1;
+}
+
+// confere um operador lido do arquivo: row_ptr crescente de 0 até nnz,
+// quadrículas da saída abaixo de 'n_cells' e do primário abaixo de 'n_cols'
+static int valid_operator(csr_operator* op, size_t nnz, size_t n_cells, size_t n_cols){
+    if (op->row_ptr[0] != 0 || op->row_ptr[op->n_rows] != nnz) return 0;
+
+    for (size_t r = 0; r < op->n_rows; r++)
+        if (op->row_ptr[r] > op->row_ptr[r + 1] || op->cell[r] >= n_cells) return 0;
+
+    for (size_t k = 0; k < nnz; k++)
+        if (op->col[k] >= n_cols) return 0;
+
+    return 1;
+}
+
+
+uint64_t hash_bytes(uint64_t h, const void* data, size_t n){
+    const unsigned char* bytes = data;
+
+    for (size_t i = 0; i < n; i++){
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+void free_operator(csr_operator* op){
+    if (!op->mapped){
+        free(op->row_ptr);
+        free(op->cell);
+        free(op->qt);
+        free(op->w_sum);
+        free(op->min_w);
+        free(op->col);
+        free(op->val);
+    }
+    memset(op, 0, sizeof(csr_operator));
+}
+
+
+oper_cache* open_oper_cache(const char* name, uint64_t key, size_t words, size_t n_cells, size_t n_cols){
+    oper_cache* cache = calloc(1, sizeof(oper_cache));
+    if (!cache) return NULL;
+
+    cache->key = key;
+    cache->words = words;
+
+    if ((cache->fd = open(name, O_RDWR | O_CREAT, 0644)) < 0 || !lock_cache(cache->fd, LOCK_SH)){
+        fprintf(stderr, "ERRO: não foi possível abrir o cache de operadores (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        if (cache->fd >= 0) close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    // os registros contados no cabeçalho estão completos: ele só é atualizado depois da escrita
+    struct stat st;
+    oper_header header;
+    int valid = (pread(cache->fd, &header, sizeof(oper_header), 0) == sizeof(oper_header))
+        && (fstat(cache->fd, &st) == 0)
+        && !memcmp(header.magic, OPER_MAGIC, OPER_MAGIC_SIZE) && (header.ssize == sizeof(size_t))
+        && (header.key == key) && (header.words == words)
+        && (header.n_ops <= st.st_size / sizeof(oper_record));
+
+    if (valid){
+        cache->map_size = st.st_size;
+        cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, cache->fd, 0);
+
+        cache->hashes = malloc(header.n_ops * sizeof(uint64_t));
+        cache->masks = malloc(header.n_ops * sizeof(uint64_t*));
+        cache->ops = calloc(header.n_ops, sizeof(csr_operator));
+
+        valid = (cache->map != MAP_FAILED) && (!header.n_ops || (cache->hashes && cache->masks && cache->ops));
+        if (cache->map == MAP_FAILED) cache->map = NULL;
+    }
+
+    if (valid){
+        // índice dos registros, os que não passam na conferência são descartados
+        size_t pos = sizeof(oper_header);
+        size_t file_end = pos;
+        valid = records_end(cache->fd, words, 0, header.n_ops, &file_end) && (file_end <= cache->map_size);
+
+        for (size_t i = 0; valid && i < header.n_ops; i++){
+            oper_record* rec = (oper_record*)(cache->map + pos);
+            size_t n_rows = rec->n_rows, nnz = rec->nnz;
+
+            char* data = cache->map + pos + sizeof(oper_record);
+            size_t n = cache->n_ops;
+            csr_operator* op = &cache->ops[n];
+
+            cache->hashes[n] = rec->hash;
+            cache->masks[n] = (uint64_t*)data; data += words * sizeof(uint64_t);
+            op->n_rows  = n_rows;
+            op->row_ptr = (size_t*)data;        data += (n_rows + 1) * sizeof(size_t);
+            op->cell    = (size_t*)data;        data += n_rows * sizeof(size_t);
+            op->w_sum   = (double*)data;        data += n_rows * sizeof(double);
+            op->min_w   = (double*)data;        data += n_rows * sizeof(double);
+            op->col     = (size_t*)data;        data += nnz * sizeof(size_t);
+            op->val     = (double*)data;        data += nnz * sizeof(double);
+            op->qt      = (int*)data;
+            op->mapped  = 1;
+
+            if (valid_operator(op, nnz, n_cells, n_cols)) cache->n_ops++;
+
+            pos += record_size(words, n_rows, nnz);
+        }
+
+        cache->end = pos;
+        cache->n_file = header.n_ops;
+    }
+
+    flock(cache->fd, LOCK_UN);
+
+    if (!valid){
+        if (cache->map) munmap(cache->map, cache->map_size);
+        cache->map = NULL;
+        cache->n_ops = 0;
+
+        // outro processo pode ter recriado o arquivo enquanto o lock era esperado
+        struct stat cur;
+        int ok = lock_cache(cache->fd, LOCK_EX);
+        if (ok && stat(name, &cur) == 0 && fstat(cache->fd, &st) == 0 && cur.st_ino != st.st_ino){
+            close_oper_cache(cache);
+            return open_oper_cache(name, key, words, n_cells, n_cols);
+        }
+
+        ok = ok && reset_cache(cache, name);
+        flock(cache->fd, LOCK_UN);
+
+        if (!ok){
+            fprintf(stderr, "ERRO: não foi possível escrever o cache de operadores (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+            close_oper_cache(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+
+int find_operator(oper_cache* cache, uint64_t hash, const uint64_t* mask, csr_operator* op){
+    for (size_t i = 0; i < cache->n_ops; i++){
+        if (cache->hashes[i] == hash && !memcmp(cache->masks[i], mask, cache->words * sizeof(uint64_t))){
+            *op = cache->ops[i];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int save_operator(oper_cache* cache, uint64_t hash, const uint64_t* mask, csr_operator* op){
+    size_t n_rows = op->n_rows;
+    size_t nnz = op->row_ptr[n_rows];
+    oper_record rec = {hash, n_rows, nnz};
+
+    // qt é completado com zeros até um múltiplo de 8 bytes
+    size_t qt_size = (n_rows * sizeof(int) + 7) / 8 * 8;
+    char* qt = calloc(1, qt_size + 1);
+    if (!qt) return 0;
+    memcpy(qt, op->qt, n_rows * sizeof(int));
+
+    // outros processos podem ter acrescentado registros: o novo vai depois do último contado no cabeçalho
+    oper_header header;
+    int ok = lock_cache(cache->fd, LOCK_EX)
+        && (pread(cache->fd, &header, sizeof(oper_header), 0) == sizeof(oper_header))
+        && (header.key == cache->key) && (header.n_ops >= cache->n_file);
+
+    size_t pos = cache->end;
+    ok = ok && records_end(cache->fd, cache->words, cache->n_file, header.n_ops, &pos);
+    if (ok){
+        cache->end = pos;
+        cache->n_file = header.n_ops;
+    }
+
+    ok = ok && write_at(cache->fd, &rec, sizeof(oper_record), &pos)
+        && write_at(cache->fd, mask, cache->words * sizeof(uint64_t), &pos)
+        && write_at(cache->fd, op->row_ptr, (n_rows + 1) * sizeof(size_t), &pos)
+        && write_at(cache->fd, op->cell, n_rows * sizeof(size_t), &pos)
+        && write_at(cache->fd, op->w_sum, n_rows * sizeof(double), &pos)
+        && write_at(cache->fd, op->min_w, n_rows * sizeof(double), &pos)
+        && write_at(cache->fd, op->col, nnz * sizeof(size_t), &pos)
+        && write_at(cache->fd, op->val, nnz * sizeof(double), &pos)
+        && write_at(cache->fd, qt, qt_size, &pos);
+
+    // o registro só passa a contar quando o cabeçalho for atualizado
+    uint64_t n_ops = cache->n_file + 1;
+    ok = ok && (pwrite(cache->fd, &n_ops, sizeof(uint64_t), offsetof(oper_header, n_ops)) == sizeof(uint64_t));
+    if (ok){
+        cache->end = pos;
+        cache->n_file++;
+        cache->n_new++;
+    }
+
+    flock(cache->fd, LOCK_UN);
+    free(qt);
+
+    return ok;
+}
+
+
+void close_oper_cache(oper_cache* cache){
+    if (!cache) return;
+
+    if (cache->map) munmap(cache->map, cache->map_size);
+    close(cache->fd);
+
+    free(cache->hashes);
+    free(cache->masks);
+    free(cache->ops);
+    free(cache);
+}
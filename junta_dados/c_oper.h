@@ -0,0 +1,88 @@
+// Operadores esparsos de interpolação e cache em arquivo
+// Um operador (formato CSR) guarda, para uma máscara de quadrículas definidas
+// do dado primário, os vizinhos e pesos de cada lacuna. O cache guarda os
+// operadores já montados, identificados pelo hash da máscara, para que
+// execuções seguintes com a mesma geometria (grid, área, método e raios)
+// apenas mapeiem o arquivo na memória em vez de recalcular distâncias e pesos.
+
+#ifndef _COPER_
+#define _COPER_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// identificação do formato (8 bytes no início do arquivo)
+#define OPER_MAGIC      "CMPOPER1"
+#define OPER_MAGIC_SIZE 8
+
+// valor inicial do hash FNV-1a
+#define HASH_INIT       0xcbf29ce484222325ULL
+
+
+// Operador de uma máscara: uma linha por lacuna
+typedef struct csr_operator_struct{
+    size_t n_rows;
+    size_t* row_ptr;    // início da linha r em 'col' e 'val' (n_rows+1 posições)
+    size_t* cell;       // quadrícula (y*x.def + x) da saída de cada linha
+    int* qt;            // avg e msh: 1 + vizinhos que entram na contagem
+    double* w_sum;      // idw e msh: soma dos pesos
+    double* min_w;      // idw: menor peso entre os vizinhos
+    size_t* col;        // quadrícula (y*x.def + x) do primário
+    double* val;        // peso do vizinho
+
+    int mapped;         // vetores apontam para o cache mapeado (não são liberados)
+} csr_operator;
+
+// Cache de operadores aberto
+typedef struct oper_cache_struct{
+    int fd;
+    uint64_t key;       // hash da geometria
+    size_t words;       // palavras de 64 bits da máscara
+
+    char* map;          // arquivo mapeado na memória (NULL se vazio)
+    size_t map_size;
+
+    size_t n_ops;       // operadores do arquivo
+    uint64_t* hashes;   // hash da máscara de cada operador
+    uint64_t** masks;   // máscara de cada operador (dentro do mapa)
+    csr_operator* ops;  // operadores (dentro do mapa)
+
+    size_t end;         // fim dos registros conhecidos do arquivo
+    size_t n_file;      // registros do arquivo até 'end' (incluindo os descartados na conferência)
+    size_t n_new;       // operadores escritos nesta execução
+} oper_cache;
+
+
+/* Hash FNV-1a de 'n' bytes, continuando de 'h' (HASH_INIT para começar)
+**/
+uint64_t hash_bytes(uint64_t h, const void* data, size_t n);
+
+/* Libera os vetores do operador (exceto se estiverem no cache mapeado).
+**/
+void free_operator(csr_operator* op);
+
+/* Abre (ou cria) o cache 'name' da geometria 'key', com máscaras de 'words' palavras.
+ * Operadores com row_ptr fora de ordem ou quadrículas fora das grades (saída com 'n_cells'
+ * e primário com 'n_cols' quadrículas) são descartados. Se o arquivo for de outra geometria
+ * ou estiver corrompido, ele é recriado vazio. Vários processos podem usar o mesmo cache:
+ * a recriação e os acréscimos são feitos com lock (flock) exclusivo do arquivo.
+ * Retorna NULL em erro.
+**/
+oper_cache* open_oper_cache(const char* name, uint64_t key, size_t words, size_t n_cells, size_t n_cols);
+
+/* Procura o operador da máscara 'mask' (com hash 'hash').
+ * Retorna 1 e preenche 'op' (apontando para o mapa) se encontrado, 0 caso contrário.
+**/
+int find_operator(oper_cache* cache, uint64_t hash, const uint64_t* mask, csr_operator* op);
+
+/* Acrescenta o operador da máscara 'mask' ao arquivo e atualiza o cabeçalho.
+ * Retorna 0 em erro de escrita.
+**/
+int save_operator(oper_cache* cache, uint64_t hash, const uint64_t* mask, csr_operator* op);
+
+/* Fecha o cache.
+**/
+void close_oper_cache(oper_cache* cache);
+
+#endif
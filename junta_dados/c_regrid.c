@@ -0,0 +1,166 @@
+#include "c_regrid.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define UNDEF_ERR (0.00001) // Erro permitido ao comparar com undef
+#define EDGE_ERR  (0.0001)  // fração de quadrícula ignorada nas bordas (erros de float)
+
+
+// largura do intervalo [lo,hi]: em graus na longitude, sen(lat) na latitude (proporcional à área)
+static double span(double lo, double hi, int lat){
+    if (!lat) return hi - lo;
+
+    lo = fmax(lo, -90);
+    hi = fmin(hi, 90);
+    return (hi > lo) ? sin(hi * M_PI / 180) - sin(lo * M_PI / 180) : 0;
+}
+
+
+/* Pesos da posição k do eixo de saída ('d') no eixo do secundário ('s').
+ * Se 'idx' for NULL apenas conta. Retorna a quantidade de pesos.
+**/
+static size_t axis_weights(info_coord* d, info_coord* s, int method, int lat, size_t k, long* idx, double* w){
+    double c = d->i + k * d->size;
+    size_t n = 0;
+
+    if (method == REGRID_BIL){
+        // posição do centro entre os centros do secundário
+        double u = (c - s->i) / s->size;
+        long j = (long)floor(u);
+        double f = u - j;
+
+        // fora do secundário: até meia quadrícula usa a da borda
+        if (u < 0 || u > (double)s->def - 1){
+            long jn = (long)floor(u + 0.5);
+            if (jn < 0 || jn >= (long)s->def) return 0;
+
+            if (idx){
+                idx[0] = jn;
+                w[0] = 1;
+            }
+            return 1;
+        }
+
+        if (1 - f > EDGE_ERR){
+            if (idx){
+                idx[n] = j;
+                w[n] = 1 - f;
+            }
+            n++;
+        }
+        if (f > EDGE_ERR && j + 1 < (long)s->def){
+            if (idx){
+                idx[n] = j + 1;
+                w[n] = f;
+            }
+            n++;
+        }
+        return n;
+    }
+
+    // conservativo: quadrículas do secundário que cruzam [lo,hi]
+    double lo = c - d->size / 2, hi = c + d->size / 2;
+    double s_lo = s->i - s->size / 2;
+    long j0 = (long)floor((lo - s_lo) / s->size);
+    long j1 = (long)floor((hi - s_lo) / s->size);
+
+    for (long j = (j0 < 0 ? 0 : j0); j <= j1 && j < (long)s->def; j++){
+        double a = fmax(lo, s_lo + j * s->size);
+        double b = fmin(hi, s_lo + (j + 1) * s->size);
+
+        if (b - a <= EDGE_ERR * fmin(d->size, s->size)) continue;
+
+        if (idx){
+            idx[n] = j;
+            w[n] = span(a, b, lat);
+        }
+        n++;
+    }
+
+    return n;
+}
+
+
+static int build_axis(regrid_axis* ax, info_coord* d, info_coord* s, int method, int lat){
+    ax->n = d->def;
+    ax->src_i = s->i;
+    ax->src_size = s->size;
+    ax->start = calloc(d->def + 1, sizeof(size_t));
+    ax->near = malloc(d->def * sizeof(long));
+    if (!ax->start || !ax->near) return 0;
+
+    for (size_t k = 0; k < d->def; k++){
+        ax->start[k + 1] = ax->start[k] + axis_weights(d, s, method, lat, k, NULL, NULL);
+
+        long jn = (long)floor((d->i + k * d->size - s->i) / s->size + 0.5);
+        ax->near[k] = (jn >= 0 && jn < (long)s->def) ? jn : -1;
+    }
+
+    ax->idx = malloc((ax->start[d->def] + 1) * sizeof(long));
+    ax->w = malloc((ax->start[d->def] + 1) * sizeof(double));
+    if (!ax->idx || !ax->w) return 0;
+
+    for (size_t k = 0; k < d->def; k++)
+        axis_weights(d, s, method, lat, k, ax->idx + ax->start[k], ax->w + ax->start[k]);
+
+    return 1;
+}
+
+
+regrid_op* build_regrid(info_ctl* dest, info_ctl* src, int method){
+    regrid_op* op = calloc(1, sizeof(regrid_op));
+    if (!op) return NULL;
+
+    op->method = method;
+
+    if (!build_axis(&(op->x), &(dest->x), &(src->x), method, 0) ||
+        !build_axis(&(op->y), &(dest->y), &(src->y), method, 1)){
+        free_regrid(op);
+        return NULL;
+    }
+
+    return op;
+}
+
+
+int regrid_val(regrid_op* op, binary_data* src, size_t x, size_t y, long t, datatype* out){
+    if (t < 0 || t >= (long)src->info.tdef) return 0;
+
+    size_t s_x = src->info.x.def;
+    size_t base = t * s_x * src->info.y.def;
+    double sum = 0, w_sum = 0;
+
+    for (size_t j = op->y.start[y]; j < op->y.start[y + 1]; j++){
+        size_t row = base + op->y.idx[j] * s_x;
+
+        for (size_t i = op->x.start[x]; i < op->x.start[x + 1]; i++){
+            datatype v = get_pos_val(src, row + op->x.idx[i]);
+            if (fabs(v - src->info.undef) < UNDEF_ERR) continue;
+
+            double w = op->y.w[j] * op->x.w[i];
+            sum += w * v;
+            w_sum += w;
+        }
+    }
+
+    if (w_sum <= 0) return 0;
+
+    *out = sum / w_sum;
+    return 1;
+}
+
+
+static void free_axis(regrid_axis* ax){
+    free(ax->start);
+    free(ax->idx);
+    free(ax->w);
+    free(ax->near);
+}
+
+void free_regrid(regrid_op* op){
+    if (op){
+        free_axis(&(op->x));
+        free_axis(&(op->y));
+        free(op);
+    }
+}
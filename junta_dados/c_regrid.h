@@ -0,0 +1,53 @@
+// Regradeamento do dado secundário
+// Quando o secundário está em outro grid regular (outra resolução ou origem desalinhada), cada
+// quadrícula do grid de saída é uma média ponderada das quadrículas do secundário.
+// Nos dois grids as linhas e colunas são independentes, então o operador é o produto de duas
+// matrizes esparsas, uma por eixo (longitude e latitude), montadas uma única vez.
+// O operador é aplicado sob demanda, só nas quadrículas e tempos em que o secundário é usado.
+//
+// Métodos:
+//      conservativo: pesos proporcionais à área de interseção entre as quadrículas
+//      bilinear: as quatro quadrículas do secundário em volta do centro
+
+#ifndef _CREGRID_
+#define _CREGRID_
+
+#include <stddef.h>
+#include "c_ctl.h"
+
+
+#define REGRID_CON  0
+#define REGRID_BIL  1
+
+
+// Pesos de um eixo (CSR: uma linha por posição do grid de saída)
+typedef struct regrid_axis_struct{
+    size_t n;           // posições no grid de saída
+    size_t* start;      // início dos pesos de cada posição (n+1 posições)
+    long* idx;          // posição no secundário
+    double* w;
+    long* near;         // posição do secundário que contém o centro, -1 se fora dele
+    double src_i;       // início e tamanho das quadrículas do secundário nesse eixo
+    double src_size;
+} regrid_axis;
+
+typedef struct regrid_op_struct{
+    int method;
+    regrid_axis x, y;
+} regrid_op;
+
+
+/* Monta o operador do grid de 'src' para o grid de 'dest'.
+ * Retorna NULL em erro de alocação.
+**/
+regrid_op* build_regrid(info_ctl* dest, info_ctl* src, int method);
+
+/* Valor regradeado de 'src' na quadrícula (x,y) do grid de saída, no tempo t de 'src'.
+ * Quadrículas indefinidas do secundário ficam de fora e os pesos restantes são renormalizados.
+ * Retorna 0 se não houver quadrícula definida (ou t estiver fora de 'src').
+**/
+int regrid_val(regrid_op* op, binary_data* src, size_t x, size_t y, long t, datatype* out);
+
+void free_regrid(regrid_op* op);
+
+#endif
@@ -0,0 +1,392 @@
+#include "c_station.h"
+#include "geodist.h"
+#include <stdio.h>
+#include <string.h>
+
+
+// posição de (lon,lat) na esfera unitária
+static void unit_sphere(double lon, double lat, double* q){
+    double lo = to_radians(lon), la = to_radians(lat);
+
+    q[0] = cos(la) * cos(lo);
+    q[1] = cos(la) * sin(lo);
+    q[2] = sin(la);
+}
+
+// distância em km a partir da corda na esfera unitária (ao quadrado)
+static double chord_to_km(double c2){
+    double c = sqrt(c2) / 2;
+    return 2 * EARTH_RADIUS * asin(c < 1 ? c : 1);
+}
+
+// corda (ao quadrado) na esfera unitária de uma distância em km
+static double km_to_chord2(double km){
+    double a = km / (2 * EARTH_RADIUS);
+    double c = (a < M_PI / 2) ? 2 * sin(a) : 2;
+    return c * c;
+}
+
+
+// coordenada 'axis' da estação i (ainda na ordem do arquivo, via 'pos')
+static inline double coord(double* pos[3], int axis, size_t i){
+    return pos[axis][i];
+}
+
+/* Monta a árvore em perm[lo,hi): a estação do meio é a mediana no eixo de maior extensão,
+ * as menores ficam antes e as maiores depois.
+**/
+static void build_tree(double* pos[3], size_t* perm, unsigned char* dim, size_t lo, size_t hi){
+    if (hi - lo <= 1){
+        if (hi > lo) dim[lo] = 0;
+        return;
+    }
+
+    // eixo de maior extensão
+    double min[3] = {INFINITY, INFINITY, INFINITY}, max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = lo; i < hi; i++){
+        for (int a = 0; a < 3; a++){
+            double v = coord(pos, a, perm[i]);
+            if (v < min[a]) min[a] = v;
+            if (v > max[a]) max[a] = v;
+        }
+    }
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (max[a] - min[a] > max[axis] - min[axis]) axis = a;
+
+    // quickselect da mediana, partição em três (menores, iguais e maiores que o pivô)
+    size_t mid = lo + (hi - lo) / 2;
+    size_t l = lo, r = hi;
+    while (r - l > 1){
+        double pivot = coord(pos, axis, perm[l + (r - l) / 2]);
+        size_t lt = l, i = l, gt = r;
+
+        while (i < gt){
+            double v = coord(pos, axis, perm[i]);
+            size_t tmp = perm[i];
+
+            if (v < pivot){
+                perm[i++] = perm[lt];
+                perm[lt++] = tmp;
+            }
+            else if (v > pivot){
+                perm[i] = perm[--gt];
+                perm[gt] = tmp;
+            }
+            else i++;
+        }
+
+        if (mid < lt) r = lt;
+        else if (mid >= gt) l = gt;
+        else break;
+    }
+
+    dim[mid] = axis;
+    build_tree(pos, perm, dim, lo, mid);
+    build_tree(pos, perm, dim, mid + 1, hi);
+}
+
+
+// lê o cabeçalho (undef e tdef) do arquivo de estações
+static int read_header(FILE* file, info_ctl* info){
+    char date[64], incr[64];
+
+    memset(info, 0, sizeof(info_ctl));
+
+    if (fscanf(file, " undef %f", &(info->undef)) != 1) return 0;
+    if (fscanf(file, " tdef %lu linear %63s %63s", &(info->tdef), date, incr) != 3) return 0;
+
+    if (!str_to_date(&(info->date_i), date) || !(info->ttype = str_to_ttype(incr))){
+        fprintf(stderr, "ERRO: data do arquivo de estações inválida. Formato aceito: ddmmmaaaa 1mo|1dy|1yr (%s:%d).\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    snprintf(info->tdesc, STR_SIZE, "%s %s\n", date, incr);
+    info->t_from_date_i = date_to_t(info);
+
+    return info->tdef > 0;
+}
+
+
+station_data* open_stations(char* name){
+    FILE* file = fopen(name, "r");
+    if (!file) return NULL;
+
+    station_data* st = calloc(1, sizeof(station_data));
+    if (!st || !read_header(file, &(st->info))){
+        fprintf(stderr, "ERRO: cabeçalho do arquivo de estações inválido (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        fclose(file);
+        free(st);
+        return NULL;
+    }
+
+    size_t tdef = st->info.tdef;
+    size_t cap = 0, n = 0;
+    coordtype* lon = NULL, * lat = NULL;
+    datatype* series = NULL;    // na ordem do arquivo: series[i*tdef + t]
+    int ok = 1;
+
+    float a, b;
+    while (ok && fscanf(file, "%f %f", &a, &b) == 2){
+        if (n == cap){
+            cap = cap ? 2 * cap : 1024;
+
+            coordtype* new_lon = realloc(lon, cap * sizeof(coordtype));
+            if (new_lon) lon = new_lon;
+            coordtype* new_lat = realloc(lat, cap * sizeof(coordtype));
+            if (new_lat) lat = new_lat;
+            datatype* new_series = realloc(series, cap * tdef * sizeof(datatype));
+            if (new_series) series = new_series;
+
+            if (!new_lon || !new_lat || !new_series){
+                ok = 0;
+                break;
+            }
+        }
+
+        lon[n] = wrap_val(a, MIN_X, MAX_X);
+        lat[n] = b;
+        for (size_t t = 0; ok && t < tdef; t++){
+            float v;
+            if (fscanf(file, "%f", &v) != 1) ok = 0;
+            series[n * tdef + t] = v;
+        }
+        n++;
+    }
+
+    if (ok && !feof(file)) ok = 0;
+    fclose(file);
+
+    st->n = n;
+    if (ok && n > 0){
+        st->lon = malloc(n * sizeof(coordtype));
+        st->lat = malloc(n * sizeof(coordtype));
+        st->px  = malloc(n * sizeof(double));
+        st->py  = malloc(n * sizeof(double));
+        st->pz  = malloc(n * sizeof(double));
+        st->dim = malloc(n);
+        st->val = malloc(n * tdef * sizeof(datatype));
+        ok = st->lon && st->lat && st->px && st->py && st->pz && st->dim && st->val;
+    }
+
+    double* pos[3] = {NULL, NULL, NULL};
+    size_t* perm = NULL;
+    if (ok && n > 0){
+        for (int i = 0; i < 3; i++) pos[i] = malloc(n * sizeof(double));
+        perm = malloc(n * sizeof(size_t));
+        ok = pos[0] && pos[1] && pos[2] && perm;
+    }
+
+    if (ok && n > 0){
+        for (size_t i = 0; i < n; i++){
+            double q[3];
+            unit_sphere(lon[i], lat[i], q);
+            for (int a = 0; a < 3; a++) pos[a][i] = q[a];
+            perm[i] = i;
+        }
+
+        build_tree(pos, perm, st->dim, 0, n);
+
+        // estações na ordem da árvore
+        for (size_t i = 0; i < n; i++){
+            st->lon[i] = lon[perm[i]];
+            st->lat[i] = lat[perm[i]];
+            st->px[i] = pos[0][perm[i]];
+            st->py[i] = pos[1][perm[i]];
+            st->pz[i] = pos[2][perm[i]];
+        }
+
+        #pragma omp parallel for
+        for (size_t t = 0; t < tdef; t++)
+            for (size_t i = 0; i < n; i++) st->val[t * n + i] = series[perm[i] * tdef + t];
+    }
+
+    for (int i = 0; i < 3; i++) free(pos[i]);
+    free(perm);
+    free(lon);
+    free(lat);
+    free(series);
+
+    if (!ok || n == 0){
+        fprintf(stderr, "ERRO: arquivo de estações inválido ou sem estações (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        free_stations(st);
+        return NULL;
+    }
+
+    return st;
+}
+
+
+void free_stations(station_data* st){
+    if (st){
+        free(st->lon);
+        free(st->lat);
+        free(st->px);
+        free(st->py);
+        free(st->pz);
+        free(st->dim);
+        free(st->val);
+        free(st);
+    }
+}
+
+
+// distância² (corda) da estação i até q e diferença no eixo de corte do nó
+static inline double node_dist2(station_data* st, const double* q, size_t i, double* diff){
+    double p[3] = {st->px[i], st->py[i], st->pz[i]};
+    double dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+
+    *diff = q[st->dim[i]] - p[st->dim[i]];
+    return dx*dx + dy*dy + dz*dz;
+}
+
+
+// busca por raio
+typedef struct {
+    double c2;
+    size_t n;
+    size_t** idx;
+    double** d;
+    size_t* cap;
+    int ok;
+} radius_query;
+
+static void radius_rec(station_data* st, const double* q, radius_query* rq, size_t lo, size_t hi){
+    if (lo >= hi || !rq->ok) return;
+
+    size_t mid = lo + (hi - lo) / 2;
+    double diff;
+    double d2 = node_dist2(st, q, mid, &diff);
+
+    if (d2 <= rq->c2){
+        if (rq->n == *(rq->cap)){
+            size_t cap = *(rq->cap) ? 2 * *(rq->cap) : 64;
+            size_t* idx = realloc(*(rq->idx), cap * sizeof(size_t));
+            if (idx) *(rq->idx) = idx;
+            double* d = realloc(*(rq->d), cap * sizeof(double));
+            if (d) *(rq->d) = d;
+
+            if (!idx || !d){
+                rq->ok = 0;
+                return;
+            }
+            *(rq->cap) = cap;
+        }
+
+        (*(rq->idx))[rq->n] = mid;
+        (*(rq->d))[rq->n] = chord_to_km(d2);
+        rq->n++;
+    }
+
+    // lado do ponto primeiro, o outro só se o plano de corte estiver ao alcance
+    if (diff < 0){
+        radius_rec(st, q, rq, lo, mid);
+        if (diff * diff <= rq->c2) radius_rec(st, q, rq, mid + 1, hi);
+    }
+    else{
+        radius_rec(st, q, rq, mid + 1, hi);
+        if (diff * diff <= rq->c2) radius_rec(st, q, rq, lo, mid);
+    }
+}
+
+long kd_radius(station_data* st, double lon, double lat, double radius, size_t** idx, double** d, size_t* cap){
+    double q[3];
+    radius_query rq = {km_to_chord2(radius), 0, idx, d, cap, 1};
+
+    unit_sphere(lon, lat, q);
+    radius_rec(st, q, &rq, 0, st->n);
+
+    return rq.ok ? (long)rq.n : -1;
+}
+
+
+// busca das k mais próximas: heap com a mais distante na raiz
+typedef struct {
+    long t;
+    int k, n;
+    size_t* idx;
+    double* d2;
+} nearest_query;
+
+static void heap_push(nearest_query* nq, size_t i, double d2){
+    int c;
+
+    if (nq->n < nq->k){
+        c = nq->n++;
+    }
+    else{
+        // substitui a raiz e desce
+        int p = 0;
+        while (1){
+            int l = 2*p + 1, r = l + 1, m = p;
+            double dm = d2;
+
+            if (l < nq->n && nq->d2[l] > dm){ m = l; dm = nq->d2[l]; }
+            if (r < nq->n && nq->d2[r] > dm) m = r;
+            if (m == p) break;
+
+            nq->idx[p] = nq->idx[m];
+            nq->d2[p] = nq->d2[m];
+            p = m;
+        }
+        nq->idx[p] = i;
+        nq->d2[p] = d2;
+        return;
+    }
+
+    // sobe
+    while (c > 0 && nq->d2[(c - 1) / 2] < d2){
+        nq->idx[c] = nq->idx[(c - 1) / 2];
+        nq->d2[c] = nq->d2[(c - 1) / 2];
+        c = (c - 1) / 2;
+    }
+    nq->idx[c] = i;
+    nq->d2[c] = d2;
+}
+
+static void nearest_rec(station_data* st, const double* q, nearest_query* nq, size_t lo, size_t hi){
+    if (lo >= hi) return;
+
+    size_t mid = lo + (hi - lo) / 2;
+    double diff;
+    double d2 = node_dist2(st, q, mid, &diff);
+
+    if ((nq->t < 0 || station_valid(st, nq->t, mid)) && (nq->n < nq->k || d2 < nq->d2[0]))
+        heap_push(nq, mid, d2);
+
+    size_t near_lo = (diff < 0) ? lo : mid + 1, near_hi = (diff < 0) ? mid : hi;
+    size_t far_lo = (diff < 0) ? mid + 1 : lo, far_hi = (diff < 0) ? hi : mid;
+
+    nearest_rec(st, q, nq, near_lo, near_hi);
+    if (nq->n < nq->k || diff * diff < nq->d2[0]) nearest_rec(st, q, nq, far_lo, far_hi);
+}
+
+int kd_nearest(station_data* st, double lon, double lat, long t, int k, size_t* idx, double* d){
+    double q[3];
+    nearest_query nq = {t, k, 0, idx, d};
+
+    if (k <= 0) return 0;
+
+    unit_sphere(lon, lat, q);
+    nearest_rec(st, q, &nq, 0, st->n);
+
+    // ordem crescente de distância (k é pequeno)
+    for (int i = 1; i < nq.n; i++){
+        size_t ci = idx[i];
+        double cd = d[i];
+        int j = i - 1;
+
+        while (j >= 0 && (d[j] > cd || (d[j] == cd && idx[j] > ci))){
+            idx[j + 1] = idx[j];
+            d[j + 1] = d[j];
+            j--;
+        }
+        idx[j + 1] = ci;
+        d[j + 1] = cd;
+    }
+
+    for (int i = 0; i < nq.n; i++) d[i] = chord_to_km(d[i]);
+
+    return nq.n;
+}
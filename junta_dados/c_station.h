@@ -0,0 +1,67 @@
+// Dados de estações (pluviômetros) em posições irregulares
+// As estações ficam em vetores separados (lon, lat, posição na esfera unitária e séries),
+// na ordem de uma árvore k-d implícita sobre a esfera unitária: o nó de um intervalo [lo,hi)
+// é a estação do meio, e as estações próximas ficam próximas na memória.
+// A árvore responde buscas por raio e pelas k mais próximas (com distância em km).
+//
+// Formato do arquivo (texto):
+//      undef -999.0
+//      tdef 120 linear 01jan1980 1mo
+//      lon lat v_0 v_1 ... v_(tdef-1)      (uma linha por estação)
+
+#ifndef _CSTATION_
+#define _CSTATION_
+
+#include <math.h>
+#include <stddef.h>
+#include "c_ctl.h"
+
+
+// Erro permitido ao comparar com undef
+#define STATION_UNDEF_ERR   (0.00001)
+
+
+// Estações e árvore
+typedef struct station_data_struct{
+    size_t n;               // quantidade de estações
+    info_ctl info;          // undef e eixo de tempo (tdef, ttype, date_i, t_from_date_i)
+
+    coordtype* lon;
+    coordtype* lat;
+    double* px;             // posição na esfera unitária
+    double* py;
+    double* pz;
+    unsigned char* dim;     // eixo de corte do nó de cada estação (0, 1 ou 2)
+
+    datatype* val;          // séries em ordem de tempo: val[t*n + i]
+} station_data;
+
+
+/* Lê o arquivo de estações 'name' e monta a árvore.
+ * Retorna NULL em erro (arquivo inválido ou alocação).
+**/
+station_data* open_stations(char* name);
+
+void free_stations(station_data* st);
+
+/* 1 se a estação i está definida no tempo t (t fora da série: 0)
+**/
+static inline int station_valid(station_data* st, long t, size_t i){
+    if (t < 0 || t >= (long)st->info.tdef) return 0;
+
+    return fabs(st->val[t * st->n + i] - st->info.undef) >= STATION_UNDEF_ERR;
+}
+
+/* Estações a menos de 'radius' km de (lon,lat), em 'idx' e 'd' (distância em km).
+ * Os vetores são realocados conforme necessário ('cap' é sua capacidade).
+ * Retorna a quantidade de estações ou -1 em erro de alocação.
+**/
+long kd_radius(station_data* st, double lon, double lat, double radius, size_t** idx, double** d, size_t* cap);
+
+/* As até k estações mais próximas de (lon,lat) definidas no tempo t (t < 0: todas),
+ * em ordem crescente de distância (km).
+ * Retorna a quantidade encontrada.
+**/
+int kd_nearest(station_data* st, double lon, double lat, long t, int k, size_t* idx, double* d);
+
+#endif
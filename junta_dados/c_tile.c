@@ -0,0 +1,529 @@
+#include "c_tile.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNDEF_ERR (0.00001) // Erro permitido ao comparar com undef
+
+// Cabeçalho do arquivo em blocos (mesmo layout no disco)
+// seguido por: índice [t][ny][nx], mapas de bits [t][ny][nx][words]
+// e os valores válidos de cada bloco não vazio, em ordem do mapa de bits
+typedef struct tile_header_struct{
+    char magic[TILE_MAGIC_SIZE];
+    uint32_t dsize;     // sizeof(datatype) usado na escrita
+    uint32_t tx;
+    uint32_t ty;
+    uint32_t reserved;
+    uint64_t x, y, t;
+    double undef;
+} tile_header;
+
+
+// quantidade total de blocos do índice
+static size_t n_tiles(tile_index* index){
+    return index->nx * index->ny * index->t;
+}
+
+// posição do bloco (bx,by,t) no índice
+static size_t tile_pos(tile_index* index, size_t bx, size_t by, size_t t){
+    return bx + index->nx * (by + index->ny * t);
+}
+
+// largura e altura reais do bloco (bx,by), blocos da borda podem ser menores
+static size_t tile_w(tile_index* index, size_t bx){
+    size_t rest = index->x - bx * index->tx;
+    return (rest < index->tx) ? rest : index->tx;
+}
+
+static size_t tile_h(tile_index* index, size_t by){
+    size_t rest = index->y - by * index->ty;
+    return (rest < index->ty) ? rest : index->ty;
+}
+
+// lê exatamente 'size' bytes de 'fd' a partir de 'offset'
+static int pread_all(int fd, void* buf, size_t size, off_t offset){
+    char* p = buf;
+    while (size > 0){
+        ssize_t r = pread(fd, p, size, offset);
+        if (r <= 0) return 0;
+        p += r;
+        size -= r;
+        offset += r;
+    }
+    return 1;
+}
+
+int is_tile_file(char* name){
+    char magic[TILE_MAGIC_SIZE];
+    FILE* f = fopen(name, "rb");
+
+    if (!f) return 0;
+
+    int ok = (fread(magic, 1, TILE_MAGIC_SIZE, f) == TILE_MAGIC_SIZE) &&
+             !memcmp(magic, TILE_MAGIC, TILE_MAGIC_SIZE);
+
+    fclose(f);
+    return ok;
+}
+
+tile_index* open_tile_index(char* name, size_t x, size_t y, size_t t){
+    tile_header header;
+    tile_index* index;
+    FILE* f;
+
+    if (!(f = fopen(name, "rb"))){
+        fprintf(stderr, "ERRO: não foi possível abrir arquivo em blocos para leitura (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    if (fread(&header, sizeof(tile_header), 1, f) < 1 ||
+        memcmp(header.magic, TILE_MAGIC, TILE_MAGIC_SIZE)){
+        fprintf(stderr, "ERRO: arquivo não está no formato em blocos (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        fclose(f);
+        return NULL;
+    }
+
+    if (header.dsize != sizeof(datatype)){
+        fprintf(stderr, "ERRO: arquivo em blocos com dado de %u bytes, esperado %lu (%s:%d).\n",
+                header.dsize, sizeof(datatype), __FILE__, __LINE__);
+        fclose(f);
+        return NULL;
+    }
+
+    // os tamanhos dos blocos são divisores e as dimensões definem o tamanho do índice
+    if (!header.tx || !header.ty){
+        fprintf(stderr, "ERRO: arquivo em blocos com blocos de tamanho %ux%u (%s). (%s:%d).\n", header.tx, header.ty, name, __FILE__, __LINE__);
+        fclose(f);
+        return NULL;
+    }
+
+    if (header.x != x || header.y != y || header.t != t){
+        fprintf(stderr, "ERRO: dimensões do arquivo em blocos (%lu,%lu,%lu) diferentes do ctl (%lu,%lu,%lu) (%s). (%s:%d).\n",
+                (size_t)header.x, (size_t)header.y, (size_t)header.t, x, y, t, name, __FILE__, __LINE__);
+        fclose(f);
+        return NULL;
+    }
+
+    if (!(index = calloc(1, sizeof(tile_index)))){
+        fclose(f);
+        return NULL;
+    }
+
+    strncpy(index->filename, name, STR_SIZE - 1);
+    index->x = header.x;
+    index->y = header.y;
+    index->t = header.t;
+    index->tx = header.tx;
+    index->ty = header.ty;
+    index->nx = (index->x + index->tx - 1) / index->tx;
+    index->ny = (index->y + index->ty - 1) / index->ty;
+    index->words = (index->tx * index->ty + 63) / 64;
+    index->undef = header.undef;
+
+    size_t n = n_tiles(index);
+
+    index->entries = malloc(n * sizeof(tile_entry));
+    index->bitmaps = malloc(n * index->words * sizeof(uint64_t));
+
+    if (!index->entries || !index->bitmaps ||
+        fread(index->entries, sizeof(tile_entry), n, f) < n ||
+        fread(index->bitmaps, sizeof(uint64_t), n * index->words, f) < n * index->words){
+        fprintf(stderr, "ERRO: índice do arquivo em blocos incompleto (%s). (%s:%d).\n", name, __FILE__, __LINE__);
+        fclose(f);
+        return free_tile_index(index);
+    }
+
+    fclose(f);
+    return index;
+}
+
+tile_index* free_tile_index(tile_index* index){
+    if (index){
+        safeFree(index->entries);
+        safeFree(index->bitmaps);
+        safeFree(index);
+    }
+    return NULL;
+}
+
+/* Lê os blocos de 'index' que cruzam a região [x0,x0+nx) x [y0,y0+ny) x [t0,t0+nt)
+ * para 'dest', que tem as dimensões da região.
+ * Blocos vazios apenas preenchem a região com undef, sem acesso ao disco.
+ * Retorna 1 em sucesso ou 0 em erro
+**/
+static int read_tiles(tile_index* index, binary_data* dest, size_t x0, size_t y0, size_t t0, size_t nx, size_t ny, size_t nt){
+    int fd = open(index->filename, O_RDONLY);
+    int ok = 1;
+
+    if (fd < 0){
+        fprintf(stderr, "ERRO: não foi possível abrir arquivo em blocos para leitura (%s). (%s:%d).\n", index->filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // blocos que cruzam a região
+    size_t bx0 = x0 / index->tx, bx1 = (x0 + nx + index->tx - 1) / index->tx;
+    size_t by0 = y0 / index->ty, by1 = (y0 + ny + index->ty - 1) / index->ty;
+    size_t nbx = bx1 - bx0, nby = by1 - by0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (size_t k = 0; k < nt * nby * nbx; k++){
+        size_t bx = bx0 + k % nbx;
+        size_t by = by0 + (k / nbx) % nby;
+        size_t t  = t0 + k / (nbx * nby);
+
+        size_t pos = tile_pos(index, bx, by, t);
+        tile_entry* e = &(index->entries[pos]);
+        uint64_t* bits = index->bitmaps + pos * index->words;
+        size_t w = tile_w(index, bx), h = tile_h(index, by);
+
+        datatype* vals = NULL;
+        size_t v = 0;
+
+        if (e->valid > 0){
+            if (!(vals = malloc(e->valid * sizeof(datatype))) ||
+                !pread_all(fd, vals, e->valid * sizeof(datatype), e->offset)){
+                safeFree(vals);
+                ok = 0;
+                continue;
+            }
+        }
+
+        for (size_t ly = 0; ly < h; ly++){
+            for (size_t lx = 0; lx < w; lx++){
+                size_t bit = ly * w + lx;
+                datatype val = index->undef;
+
+                if ((bits[bit / 64] >> (bit % 64)) & 1)
+                    val = vals[v++];
+
+                size_t gx = bx * index->tx + lx;
+                size_t gy = by * index->ty + ly;
+
+                // apenas quadrículas dentro da região
+                if (gx >= x0 && gx < x0 + nx && gy >= y0 && gy < y0 + ny)
+                    dest->data[(gx - x0) + nx * ((gy - y0) + ny * (t - t0))] = val;
+            }
+        }
+
+        safeFree(vals);
+    }
+
+    close(fd);
+
+    if (!ok)
+        fprintf(stderr, "ERRO: falha ao ler blocos de %s (%s:%d).\n", index->filename, __FILE__, __LINE__);
+
+    return ok;
+}
+
+binary_data* open_tile(char* name, size_t x, size_t y, size_t t){
+    tile_index* index;
+    binary_data* bin_data;
+
+    if (!(index = open_tile_index(name, x, y, t)))
+        return NULL;
+
+    if (!(bin_data = aloca_bin(x, y, t))){
+        free_tile_index(index);
+        return NULL;
+    }
+
+    if (!read_tiles(index, bin_data, 0, 0, 0, x, y, t))
+        bin_data = free_bin(bin_data);
+
+    free_tile_index(index);
+    return bin_data;
+}
+
+// desloca a data inicial de 'info' em 't0' passos de tempo (ajusta 'tdesc')
+static void shift_date(info_ctl* info, size_t t0){
+    char months[12][4] = {"jan", "feb", "mar", "apr", "may", "jun",
+                          "jul", "aug", "sep", "oct", "nov", "dec"};
+    char step[STR_SIZE] = "";
+    struct tm date = info->date_i;
+
+    if (!t0) return;
+
+    date.tm_hour = 12;
+    date.tm_min = date.tm_sec = 0;
+    date.tm_isdst = -1;
+
+    switch (info->ttype){
+    case T_YEAR:  date.tm_year += t0; break;
+    case T_MONTH: date.tm_mon  += t0; break;
+    case T_DAY:   date.tm_mday += t0; break;
+    }
+    // normaliza dia/mês/ano
+    mktime(&date);
+
+    info->date_i.tm_mday = date.tm_mday;
+    info->date_i.tm_mon = date.tm_mon;
+    info->date_i.tm_year = date.tm_year;
+
+    sscanf(info->tdesc, "%*s %" STR(STR_SIZE) "s", step);
+    snprintf(info->tdesc, STR_SIZE, " %02d%s%04d %s\n", date.tm_mday, months[date.tm_mon], date.tm_year + 1900, step);
+
+    info->t_from_date_i = date_to_t(info);
+}
+
+binary_data* open_tile_region(tile_index* index, info_ctl* info, size_t x0, size_t y0, size_t t0, size_t nx, size_t ny, size_t nt){
+    binary_data* bin_data;
+
+    if (x0 + nx > index->x || y0 + ny > index->y || t0 + nt > index->t){
+        fprintf(stderr, "ERRO: região fora dos limites do arquivo em blocos (%s:%d).\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    if (!(bin_data = aloca_bin(nx, ny, nt)))
+        return NULL;
+
+    if (!read_tiles(index, bin_data, x0, y0, t0, nx, ny, nt))
+        return free_bin(bin_data);
+
+    // ajusta o ctl para a região lida
+    cp_ctl(&(bin_data->info), info);
+
+    bin_data->info.x.def = nx;
+    bin_data->info.x.i = info->x.i + x0 * info->x.size;
+    bin_data->info.x.f = bin_data->info.x.i + nx * info->x.size;
+
+    bin_data->info.y.def = ny;
+    bin_data->info.y.i = info->y.i + y0 * info->y.size;
+    bin_data->info.y.f = bin_data->info.y.i + ny * info->y.size;
+
+    bin_data->info.tdef = nt;
+    shift_date(&(bin_data->info), t0);
+
+    return bin_data;
+}
+
+binary_data* open_bin_ctl_tile(char* name, tile_index** index){
+    info_ctl info_field;
+    binary_data* bin_data;
+    tile_index* tiles;
+
+    if (index) *index = NULL;
+
+    if (!open_ctl(&info_field, name))
+        return NULL;
+
+    if (!is_tile_file(info_field.bin_filename))
+        return open_bin_info(&info_field);
+
+    if (!(tiles = open_tile_index(info_field.bin_filename, info_field.x.def, info_field.y.def, info_field.tdef)))
+        return NULL;
+
+    bin_data = open_tile_region(tiles, &info_field, 0, 0, 0, tiles->x, tiles->y, tiles->t);
+
+    if (bin_data && index)
+        *index = tiles;
+    else
+        free_tile_index(tiles);
+
+    return bin_data;
+}
+
+int write_tile(binary_data* bin_data, size_t tx, size_t ty){
+    tile_header header;
+    tile_index index;
+    FILE* f;
+
+    memset(&header, 0, sizeof(tile_header));
+    memset(&index, 0, sizeof(tile_index));
+
+    index.x = bin_data->info.x.def;
+    index.y = bin_data->info.y.def;
+    index.t = bin_data->info.tdef;
+    index.tx = tx;
+    index.ty = ty;
+    index.nx = (index.x + tx - 1) / tx;
+    index.ny = (index.y + ty - 1) / ty;
+    index.words = (tx * ty + 63) / 64;
+    index.undef = bin_data->info.undef;
+
+    size_t n = n_tiles(&index);
+
+    index.entries = calloc(n, sizeof(tile_entry));
+    index.bitmaps = calloc(n * index.words, sizeof(uint64_t));
+
+    if (!index.entries || !index.bitmaps){
+        fprintf(stderr, "Erro ao alocar memória para o índice em blocos (%s:%d).\n", __FILE__, __LINE__);
+        safeFree(index.entries);
+        safeFree(index.bitmaps);
+        return 0;
+    }
+
+    // estatísticas e mapas de bits de cada bloco
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t k = 0; k < n; k++){
+        size_t bx = k % index.nx;
+        size_t by = (k / index.nx) % index.ny;
+        size_t t  = k / (index.nx * index.ny);
+
+        tile_entry* e = &(index.entries[k]);
+        uint64_t* bits = index.bitmaps + k * index.words;
+        size_t w = tile_w(&index, bx), h = tile_h(&index, by);
+
+        e->cells = w * h;
+        e->min = INFINITY;
+        e->max = -INFINITY;
+
+        for (size_t ly = 0; ly < h; ly++){
+            for (size_t lx = 0; lx < w; lx++){
+                datatype val = get_pos_val(bin_data, get_pos(&(bin_data->info), bx * tx + lx, by * ty + ly, t));
+
+                if (fabs(val - index.undef) < UNDEF_ERR) continue;
+
+                size_t bit = ly * w + lx;
+                bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+
+                e->valid++;
+                if (val < e->min) e->min = val;
+                if (val > e->max) e->max = val;
+            }
+        }
+
+        if (!e->valid)
+            e->min = e->max = index.undef;
+    }
+
+    // posição dos valores de cada bloco no arquivo
+    uint64_t offset = sizeof(tile_header) + n * sizeof(tile_entry) + n * index.words * sizeof(uint64_t);
+    for (size_t k = 0; k < n; k++){
+        if (index.entries[k].valid){
+            index.entries[k].offset = offset;
+            offset += index.entries[k].valid * sizeof(datatype);
+        }
+    }
+
+    memcpy(header.magic, TILE_MAGIC, TILE_MAGIC_SIZE);
+    header.dsize = sizeof(datatype);
+    header.tx = tx;
+    header.ty = ty;
+    header.x = index.x;
+    header.y = index.y;
+    header.t = index.t;
+    header.undef = index.undef;
+
+    int ok = 0;
+    datatype* buff = malloc(tx * ty * sizeof(datatype));
+
+    if (!buff || !(f = fopen(bin_data->info.bin_filename, "wb"))){
+        fprintf(stderr, "Erro ao abrir o arquivo %s para escrita (%s:%d).\n", bin_data->info.bin_filename, __FILE__, __LINE__);
+        goto end;
+    }
+
+    if (fwrite(&header, sizeof(tile_header), 1, f) < 1 ||
+        fwrite(index.entries, sizeof(tile_entry), n, f) < n ||
+        fwrite(index.bitmaps, sizeof(uint64_t), n * index.words, f) < n * index.words){
+        fprintf(stderr, "Erro ao escrever índice em blocos. (%s:%d).\n", __FILE__, __LINE__);
+        fclose(f);
+        goto end;
+    }
+
+    // apenas os valores válidos, na ordem do mapa de bits
+    for (size_t k = 0; k < n; k++){
+        if (!index.entries[k].valid) continue;
+
+        size_t bx = k % index.nx;
+        size_t by = (k / index.nx) % index.ny;
+        size_t t  = k / (index.nx * index.ny);
+        uint64_t* bits = index.bitmaps + k * index.words;
+        size_t w = tile_w(&index, bx), h = tile_h(&index, by);
+        size_t v = 0;
+
+        for (size_t bit = 0; bit < w * h; bit++){
+            if ((bits[bit / 64] >> (bit % 64)) & 1)
+                buff[v++] = get_pos_val(bin_data, get_pos(&(bin_data->info), bx * tx + bit % w, by * ty + bit / w, t));
+        }
+
+        if (fwrite(buff, sizeof(datatype), v, f) < v){
+            fprintf(stderr, "Erro ao escrever binario em blocos. (%s:%d).\n", __FILE__, __LINE__);
+            fclose(f);
+            goto end;
+        }
+    }
+
+    fclose(f);
+    ok = 1;
+
+end:
+    safeFree(buff);
+    safeFree(index.entries);
+    safeFree(index.bitmaps);
+    return ok;
+}
+
+int write_tile_files(binary_data* bin_data, char* name, char* title, size_t tx, size_t ty){
+    char name_bin[STR_SIZE];
+    char name_ctl[STR_SIZE];
+
+    snprintf(name_bin, STR_SIZE, "%s.bin", name);
+    snprintf(name_ctl, STR_SIZE, "%s.ctl", name);
+
+    strcpy(bin_data->info.bin_filename, name_bin);
+
+    return (write_tile(bin_data, tx, ty) && write_ctl(&(bin_data->info), name_ctl, title));
+}
+
+tile_entry* get_tile(tile_index* index, size_t x, size_t y, size_t t){
+    if (x >= index->x || y >= index->y || t >= index->t)
+        return NULL;
+
+    return &(index->entries[tile_pos(index, x / index->tx, y / index->ty, t)]);
+}
+
+int tile_state(tile_index* index, size_t x, size_t y, size_t t){
+    tile_entry* e = get_tile(index, x, y, t);
+
+    if (!e || !e->valid) return TILE_EMPTY;
+
+    return (e->valid == e->cells) ? TILE_FULL : TILE_MIXED;
+}
+
+int tile_cell_valid(tile_index* index, size_t x, size_t y, size_t t){
+    size_t bx = x / index->tx, by = y / index->ty;
+    tile_entry* e;
+
+    if (!(e = get_tile(index, x, y, t)) || !e->valid) return 0;
+    if (e->valid == e->cells) return 1;
+
+    size_t pos = tile_pos(index, bx, by, t);
+    size_t bit = (y - by * index->ty) * tile_w(index, bx) + (x - bx * index->tx);
+
+    return (index->bitmaps[pos * index->words + bit / 64] >> (bit % 64)) & 1;
+}
+
+size_t tile_count_gaps(tile_index* index, size_t t, size_t x0, size_t x1, size_t y0, size_t y1){
+    size_t gaps = 0;
+
+    if (x1 > index->x) x1 = index->x;
+    if (y1 > index->y) y1 = index->y;
+    if (t >= index->t || x0 >= x1 || y0 >= y1) return 0;
+
+    for (size_t by = y0 / index->ty; by * index->ty < y1; by++){
+        for (size_t bx = x0 / index->tx; bx * index->tx < x1; bx++){
+            tile_entry* e = &(index->entries[tile_pos(index, bx, by, t)]);
+
+            size_t gx0 = bx * index->tx, gy0 = by * index->ty;
+            size_t w = tile_w(index, bx), h = tile_h(index, by);
+
+            // bloco totalmente contido na região: apenas o índice
+            if (gx0 >= x0 && gx0 + w <= x1 && gy0 >= y0 && gy0 + h <= y1){
+                gaps += e->cells - e->valid;
+                continue;
+            }
+
+            // bloco na borda da região: contagem pelo mapa de bits
+            for (size_t gy = (gy0 > y0 ? gy0 : y0); gy < gy0 + h && gy < y1; gy++)
+                for (size_t gx = (gx0 > x0 ? gx0 : x0); gx < gx0 + w && gx < x1; gx++)
+                    gaps += !tile_cell_valid(index, gx, gy, t);
+        }
+    }
+
+    return gaps;
+}
@@ -0,0 +1,115 @@
+// Container em blocos (tiles) para arquivos binários de chuva
+// Alternativa opcional ao .bin do GrADS: os dados são guardados em blocos
+// (t, y-tile, x-tile) com um índice no cabeçalho contendo, para cada bloco,
+// a quantidade de quadrículas válidas, um mapa de bits de validade e min/max.
+// Blocos totalmente indefinidos não ocupam espaço nem são lidos.
+
+#ifndef _CTILE_
+#define _CTILE_
+
+#include <stdint.h>
+#include "c_ctl.h"
+
+
+// identificação do formato (8 bytes no início do arquivo)
+#define TILE_MAGIC      "CTLTILE1"
+#define TILE_MAGIC_SIZE 8
+
+// tamanho padrão dos blocos
+#ifndef TILE_DEF_X
+#define TILE_DEF_X      32
+#endif
+#ifndef TILE_DEF_Y
+#define TILE_DEF_Y      32
+#endif
+
+// estado de um bloco segundo o índice
+#define TILE_EMPTY  0   // todas as quadrículas indefinidas
+#define TILE_MIXED  1   // algumas quadrículas válidas
+#define TILE_FULL   2   // todas as quadrículas válidas
+
+
+// Entrada do índice, uma para cada bloco (mesmo layout no disco)
+typedef struct tile_entry_struct{
+    uint64_t offset;    // posição dos valores válidos no arquivo (0 se vazio)
+    uint32_t valid;     // quantidade de quadrículas válidas
+    uint32_t cells;     // quantidade de quadrículas do bloco (blocos da borda são menores)
+    double min;         // menor valor válido
+    double max;         // maior valor válido
+} tile_entry;
+
+// Índice de um arquivo em blocos
+typedef struct tile_index_struct{
+    char filename[STR_SIZE];
+
+    size_t x, y, t;     // dimensões do dado
+    size_t tx, ty;      // dimensões de um bloco
+    size_t nx, ny;      // quantidade de blocos em x e y
+    size_t words;       // palavras de 64 bits do mapa de bits de cada bloco
+
+    datatype undef;     // valor indefinido
+
+    tile_entry* entries;    // índice [t][ny][nx]
+    uint64_t* bitmaps;      // mapas de bits [t][ny][nx][words]
+} tile_index;
+
+
+/* Retorna 1 se o arquivo 'name' está no formato em blocos, 0 caso contrário.
+**/
+int is_tile_file(char* name);
+
+/* Lê o cabeçalho, o índice e os mapas de bits do arquivo em blocos 'name'
+ * O cabeçalho deve ter blocos de tamanho não nulo e as dimensões (x,y,t) do ctl.
+ * Retorna o ponteiro para o índice, ou NULL em erro
+**/
+tile_index* open_tile_index(char* name, size_t x, size_t y, size_t t);
+
+// Libera a alocação de 'index'
+tile_index* free_tile_index(tile_index* index);
+
+/* Abre um arquivo em blocos com as dimensões (x,y,t) esperadas
+ * Blocos vazios não são lidos do disco, apenas preenchidos com 'undef'.
+ * Retorna o ponteiro para a struct de dado, ou NULL em erro
+**/
+binary_data* open_tile(char* name, size_t x, size_t y, size_t t);
+
+/* Lê apenas a região [x0,x0+nx) x [y0,y0+ny) x [t0,t0+nt) do arquivo de 'index'
+ * apenas os blocos que cruzam a região são lidos.
+ * As informações de 'info' (ctl do arquivo completo) são ajustadas para a região.
+ * Retorna o ponteiro para a struct de dado, ou NULL em erro
+**/
+binary_data* open_tile_region(tile_index* index, info_ctl* info, size_t x0, size_t y0, size_t t0, size_t nx, size_t ny, size_t nt);
+
+/* Abre o ctl 'name' e o binário correspondente, seja ele .bin ou em blocos.
+ * Se o arquivo está em blocos e 'index' não for NULL, '*index' recebe o índice
+ * (ou NULL se o arquivo for um .bin comum).
+ * Retorna o ponteiro para a struct de dado, ou NULL em erro
+**/
+binary_data* open_bin_ctl_tile(char* name, tile_index** index);
+
+/* Escreve 'bin_data' no formato em blocos de tamanho (tx,ty) no arquivo
+ * 'bin_data->info.bin_filename'
+ * retorna 1 em sucesso ou 0 em erro
+**/
+int write_tile(binary_data* bin_data, size_t tx, size_t ty);
+
+// Escreve o binário em blocos e o ctl de nome 'name' (mesmo formato de 'write_files')
+int write_tile_files(binary_data* bin_data, char* name, char* title, size_t tx, size_t ty);
+
+// Retorna a entrada do índice do bloco que contém a quadrícula (x,y,t)
+tile_entry* get_tile(tile_index* index, size_t x, size_t y, size_t t);
+
+// Retorna TILE_EMPTY, TILE_MIXED ou TILE_FULL para o bloco que contém (x,y,t)
+int tile_state(tile_index* index, size_t x, size_t y, size_t t);
+
+/* Retorna 1 se a quadrícula (x,y,t) é válida segundo o mapa de bits
+ * Retorna 0 caso contrário (ou se está fora dos limites).
+**/
+int tile_cell_valid(tile_index* index, size_t x, size_t y, size_t t);
+
+/* Quantidade de quadrículas indefinidas no tempo 't' dentro da região
+ * [x0,x1) x [y0,y1), usando apenas o índice (sem ler os dados)
+**/
+size_t tile_count_gaps(tile_index* index, size_t t, size_t x0, size_t x1, size_t y0, size_t y1);
+
+#endif
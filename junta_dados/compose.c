@@ -14,6 +14,14 @@ Missão:
 #include <getopt.h>     //getopt
 #include <string.h>     //strncpy
 #include "c_ctl.h"
+#include "c_tile.h"
+#include "c_oper.h"
+#include "c_corr.h"
+#include "c_dtrans.h"
+#include "c_station.h"
+#include "c_krig.h"
+#include "c_regrid.h"
+#include "c_halo.h"
 #include "geodist.h"
 
 
@@ -38,6 +46,24 @@ Missão:
 #ifndef MAX_SIZE
 #define MAX_SIZE        1.0                         //Tamanho de quadrícula máximo recomendado
 #endif
+#ifndef CSH_N
+#define CSH_N           7                           //Quantidade de estações mais correlacionadas usadas no método csh
+#endif
+#ifndef OKR_N
+#define OKR_N           12                          //Quantidade de vizinhas mais próximas usadas no método okr
+#endif
+#ifndef OKR_MIN
+#define OKR_MIN         3                           //Quantidade mínima de vizinhas para montar o sistema da krigagem
+#endif
+#ifndef STATION_K
+#define STATION_K       8                           //Quantidade de estações mais próximas usadas no IDW com --stations
+#endif
+#ifndef STATION_MIN_DIST
+#define STATION_MIN_DIST 0.001                      //Distância mínima (km) entre estação e quadrícula usada nos pesos
+#endif
+#ifndef MAX_SEC
+#define MAX_SEC         8                           //Quantidade máxima de secundários seguintes (--then)
+#endif
 #ifndef MIN_NGAUGE
 #define MIN_NGAUGE      1                           //Quantidade minima de estações (gauges) permitidas ao usar arquivo 'ngauge'
 #endif
@@ -50,6 +76,12 @@ Missão:
 #define AVG_FLAG 1
 #define IDW_FLAG 2
 #define MSH_FLAG 3
+#define CSH_FLAG 4
+#define OKR_FLAG 5
+
+#if OKR_N > KRIG_MAX_N
+#error "OKR_N maior que KRIG_MAX_N"
+#endif
 
 
 #define EXEC_MSG "primario.ctl secundario.ctl prefixo_saida"
@@ -60,11 +92,27 @@ Missão:
     "\n\t--loni LON_INI, --xi LON_INI"\
     "\n\t--lonf LON_FIN, --xf LON_FIN\n"\
     "\n\t--s-ngauge secundario_numgauge.ctl\tarquivo com número de estações de chuva por quadrícula do dado secundário.\n"\
+    "\n\t-T, --then arquivo.ctl[:metodo[:ngauge.ctl]]\tPróximo secundário (pode repetir): usado nas lacunas em que os anteriores"\
+    "\n\t\t\t\tsão indefinidos, com seu método (avg, idw, msh, csh, okr, none; padrão o principal) e 'ngauge'.\n"\
+    "\n\t-R, --regrid con|bil\tSecundário em outro grid: regradeamento conservativo (padrão) ou bilinear para o grid do primário.\n"\
     "\n\t-a, --avg\t\tUsa método de médias entre as quadriculas para interpolação."\
     "\n\t-i, --idw\t\tUsa método de peso inverso à distância (IDW) para interpolação."\
     "\n\t-m, --msh\t\tUsa método de Shepard Modificado para interpolação."\
+    "\n\t-C, --csh\t\tUsa método de Shepard por correlação: pesos 1/e^(1-CC) das estações mais correlacionadas com a mais próxima."\
+    "\n\t-W, --csh-window N\tCom --csh, correlações sobre os N tempos em torno de cada tempo em vez de toda a série."\
+    "\n\t-k, --okr\t\tUsa krigagem ordinária com as OKR_N quadrículas definidas mais próximas e variograma ajustado ao primário."\
     "\n\t-n, --none\t\tApenas junta as quadrículas, sem interpolação, preferência para os dados primários."\
-    "\n\t-d, --debug\t\tSaída gerada contém apenas quadrículas que sofreram alteração, demais valores serão undef."
+    "\n\t-d, --debug\t\tSaída gerada contém apenas quadrículas que sofreram alteração, demais valores serão undef."\
+    "\n\t-S, --sparse\t\tSaída no formato esparso (apenas quadrículas definidas), lido pelos programas que usam c_ctl."\
+    "\n\t-P, --per-cell\t\tInterpola quadrícula a quadrícula, sem montar um operador por máscara de lacunas."\
+    "\n\t-H, --halo\t\tCópia do primário com borda: vizinhos sem teste de limites e, em grids globais, através da longitude 0/360."\
+    "\n\t-K, --cache arquivo\tCache dos operadores por máscara: reaproveitado se a geometria (grids, área, método, raios) for a mesma."\
+    "\n\t-c, --cells arquivo\tColunas (linhas 'lon lat') interpoladas com pesos calculados uma vez e reutilizados em todos os tempos."\
+    "\n\t-E, --stations arquivo\tEstações (lon lat e série) no lugar do primário, interpoladas direto no grid do secundário (-i ou -m):"\
+    "\n\t\t\t\t--stations estacoes.txt secundario.ctl prefixo_saida"\
+    "\n\t-B, --batch manifesto\tExecuta os jobs do manifesto, um por linha (sem os argumentos posicionais):"\
+    "\n\t\t\t\tprimario.ctl secundario.ctl xi xf yi yf metodo prefixo_saida [ngauge.ctl]"\
+    "\n\t--print-isa\t\tMostra a variante (avx512f, avx2 ou default) das funções vetorizadas escolhida para esta CPU."
 #define EXEM_MSG "--xi -89.5 --xf -31.5 --yi -56.5f --yf 14.5f --msh"
 
 
@@ -75,6 +123,153 @@ Missão:
 **/
 binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordtype xf, coordtype yi, coordtype yf, binary_data* ngauge);
 
+/* Como compose_data, mas o primário são as estações de 'st', interpoladas direto no grid de 's'
+ * (idw: as STATION_K mais próximas a menos de MAJOR_RADIUS; msh: todas a menos de MAJOR_RADIUS).
+ * A saída tem o grid e os tempos de 's'. Retorna NULL em erro.
+**/
+binary_data* compose_stations(station_data* st, binary_data* s, coordtype xi, coordtype xf, coordtype yi, coordtype yf, binary_data* ngauge);
+
+/* Modified Shepard das estações 'idx' (a 'd' km da quadrícula) no tempo t_st das estações.
+ * Retorna 1 se ocorreu interpolação.
+**/
+int station_msh(binary_data* dest, binary_data* s, station_data* st, size_t x, size_t y, size_t t, long t_st,
+                size_t* idx, double* d, long n, binary_data* ngauge);
+
+/* IDW das estações mais próximas de (lon,lat) definidas no tempo t_st das estações.
+ * Retorna 1 se ocorreu interpolação.
+**/
+int station_idw(binary_data* dest, binary_data* s, station_data* st, size_t x, size_t y, size_t t, long t_st,
+                double lon, double lat, binary_data* ngauge);
+
+/* Copia o valor de 'p' para a quadrícula (x,y,t) de 'dest'.
+ * Retorna 1 se a quadrícula for uma lacuna do dado primário (deve ser interpolada).
+ * (p_ox,p_oy,p_ot) é o deslocamento de 'p' dentro de 'dest', usado com o índice em blocos.
+**/
+int primary_gap(binary_data* dest, binary_data* p, size_t x, size_t y, size_t t, size_t p_ox, size_t p_oy, size_t p_ot);
+
+/* Fim (exclusivo, em x de 'dest') da linha do bloco sem lacunas do primário em blocos que contém (x,y,t).
+ * Retorna x se o primário não estiver em blocos, se (x,y,t) estiver fora dele ou se o bloco tiver lacunas.
+**/
+size_t full_tile_end(size_t x, size_t y, size_t t, size_t p_ox, size_t p_oy, size_t p_ot);
+
+/* Tempo do primário correspondente ao tempo t de 'dest', -1 se estiver fora do primário
+**/
+long p_time(binary_data* dest, binary_data* p, size_t t);
+
+/* Quadrícula (y*x.def + x) do primário na posição (x,y) de 'dest', -1 se estiver fora do primário
+**/
+long p_cell(binary_data* dest, binary_data* p, int x, int y);
+
+/* 1 se a quadrícula c do primário está definida no tempo t_src (pelo mapa de validade, se houver)
+**/
+int p_valid(binary_data* p, long t_src, long c);
+
+/* Escolhe as funções do método (*_FLAG) e mostra o seu nome.
+**/
+void set_method(int method);
+
+/* Método (*_FLAG) pelo nome (none, avg, idw, msh, csh, okr), -1 se desconhecido
+**/
+int method_from_name(const char* name);
+
+/* Copia o valor secundário para a quadrícula (x,y,t) de 'dest', como cp_data_val.
+ * Com o secundário em outro grid (g_regrid) o valor é regradeado nesse momento.
+**/
+datatype cp_sec_val(binary_data* dest, binary_data* s, int x, int y, int t);
+
+/* Quantidade de estações do secundário na quadrícula (x,y,t) de 'dest', como get_data_val.
+ * Com o secundário em outro grid (g_regrid) é a da quadrícula do secundário que contém o centro.
+**/
+datatype ngauge_val(binary_data* dest, binary_data* ngauge, int x, int y, int t);
+/*===========================*/
+
+/*= CADEIA DE SECUNDÁRIOS (--then) =*/
+
+/* Os secundários passados com --then formam uma cadeia de prioridade depois do secundário principal.
+ * Uma lacuna em que o principal é indefinido é resolvida na mesma passada com o primeiro secundário
+ * definido da cadeia, usando o método e o 'ngauge' dele (os vizinhos são sempre os do primário).
+ * Fora da área vale o primeiro secundário definido e, se nenhum for, o primário.
+**/
+
+// secundário da cadeia
+typedef struct {
+    char name[STR_SIZE];
+    char ngauge_name[STR_SIZE];
+    int method;                 // *_FLAG, -1 para o método principal
+    binary_data* s;
+    binary_data* ngauge;
+    regrid_op* regrid;          // NULL se estiver no grid de saída
+} sec_source;
+
+/* Lê 'arg' no formato arquivo.ctl[:metodo[:ngauge.ctl]] para o próximo secundário da cadeia.
+ * Retorna 0 se o formato for inválido ou a cadeia estiver cheia.
+**/
+int add_chain(char* arg);
+
+/* Abre os arquivos da cadeia. Retorna 0 em erro (a mensagem indica o arquivo).
+**/
+int open_chain();
+
+/* Confere os secundários da cadeia com o primário e monta os regradeamentos para o grid de 'dest'.
+ * Retorna 0 em erro.
+**/
+int prepare_chain(binary_data* dest, binary_data* p);
+
+/* Se a lacuna (x,y,t) ficou indefinida, interpola com o primeiro secundário definido da cadeia.
+ * Retorna 1 se ocorreu interpolação ('modified' se a cadeia não foi usada).
+**/
+int chain_gap(binary_data* dest, binary_data* p, size_t x, size_t y, size_t t, int modified);
+
+/* Copia para (x,y,t) o valor do primeiro secundário definido da cadeia (undef se nenhum).
+**/
+datatype cp_chain_val(binary_data* dest, int x, int y, int t);
+
+/* 1 se algum secundário da cadeia usa o método 'method'
+**/
+int chain_uses(int method);
+
+void free_chain();
+/*===========================*/
+
+/*= LOTE (--batch) =*/
+
+/* Com --batch os jobs de um manifesto (um por linha) são executados em um único processo:
+ *      primario.ctl secundario.ctl xi xf yi yf metodo prefixo_saida [ngauge.ctl]
+ * Cada arquivo de entrada é aberto uma vez e fica na memória enquanto algum job seguinte o usar,
+ * e as tabelas de geometria continuam valendo enquanto o grid e o método se repetem (same_geometry).
+ * Os jobs passam por três etapas (leitura, composição e escrita) em um pipeline: enquanto o job N
+ * é composto, o N+1 é lido e o N-1 é escrito.
+**/
+
+// arquivo de entrada compartilhado entre jobs
+typedef struct {
+    char name[STR_SIZE];
+    binary_data* data;
+    tile_index* tiles;          // índice em blocos, se o arquivo estiver nesse formato
+    size_t uses;                // usos pelos jobs que ainda não foram compostos
+} batch_input;
+
+typedef struct {
+    size_t line;                // linha no manifesto
+    long pri, sec, ngauge;      // arquivos em 'inputs' (ngauge -1 se não houver)
+    coordtype xi, xf, yi, yf;
+    int method;
+    char out[STR_SIZE];
+
+    int ok;
+    binary_data* result;
+} batch_job;
+
+/* Lê o manifesto 'name'. 'inputs' recebe os arquivos distintos (com a quantidade de usos).
+ * Retorna a quantidade de jobs ou -1 em erro.
+**/
+long read_manifest(const char* name, batch_job** jobs, batch_input** inputs, size_t* n_inputs);
+
+/* Executa os jobs de 'manifest' com as opções globais já lidas ('csh_window' é a de --csh-window).
+ * Retorna 0 se todos os jobs foram concluídos, ou o código de erro.
+**/
+int run_batch(const char* manifest, size_t csh_window);
+
 
 /* Calcula a distancia entre quadriculas para latitudes diferentes.
  * Recebe como entrada um ctl e a função de distancia.
@@ -122,6 +317,14 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 **/
 int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
 
+/* Shepard por correlação (method.md)
+**/
+int cshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+
+/* Krigagem ordinária (c_krig.h)
+**/
+int okr_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+
 /* Nenhuma
  * */
 int none_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
@@ -131,6 +334,221 @@ int none_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src
  * https://iri.columbia.edu/~rijaf/CDTUserGuide/html/interpolation_methods.html
  *===========================*/
 
+/*= INTERPOLAÇÃO POR COLUNAS (--cells) =*/
+
+/* Quando as mesmas quadrículas faltam em todos os tempos (estação removida),
+ * os pesos de cada uma são calculados uma única vez (estêncil) e reaplicados
+ * em cada tempo, considerando apenas os vizinhos definidos naquele tempo.
+ * O resultado é idêntico ao da função de interpolação correspondente.
+**/
+
+// vizinho do estêncil: deslocamento, peso e se está dentro do raio menor (msh)
+typedef struct {
+    int dx, dy;
+    double w;
+    int minor;
+} stencil_point;
+
+typedef struct {
+    int active;             // coluna passada em --cells (e dentro da área)
+    size_t n;
+    stencil_point* pts;
+} stencil;
+
+/* Calculam o estêncil da quadrícula (x,y) de 'dest'.
+ * Retornam 0 em erro de alocação.
+**/
+int average_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+int idweight_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+int mshepard_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+int none_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+int cshepard_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+int okr_stencil(stencil* st, binary_data* dest, size_t x, size_t y);
+
+/* Aplicam o estêncil no tempo t, mesmo retorno das funções de interpolação.
+**/
+int average_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+int idweight_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+int mshepard_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+int none_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+int cshepard_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+int okr_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge);
+
+/* Lê o arquivo de colunas: uma coluna por linha, no formato 'lon lat'.
+ * Retorna a quantidade de colunas lidas ou -1 em erro.
+**/
+long read_cells(const char* name, coordtype** cells);
+
+/* Calcula os estênceis das colunas de 'g_cells' que estão dentro da área.
+ * Retorna um vetor com uma entrada por quadrícula (x,y) de 'dest' ou NULL em erro.
+**/
+stencil* build_columns(binary_data* dest, coordtype xi, coordtype xf, coordtype yi, coordtype yf, size_t* n_active);
+
+void free_columns(stencil* columns, size_t n);
+/*===========================*/
+
+/*= OPERADORES POR MÁSCARA =*/
+
+/* Fixado o conjunto de quadrículas definidas do primário (máscara) num tempo,
+ * a interpolação de cada lacuna é uma soma ponderada dos vizinhos primários,
+ * combinada com o valor secundário daquele tempo:
+ *      avg: (Σ p_k + s) / (qt)         idw: (Σ w_k p_k + min_w s) / (W + min_w)
+ *      msh: (Σ w_k p_k / W)(1 - 1/qt) + s/qt      okr: (Σ λ_k p_k)(1 - 1/qt) + s/qt
+ * Os tempos são agrupados pela máscara; para cada máscara distinta o operador
+ * é montado uma vez (formato CSR, uma linha por lacuna) e aplicado a todos os
+ * tempos do grupo. O secundário e o 'ngauge' continuam sendo lidos em cada tempo.
+**/
+
+/* Agrupa os tempos de 'dest' pela máscara do primário.
+ * 'group[t]' recebe o índice do grupo (ou -1 se o tempo deve ser interpolado quadrícula a quadrícula)
+ * e 'rep' o tempo representante de cada grupo.
+ * Retorna a quantidade de grupos ou -1 em erro de alocação.
+**/
+long group_masks(binary_data* dest, binary_data* p, long* group, size_t** rep);
+
+/* Monta o operador das lacunas 'cells' (quadrículas de 'dest') no tempo 'rep' de 'dest'.
+ * Retorna 0 em erro de alocação.
+**/
+int build_operator(csr_operator* op, binary_data* dest, binary_data* p, size_t rep, size_t* cells, size_t n_cells, dist_map* dm);
+
+/* Aplica o operador nos tempos 'times' (SpMM: cada linha percorre todos os tempos do grupo).
+**/
+void apply_operator(csr_operator* op, binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, size_t* times, size_t n_times);
+
+/* Preenche as lacunas dos tempos com grupo (group[t] >= 0) dentro da área, exceto as colunas de --cells.
+ * Retorna 0 em erro de alocação.
+**/
+int compose_operators(binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, coordtype xi, coordtype xf, coordtype yi, coordtype yf,
+                      stencil* columns, long* group, size_t* rep, long n_groups);
+
+/* Preenche as lacunas dentro da área com correlações da janela de cada tempo (--csh-window).
+ * Os tempos são percorridos em ordem para que a janela apenas deslize de um tempo ao seguinte.
+**/
+void compose_window(binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, coordtype xi, coordtype xf, coordtype yi, coordtype yf,
+                    size_t p_ox, size_t p_oy, size_t p_ot);
+
+/* Hash da geometria dos operadores: grids, área, método, BETA, raios e colunas de --cells.
+**/
+uint64_t operator_key(binary_data* dest, binary_data* p, coordtype xi, coordtype xf, coordtype yi, coordtype yf);
+
+/* Máscara do primário no tempo t_src como mapa de bits de 'words' palavras
+**/
+void mask_words(binary_data* p, long t_src, uint64_t* mask, size_t words);
+/*===========================*/
+
+/*= SHEPARD POR CORRELAÇÃO =*/
+
+/* As correlações entre as séries do primário (dentro de MAJOR_RADIUS) são calculadas
+ * uma vez, antes da interpolação. Para cada lacuna a estação mais próxima (NS) definida
+ * no tempo é encontrada percorrendo os vizinhos em ordem de distância, e entre as estações
+ * definidas a menos de MAJOR_RADIUS da NS ficam as CSH_N mais correlacionadas com ela.
+ * Como a escolha depende apenas da máscara, os pesos entram nos operadores por máscara.
+ * Com --csh-window as correlações mudam a cada tempo (janela móvel) e não há operadores.
+**/
+
+/* Calcula as correlações e os vizinhos de busca da NS.
+ * Retorna 0 em erro de alocação.
+**/
+int cshepard_prepare(binary_data* dest, binary_data* p);
+
+/* Vizinhos de cada linha de 'dest' a menos de MAJOR_RADIUS em ordem de distância (g_near).
+ * Retorna 0 em erro de alocação.
+**/
+int prepare_near(binary_data* dest);
+
+/* Primeiro vizinho da lacuna (x,y) em g_near que pode estar definido no tempo t_src:
+ * se 'dm' for a transformada desse tempo, os mais próximos que a sua distância são pulados.
+**/
+size_t near_first(size_t x, size_t y, long t_src, dist_map* dm);
+
+/* Seleciona as estações da lacuna (x,y) de 'dest' no tempo t_src do primário.
+ * Preenche 'col' (quadrícula do primário) e 'w' (peso 1/e^(1-CC)), em ordem decrescente de correlação.
+ * Se 'dm' for a transformada do tempo t_src, a busca da NS começa na distância da mais próxima.
+ * Retorna a quantidade de estações (até CSH_N).
+**/
+int cshepard_select(binary_data* dest, binary_data* p, size_t x, size_t y, long t_src, size_t* col, double* w, dist_map* dm);
+
+void free_cshepard();
+
+/* 1 se o grid de 'info' e o método são os mesmos da última chamada (as tabelas de geometria
+ * g_dist_matrix, g_skip_radius e g_near continuam valendo). Caso contrário as libera.
+**/
+int same_geometry(info_ctl* info);
+
+void free_geometry();
+/*===========================*/
+
+/*= KRIGAGEM ORDINÁRIA =*/
+
+/* O variograma é ajustado uma vez ao primário (c_krig.h). Cada lacuna usa as OKR_N quadrículas
+ * definidas mais próximas no tempo, percorrendo g_near (em ordem de distância).
+ * O sistema depende apenas da linha e dos deslocamentos das vizinhas: lacunas de um operador
+ * com a mesma configuração compartilham uma única fatoração, e o operador inteiro é
+ * reaproveitado nos tempos (e execuções, com --cache) com a mesma máscara.
+**/
+
+/* Ajusta o variograma e prepara os vizinhos.
+ * Retorna 0 em erro de alocação.
+**/
+int okr_prepare(binary_data* dest, binary_data* p);
+
+/* Seleciona as vizinhas da lacuna (x,y) de 'dest' no tempo t_src do primário.
+ * Preenche 'col' (quadrícula do primário) e 'off' (dx,dy de cada uma), em ordem de distância.
+ * Retorna a quantidade de vizinhas (até OKR_N).
+**/
+int okr_select(binary_data* dest, binary_data* p, size_t x, size_t y, long t_src, size_t* col, int* off, dist_map* dm);
+
+/* Pesos da krigagem na linha y com as vizinhas de deslocamentos 'off'.
+ * Retorna 0 se o sistema for singular.
+**/
+int okr_system(binary_data* dest, size_t y, const int* off, int n, double* lambda);
+
+/* Linhas do operador 'op' (krigagem): as vizinhas são escolhidas em paralelo, as linhas são
+ * agrupadas pela configuração e cada sistema distinto é resolvido uma vez.
+ * Retorna 0 em erro de alocação.
+**/
+int okr_rows(csr_operator* op, binary_data* dest, binary_data* p, long t_src, dist_map* dm, size_t** row_col, double** row_val);
+/*======================*/
+
+/*= LACUNAS SEM VIZINHOS =*/
+
+/* A transformada de distância (c_dtrans.h) da máscara do primário dá, para cada quadrícula,
+ * a distância até a quadrícula definida mais próxima. Lacunas em que ela passa do alcance do
+ * método (g_skip_radius) não têm vizinhos: recebem o secundário sem percorrer o estêncil.
+**/
+
+/* Alcance do método em cada linha de 'dest'.
+ * Retorna 0 em erro de alocação.
+**/
+int prepare_skip(binary_data* dest);
+
+/* Transformada para o grid de 'dest' (NULL em erro de alocação, as lacunas são então todas percorridas)
+**/
+dist_map* gap_map(binary_data* dest);
+
+/* Atualiza 'dm' para a máscara do primário no tempo t_src, se ainda não for dela.
+**/
+void update_gap_map(dist_map* dm, binary_data* dest, binary_data* p, long t_src);
+
+/* 1 se a lacuna (x,y) no tempo t_src não tem quadrícula definida ao alcance do método.
+**/
+int hopeless_gap(dist_map* dm, binary_data* dest, binary_data* p, size_t x, size_t y, long t_src);
+/*========================*/
+
+/*= BORDA (--halo) =*/
+
+/* Com --halo o primário é copiado para o grid de saída com uma borda da largura dos estênceis
+ * (c_halo.h): avg, idw e msh leem os vizinhos sem testar os limites do grid. Em grids globais a
+ * borda em x é a continuação do outro lado, e todos os métodos atravessam a longitude 0/360
+ * (exceto as correlações do csh, que continuam restritas ao grid).
+**/
+
+/* Monta g_halo com o primário no grid de 'dest'. A borda é o maior alcance do método entre as linhas
+ * da área (yi,yf). Retorna NULL em erro de alocação.
+**/
+halo_grid* build_p_halo(binary_data* dest, binary_data* p, coordtype yi, coordtype yf);
+/*========================*/
+
 /*= FUNÇÕES DE PESO =*/
 coordtype inverse_power(double value)   {return 1/(coordtype)pow(value,BETA);}
 
@@ -148,6 +566,10 @@ coordtype inverse_value(double value)   {return 1/(coordtype)value;}
 // armazena a função que será usada na interpolação
 int (*interpolation) (binary_data*,binary_data*,binary_data*,size_t,size_t,size_t,binary_data*);
 
+// funções do modo por colunas (--cells), correspondentes a 'interpolation'
+int (*build_stencil) (stencil*,binary_data*,size_t,size_t);
+int (*apply_stencil) (stencil*,binary_data*,binary_data*,binary_data*,size_t,size_t,size_t,binary_data*);
+
 // armazena a função de distancia
 double (*dist) (double, double, double, double);
 
@@ -162,6 +584,65 @@ coordtype g_height;
 
 int g_debug = 0;
 
+// saída no formato esparso
+int g_sparse = 0;
+
+// índice do dado primário quando este está no formato em blocos (c_tile)
+tile_index* g_tiles = NULL;
+
+// método escolhido (*_FLAG), usado pelos operadores por máscara
+int g_method = MSH_FLAG;
+
+// desativa os operadores por máscara
+int g_per_cell = 0;
+
+// arquivo de cache dos operadores (vazio = sem cache)
+char g_cache_name[STR_SIZE] = {'\0'};
+
+// acrescenta a chave da geometria ao nome do cache (--batch): jobs com a mesma geometria usam o mesmo arquivo
+int g_cache_by_key = 0;
+
+// correlações e vizinhos em ordem de distância (métodos csh e okr)
+corr_table* g_corr = NULL;
+corr_offset* g_near = NULL;
+size_t* g_near_start = NULL;
+
+// variograma da krigagem ordinária e sistemas resolvidos / lacunas atendidas nos operadores
+variogram g_vario;
+size_t g_okr_systems = 0, g_okr_rows = 0;
+
+// tempos da janela móvel das correlações (0 = toda a série) e seu estado
+size_t g_csh_window = 0;
+corr_window* g_window = NULL;
+
+// alcance do método em cada linha (NULL sem interpolação)
+double* g_skip_radius = NULL;
+
+// transformada de distância usada pela thread na interpolação quadrícula a quadrícula
+dist_map* g_dmap = NULL;
+#pragma omp threadprivate(g_dmap)
+
+// regradeamento do secundário para o grid de saída (NULL se os grids forem compatíveis)
+regrid_op* g_regrid = NULL;
+int g_regrid_method = REGRID_CON;
+
+// secundários seguintes (--then), em ordem de prioridade
+sec_source g_chain[MAX_SEC];
+size_t g_n_chain = 0;
+
+// função de interpolação de cada método (índice *_FLAG)
+int (*g_method_interp[]) (binary_data*,binary_data*,binary_data*,size_t,size_t,size_t,binary_data*) = {
+    none_interpolation, average_interpolation, idweight_interpolation, mshepard_interpolation, cshepard_interpolation, okr_interpolation
+};
+
+// primário com borda (--halo), NULL sem a opção
+halo_grid* g_halo = NULL;
+int g_use_halo = 0;
+
+// colunas (lon,lat) de --cells
+coordtype* g_cells = NULL;
+size_t g_n_cells = 0;
+
 /* ======================= */
 
 
@@ -176,6 +657,8 @@ int main(int argc, char *argv[]) {
 
     binary_data* sngauge = NULL;    //dados complementares que serão adicionados
 
+    station_data* stations = NULL;  //estações no lugar do primário (--stations)
+
     //coordenadas da america do sul
     coordtype xi = -89.5f,
         xf = -31.5f,
@@ -188,6 +671,12 @@ int main(int argc, char *argv[]) {
 
     char sngauge_name[STR_SIZE] = {'\0'};
 
+    char cells_name[STR_SIZE] = {'\0'};
+
+    char stations_name[STR_SIZE] = {'\0'};
+
+    char batch_name[STR_SIZE] = {'\0'};
+
 
     // por padrão usa a interpolação Modified Shepard
     int interp_method = MSH_FLAG;
@@ -199,10 +688,15 @@ int main(int argc, char *argv[]) {
         {
             {"help" , no_argument, NULL, 'h'},
             {"debug", no_argument, NULL, 'D'},
+            {"sparse", no_argument, NULL, 'S'},
+            {"per-cell", no_argument, NULL, 'P'},
 
             {"avg"  , no_argument, NULL, 'a'},
             {"idw"  , no_argument, NULL, 'i'},
             {"msh"  , no_argument, NULL, 'm'},
+            {"csh"  , no_argument, NULL, 'C'},
+            {"csh-window", required_argument, NULL, 'W'},
+            {"okr"  , no_argument, NULL, 'k'},
             {"none"  , no_argument, NULL, 'n'},
 
             {"loni", required_argument, NULL, 'w'},
@@ -211,6 +705,14 @@ int main(int argc, char *argv[]) {
             {"latf", required_argument, NULL, 'z'},
 
             {"s-ngauge", required_argument, NULL, 'g'},
+            {"regrid", required_argument, NULL, 'R'},
+            {"then", required_argument, NULL, 'T'},
+            {"cells", required_argument, NULL, 'c'},
+            {"cache", required_argument, NULL, 'K'},
+            {"stations", required_argument, NULL, 'E'},
+            {"batch", required_argument, NULL, 'B'},
+            {"halo", no_argument, NULL, 'H'},
+            {"print-isa", no_argument, NULL, 'I'},
 
             {"xi"  , required_argument, NULL, 'w'},
             {"xf"  , required_argument, NULL, 'x'},
@@ -221,7 +723,7 @@ int main(int argc, char *argv[]) {
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        int opt = getopt_long (argc, argv, "aimnw:x:y:z:g:hD",
+        int opt = getopt_long (argc, argv, "aimCW:knw:x:y:z:g:R:T:c:K:E:B:hDSPH",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -237,6 +739,16 @@ int main(int argc, char *argv[]) {
             case 'm':
                 interp_method = MSH_FLAG;
                 break;
+            case 'C':
+                interp_method = CSH_FLAG;
+                break;
+            case 'W':
+                g_csh_window = atol(optarg);
+                break;
+            case 'k':
+                interp_method = OKR_FLAG;
+                break;
+
             case 'n':
                 interp_method = NON_FLAG;
                 break;
@@ -259,12 +771,64 @@ int main(int argc, char *argv[]) {
                 sngauge_name[STR_SIZE-1]='\0';
                 break;
 
+            case 'R':
+                if (!strcmp(optarg, "con")) g_regrid_method = REGRID_CON;
+                else if (!strcmp(optarg, "bil")) g_regrid_method = REGRID_BIL;
+                else{
+                    fprintf(stderr,"ERRO: regradeamento '%s' desconhecido (con ou bil).\n", optarg);
+                    return perro(ARG_ERR);
+                }
+                break;
+
+            case 'T':
+                if (!add_chain(optarg)){
+                    fprintf(stderr,"ERRO: secundário '%s' inválido (arquivo.ctl[:metodo[:ngauge.ctl]], até %d).\n", optarg, MAX_SEC);
+                    return perro(ARG_ERR);
+                }
+                break;
+
+            case 'c':
+                strncpy(cells_name, optarg, STR_SIZE - 1);
+                cells_name[STR_SIZE-1]='\0';
+                break;
+
+            case 'K':
+                strncpy(g_cache_name, optarg, STR_SIZE - 1);
+                g_cache_name[STR_SIZE-1]='\0';
+                break;
+
+            case 'E':
+                strncpy(stations_name, optarg, STR_SIZE - 1);
+                stations_name[STR_SIZE-1]='\0';
+                break;
+
+            case 'B':
+                strncpy(batch_name, optarg, STR_SIZE - 1);
+                batch_name[STR_SIZE-1]='\0';
+                break;
+
 
             case 'D':
                 printf(" ==> MODO DE DEPURAÇÃO: apenas quadrículas interpoladas serão salvas.\n");
                 g_debug = 1;
                 break;
 
+            case 'S':
+                g_sparse = 1;
+                break;
+
+            case 'P':
+                g_per_cell = 1;
+                break;
+
+            case 'H':
+                g_use_halo = 1;
+                break;
+
+            case 'I':
+                printf("%s\n", isa_variant());
+                return 0;
+
             case 'h':
                 fprintf(stderr,
                         OPTS_MSG
@@ -280,14 +844,42 @@ int main(int argc, char *argv[]) {
     }
 
 
-    if (optind > (argc-3)) {
+    // funções adicionais
+    dist = haversine_distance;
+    weight = inverse_power_2;
+
+    // com --batch os arquivos e métodos vêm do manifesto
+    if (strlen(batch_name) > 0){
+        if (strlen(stations_name) > 0 || strlen(cells_name) > 0 || strlen(sngauge_name) > 0 || g_n_chain){
+            fprintf(stderr,"ERRO: --batch não aceita --stations, --cells, --s-ngauge nem --then (ngauge vai no manifesto).\n");
+            return perro(ARG_ERR);
+        }
+        return run_batch(batch_name, g_csh_window);
+    }
+
+    // com --stations não há arquivo primário
+    int n_args = (strlen(stations_name) > 0) ? 2 : 3;
+
+    if (optind > (argc-n_args)) {
         fprintf(stderr,"Uso: %s " EXEC_MSG "\n" HELP_MSG "\n", argv[0]);
         return ARG_ERR;
     }
 
+    if (n_args == 2 && interp_method != IDW_FLAG && interp_method != MSH_FLAG){
+        fprintf(stderr,"ERRO: com --stations apenas os métodos idw (-i) e msh (-m) estão disponíveis.\n");
+        return perro(ARG_ERR);
+    }
+
+    if (n_args == 2 && g_n_chain){
+        fprintf(stderr,"ERRO: com --stations não há cadeia de secundários (--then).\n");
+        return perro(ARG_ERR);
+    }
+
     // le resto dos argumentos
-    strncpy(pri_name,argv[optind++],STR_SIZE-1);
-    pri_name[STR_SIZE-1]='\0';
+    if (n_args == 3){
+        strncpy(pri_name,argv[optind++],STR_SIZE-1);
+        pri_name[STR_SIZE-1]='\0';
+    }
 
     strncpy(sec_name,argv[optind++],STR_SIZE-1);
     sec_name[STR_SIZE-1]='\0';
@@ -297,92 +889,147 @@ int main(int argc, char *argv[]) {
 
 
 
-    lab = open_bin_ctl(pri_name);
-    if (lab == NULL){
-        return perro_com(MEM_ERR, pri_name);
+    if (n_args == 2){
+        stations = open_stations(stations_name);
+        if (stations == NULL){
+            return perro_com(ARQ_ERR, stations_name);
+        }
+    }
+    else{
+        // o primário pode estar no formato em blocos, nesse caso o índice é mantido
+        lab = open_bin_ctl_tile(pri_name, &g_tiles);
+        if (lab == NULL){
+            return perro_com(MEM_ERR, pri_name);
+        }
     }
 
-    extra = open_bin_ctl(sec_name);
+    extra = open_bin_ctl_tile(sec_name, NULL);
     if (extra == NULL){
         free_bin(lab);
+        free_stations(stations);
+        free_tile_index(g_tiles);
         return perro_com(MEM_ERR, sec_name);
     }
 
     if ( strlen(sngauge_name) > 0 ){
 
-        sngauge = open_bin_ctl(sngauge_name);
+        sngauge = open_bin_ctl_tile(sngauge_name, NULL);
 
         if (sngauge == NULL){
             free_bin(lab);
+            free_stations(stations);
+            free_tile_index(g_tiles);
             free_bin(extra);
             return perro_com(MEM_ERR, sngauge_name);
         }
     }
 
+    if (!open_chain()){
+        free_bin(lab);
+        free_tile_index(g_tiles);
+        free_bin(extra);
+        free_bin(sngauge);
+        free_chain();
+        return perro(ARQ_ERR);
+    }
+
+
+    if ( strlen(cells_name) > 0 ){
+        long n = read_cells(cells_name, &g_cells);
+
+        if (n < 0){
+            free_bin(lab);
+            free_stations(stations);
+            free_tile_index(g_tiles);
+            free_bin(extra);
+            free_bin(sngauge);
+            free_chain();
+            return perro_com(ARQ_ERR, cells_name);
+        }
+        g_n_cells = n;
+    }
+
 
     // Saida na tela com as opções
 
     printf("Compondo:\n\tFonte Primária: %s\n\tFonte Secundária: %s\n\tLimites:%.2f,%.2f,%.2f,%.2f\n\tSaida: %s\n",
-        lab->info.bin_filename,
+        stations ? stations_name : lab->info.bin_filename,
         extra->info.bin_filename,
         yi, yf, xi, xf,
         out_name
     );
 
-    printf("Método de interpolação:");
-
-    switch (interp_method){
-        case NON_FLAG:
-            printf(" **SEM** Interpolação.\n");
-            interpolation = none_interpolation;
-            break;
-        case AVG_FLAG:
-            interpolation = average_interpolation;
-            printf(" Média de quadriculas adjacentes.\n");
-            break;
-        case IDW_FLAG:
-            interpolation = idweight_interpolation;
-            printf(" Inverse distance weighting (IDW).\n");
-            break;
-        case MSH_FLAG:
-            printf(" Modified Shepard.\n");
-            interpolation = mshepard_interpolation;
-            break;
-    }
+    set_method(interp_method);
+    if (g_method != CSH_FLAG) g_csh_window = 0;
 
     if( sngauge ) printf("  Arquivo de número de estações: %s\n", sngauge_name);
+    if( g_cells ) printf("  Arquivo de colunas: %s (%lu colunas)\n", cells_name, g_n_cells);
 
-    // funções adicionais
-    dist = haversine_distance;
-    weight = inverse_power_2;
-
+    // métodos da cadeia: o principal se não foi escolhido
+    const char* method_names[] = {"none", "avg", "idw", "msh", "csh", "okr"};
+    for (size_t k = 0; k < g_n_chain; k++){
+        if (g_chain[k].method < 0) g_chain[k].method = g_method;
 
+        printf("  Secundário %lu: %s (%s)", k + 2, g_chain[k].s->info.bin_filename, method_names[g_chain[k].method]);
+        if (g_chain[k].ngauge) printf(", estações: %s", g_chain[k].ngauge_name);
+        printf("\n");
+    }
 
     //junta os dois dados
-    out_data = compose_data(lab,extra,xi,xf,yi,yf,sngauge);
+    if (stations){
+        printf("  Estações: %lu\n", stations->n);
+        out_data = compose_stations(stations,extra,xi,xf,yi,yf,sngauge);
+    }
+    else out_data = compose_data(lab,extra,xi,xf,yi,yf,sngauge);
 
 
 
     //erro ao ler arquivo
     if (out_data == NULL){
         free_bin(lab);
+        free_stations(stations);
         free_bin(extra);
+        free_tile_index(g_tiles);
+        free(g_cells);
+        free_regrid(g_regrid);
+        free_chain();
 
         return perro(FUN_ERR);
     }
 
     printf("Composição concluída.\n");
 
+    // apenas os valores definidos são guardados (útil com --debug, onde quase tudo é undef)
+    if (g_sparse && !bin_to_sparse(out_data)){
+        free_bin(lab);
+        free_stations(stations);
+        free_bin(extra);
+        free_bin(out_data);
+        free_tile_index(g_tiles);
+        free(g_cells);
+        free_regrid(g_regrid);
+        free_chain();
+
+        return perro_com(MEM_ERR, "Saída esparsa");
+    }
+
     //saida
     write_files(out_data,out_name,"Composição de dados");
 
     printf("Saída: %s\n",out_data->info.bin_filename);
 
     free_bin(lab);
+
+    free_stations(stations);
     free_bin(extra);
     free_bin(out_data);
     free_bin(sngauge);
-    free_dist_matrix(g_dist_matrix);
+    free_tile_index(g_tiles);
+    free_cshepard();
+    free_geometry();
+    free(g_cells);
+    free_regrid(g_regrid);
+    free_chain();
 
 
     return 0;
@@ -408,33 +1055,35 @@ binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordty
         return NULL;
     }
 
-    // testando se as quadriculas são do mesmo tamanho
-    if(!EQ_FLOAT(p->info.x.size,s->info.x.size) || !EQ_FLOAT(p->info.y.size,s->info.y.size)){
-        fprintf(stderr,"ERRO: Tamanhos de quadrículas diferentes:x(%.2f & %.2f), y(%.2f & %.2f).\n",
+    // quadrículas de tamanhos diferentes ou grids desalinhados: o secundário é regradeado para o grid do primário
+    int regrid = !EQ_FLOAT(p->info.x.size,s->info.x.size) || !EQ_FLOAT(p->info.y.size,s->info.y.size) ||
+                 !compat_grid(&(p->info),&(s->info));
+
+    if (regrid){
+        printf("  Grids diferentes: x(%.4f & %.4f), y(%.4f & %.4f), o secundário será regradeado (%s).\n",
             p->info.x.size,
             s->info.x.size,
             p->info.y.size,
-            s->info.y.size
+            s->info.y.size,
+            (g_regrid_method == REGRID_BIL) ? "bilinear" : "conservativo"
         );
-
-        return NULL;
     }
     if(MAX(p->info.x.size,s->info.x.size) > MAX_SIZE || MAX(p->info.y.size,s->info.y.size) > MAX_SIZE){
         fprintf(stderr,"AVISO: Recomenda-se utilizar quadrículas de tamanho até '%.2f' para melhores resultados.\n",MAX_SIZE);
     }
 
-    //testando se os grids são compatíveis
-    if(!compat_grid(&(p->info),&(s->info))){
-        fprintf(stderr,"ERRO: grids são incompatíveis, verifique as posições iniciais de lat e lon.\n");
-        return NULL;
-    }
-
     if (ngauge && !compat_grid(&(s->info),&(ngauge->info))){
         fprintf(stderr,"ERRO: (NUM_GAUGE) grids são incompatíveis, verifique as posições iniciais de lat e lon.\n");
         return NULL;
 
     }
 
+    // validade do primário em bits, montada uma vez (em lote fica para os jobs seguintes com o mesmo primário)
+    if (!p->valid && !build_valid(p)){
+        perro_com(MEM_ERR,"Mapa de validade do primário");
+        return NULL;
+    }
+
     // Garantindo que as coordenadas estão dentro do globo
     xi = wrap_val(xi,MIN_X,MAX_X);
     xf = wrap_val(xf,MIN_X,MAX_X);
@@ -455,6 +1104,24 @@ binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordty
     ctl.x.def = (int)((ctl.x.f - ctl.x.i) / ctl.x.size);
     ctl.y.def = (int)((ctl.y.f - ctl.y.i) / ctl.y.size);
 
+    // regradeando: grid do primário estendido, com o mesmo alinhamento, até conter os centros do secundário
+    if (regrid){
+        double s_xf = s->info.x.i + (s->info.x.def - 1) * s->info.x.size, p_xf = p->info.x.i + (p->info.x.def - 1) * p->info.x.size;
+        double s_yf = s->info.y.i + (s->info.y.def - 1) * s->info.y.size, p_yf = p->info.y.i + (p->info.y.def - 1) * p->info.y.size;
+
+        long left  = MAX(0, (long)ceil((p->info.x.i - s->info.x.i) / p->info.x.size - 0.5 - 0.001));
+        long right = MAX(0, (long)ceil((s_xf - p_xf) / p->info.x.size - 0.5 - 0.001));
+        long down  = MAX(0, (long)ceil((p->info.y.i - s->info.y.i) / p->info.y.size - 0.5 - 0.001));
+        long up    = MAX(0, (long)ceil((s_yf - p_yf) / p->info.y.size - 0.5 - 0.001));
+
+        ctl.x.def = p->info.x.def + left + right;
+        ctl.y.def = p->info.y.def + down + up;
+        ctl.x.i = p->info.x.i - left * p->info.x.size;
+        ctl.y.i = p->info.y.i - down * p->info.y.size;
+        ctl.x.f = ctl.x.i + ctl.x.def * ctl.x.size;
+        ctl.y.f = ctl.y.i + ctl.y.def * ctl.y.size;
+    }
+
     // caso o dado secundário comece antes do primário
     if(s->info.t_from_date_i < p->info.t_from_date_i){
         cp_date_ctl(&ctl,&(s->info));
@@ -475,52 +1142,405 @@ binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordty
     // copia as dimensões obtidas para a estrutura de dados
     cp_ctl(&(bin_data->info),&(ctl));
 
-
-    g_dist_matrix = calc_dist(&(bin_data->info),dist);
-    if (!g_dist_matrix){
-        perro_com(MEM_ERR,"Matriz de distâncias");
+    if (regrid && !(g_regrid = build_regrid(&ctl, &(s->info), g_regrid_method))){
+        perro_com(MEM_ERR,"Regradeamento do secundário");
+        free_bin(bin_data);
         return NULL;
     }
 
 
-    undef = bin_data->info.undef;
+    // tabelas que só dependem do grid e do método: em lote (--batch) ficam de um job para o outro
+    if (!same_geometry(&(bin_data->info))){
+        g_dist_matrix = calc_dist(&(bin_data->info),dist);
+        if (!g_dist_matrix){
+            perro_com(MEM_ERR,"Matriz de distâncias");
+            return NULL;
+        }
+    }
 
 
-    // preenchendo dados
-    #pragma omp parallel for
-    for (size_t t = 0; t < ctl.tdef; t++){
-        for (size_t y = 0; y < ctl.y.def; y++){
-            for (size_t x = 0; x < ctl.x.def; x++){
+    if (!prepare_chain(bin_data, p)){
+        free_bin(bin_data);
+        return NULL;
+    }
+
+    if ((g_method == CSH_FLAG || chain_uses(CSH_FLAG)) && !cshepard_prepare(bin_data, p)){
+        perro_com(MEM_ERR,"Correlações do dado primário");
+        free_bin(bin_data);
+        return NULL;
+    }
+
+    if ((g_method == OKR_FLAG || chain_uses(OKR_FLAG)) && !okr_prepare(bin_data, p)){
+        perro_com(MEM_ERR,"Variograma do dado primário");
+        free_bin(bin_data);
+        return NULL;
+    }
+
+    if (g_method != NON_FLAG && !g_skip_radius && !prepare_skip(bin_data)){
+        perro_com(MEM_ERR,"Alcance do método");
+        free_bin(bin_data);
+        return NULL;
+    }
+
+    if (g_use_halo && g_method != NON_FLAG){
+        if (!(g_halo = build_p_halo(bin_data, p, yi, yf))){
+            perro_com(MEM_ERR,"Primário com borda");
+            free_bin(bin_data);
+            return NULL;
+        }
+        printf("  Primário com borda de %lu x %lu quadrículas%s\n", g_halo->hx, g_halo->hy,
+               g_halo->periodic ? ", periódico na longitude" : "");
+    }
+
+    undef = bin_data->info.undef;
+
+    // deslocamento do dado primário dentro da matriz de saída
+    size_t p_ox = (size_t)((p->info.x.i - ctl.x.i) / ctl.x.size + 0.5);
+    size_t p_oy = (size_t)((p->info.y.i - ctl.y.i) / ctl.y.size + 0.5);
+    size_t p_ot = p->info.t_from_date_i - ctl.t_from_date_i;
+
+    // com o índice em blocos as lacunas são conhecidas sem percorrer os dados
+    if (g_tiles){
+        size_t gaps = 0;
+        for (size_t t = 0; t < g_tiles->t; t++)
+            gaps += tile_count_gaps(g_tiles, t, 0, g_tiles->x, 0, g_tiles->y);
+
+        printf("  Lacunas no dado primário (índice em blocos): %lu de %lu\n", gaps, g_tiles->x * g_tiles->y * g_tiles->t);
+    }
+
+
+    // colunas de --cells: estêncil calculado uma vez por coluna
+    stencil* columns = NULL;
+    size_t n_active = 0;
+    if (g_cells && g_csh_window){
+        printf("  Com --csh-window as colunas de --cells são interpoladas junto com as demais lacunas.\n");
+    }
+    else if (g_cells){
+        columns = build_columns(bin_data, xi, xf, yi, yf, &n_active);
+        if (!columns){
+            perro_com(MEM_ERR,"Estênceis das colunas");
+            free_bin(bin_data);
+            return NULL;
+        }
+        printf("  Colunas com pesos fixos: %lu de %lu\n", n_active, g_n_cells);
+    }
+
+    // tempos agrupados pela máscara de lacunas do primário (sem interpolação não há o que agrupar)
+    long* group = NULL;
+    size_t* rep = NULL;
+    long n_groups = 0;
+    if (!g_per_cell && !g_csh_window && g_method != NON_FLAG){
+        if (!(group = malloc(ctl.tdef * sizeof(long))) || (n_groups = group_masks(bin_data, p, group, &rep)) < 0){
+            perro_com(MEM_ERR,"Agrupamento das máscaras");
+            free(group);
+            free_columns(columns, ctl.x.def * ctl.y.def);
+            free_bin(bin_data);
+            return NULL;
+        }
+        printf("  Máscaras distintas do dado primário: %ld em %lu tempos\n", n_groups, ctl.tdef);
+    }
+
+
+    // preenchendo dados
+    #pragma omp parallel
+    {
+    // transformada da máscara de cada tempo, calculada na primeira lacuna interpolada do tempo
+    g_dmap = g_skip_radius ? gap_map(bin_data) : NULL;
+
+    #pragma omp for
+    for (size_t t = 0; t < ctl.tdef; t++){
+        long t_src = p_time(bin_data, p, t);
+
+        for (size_t y = 0; y < ctl.y.def; y++){
+            size_t full_end = 0;    // [x, full_end) está em um bloco do primário sem lacunas
+
+            for (size_t x = 0; x < ctl.x.def; x++){
 
                 int modified = 0;
 
+                if (g_tiles && x >= full_end) full_end = full_tile_end(x,y,t,p_ox,p_oy,p_ot);
+
+                // colunas são preenchidas abaixo, uma de cada vez
+                if (columns && columns[y * ctl.x.def + x].active) continue;
+
                 // Detectando se o dado está dentro da área passada (bounding box)
                 coordtype x_pos = wrap_val(x * ctl.x.size + ctl.x.i,MIN_X,MAX_X);
                 coordtype y_pos = wrap_val(y * ctl.y.size + ctl.y.i,MIN_Y,MAX_Y);
 
                 // Se o dado está fora da área solicitada
                 if(!inside_area(x_pos, y_pos, xi, xf, yi, yf)){
-                    if(EQ_FLOAT(cp_data_val(bin_data,s,x,y,t),undef)){
+                    if(EQ_FLOAT(cp_sec_val(bin_data,s,x,y,t),undef) && EQ_FLOAT(cp_chain_val(bin_data,x,y,t),undef)){
                         cp_data_val(bin_data,p,x,y,t);
                     }
                 }
-                else{
-                    // Se o valor copiado do dado principal 'p' for indefinido
-                    if(EQ_FLOAT(cp_data_val(bin_data,p,x,y,t),undef)){
+                // bloco sem lacunas segundo o índice: cópia direta do primário, sem testar a quadrícula
+                else if(x < full_end){
+                    set_data_val(bin_data,x,y,t,get_pos_val(p,((t - p_ot) * p->info.y.def + y - p_oy) * p->info.x.def + x - p_ox));
+                }
+                else if(primary_gap(bin_data,p,x,y,t,p_ox,p_oy,p_ot)){
 
-                        // Executa a função de interpolação
-                        modified = interpolation(bin_data,p,s,x,y,t,ngauge);
+                    // com operador a lacuna é preenchida abaixo, junto com as demais de mesma máscara,
+                    // e com a janela móvel abaixo, tempo a tempo
+                    if ((group && group[t] >= 0) || g_window){
+                        set_data_val(bin_data,x,y,t,undef);
+                        continue;
                     }
+
+                    // sem quadrícula definida ao alcance do método fica o secundário
+                    if (g_dmap && hopeless_gap(g_dmap,bin_data,p,x,y,t_src)) cp_sec_val(bin_data,s,x,y,t);
+
+                    // Executa a função de interpolação
+                    else modified = interpolation(bin_data,p,s,x,y,t,ngauge);
+
+                    // secundário indefinido: próximos da cadeia
+                    modified = chain_gap(bin_data,p,x,y,t,modified);
+                }
+                if(g_debug && !modified) set_data_val(bin_data,x,y,t,undef);
+            }
+        }
+    }
+
+    free_dist_map(g_dmap);
+    g_dmap = NULL;
+    }
+
+    // lacunas dos tempos agrupados: um operador por máscara distinta
+    if (group){
+        int ok = compose_operators(bin_data, p, s, ngauge, xi, xf, yi, yf, columns, group, rep, n_groups);
+
+        free(group);
+        free(rep);
+        if (!ok){
+            perro_com(MEM_ERR,"Operadores por máscara");
+            free_columns(columns, ctl.x.def * ctl.y.def);
+            free_bin(bin_data);
+            g_halo = free_halo(g_halo);
+            return NULL;
+        }
+    }
+
+    if (g_window) compose_window(bin_data, p, s, ngauge, xi, xf, yi, yf, p_ox, p_oy, p_ot);
+
+    // cada coluna percorre toda a série temporal com o mesmo estêncil,
+    // apenas os vizinhos indefinidos em cada tempo ficam de fora da soma
+    if (columns){
+        size_t n_xy = ctl.x.def * ctl.y.def;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t c = 0; c < n_xy; c++){
+            if (!columns[c].active) continue;
+
+            size_t x = c % ctl.x.def;
+            size_t y = c / ctl.x.def;
+
+            for (size_t t = 0; t < ctl.tdef; t++){
+                int modified = 0;
+
+                if(primary_gap(bin_data,p,x,y,t,p_ox,p_oy,p_ot)){
+                    modified = apply_stencil(&columns[c],bin_data,p,s,x,y,t,ngauge);
+                    modified = chain_gap(bin_data,p,x,y,t,modified);
                 }
                 if(g_debug && !modified) set_data_val(bin_data,x,y,t,undef);
             }
         }
+
+        free_columns(columns, n_xy);
+    }
+
+    g_halo = free_halo(g_halo);
+
+    return bin_data;
+}
+
+
+binary_data* compose_stations(station_data* st, binary_data* s, coordtype xi, coordtype xf, coordtype yi, coordtype yf, binary_data* ngauge){
+
+    if(st->info.ttype != s->info.ttype){
+        fprintf(stderr,"ERRO: Arquivos não tem o mesmo tipo de dado.\n");
+        return NULL;
+    }
+
+    if (ngauge && !compat_grid(&(s->info),&(ngauge->info))){
+        fprintf(stderr,"ERRO: (NUM_GAUGE) grids são incompatíveis, verifique as posições iniciais de lat e lon.\n");
+        return NULL;
+    }
+
+    // Garantindo que as coordenadas estão dentro do globo
+    xi = wrap_val(xi,MIN_X,MAX_X);
+    xf = wrap_val(xf,MIN_X,MAX_X);
+    yi = wrap_val(yi,MIN_Y,MAX_Y);
+    yf = wrap_val(yf,MIN_Y,MAX_Y);
+
+    // a saída tem o grid e os tempos do secundário
+    binary_data* bin_data = aloca_bin(s->info.x.def, s->info.y.def, s->info.tdef);
+    if(!bin_data->data){
+        perro_com(MEM_ERR,"Matriz de resultados");
+        return NULL;
+    }
+    cp_ctl(&(bin_data->info),&(s->info));
+
+    info_ctl* info = &(bin_data->info);
+    size_t n_xy = info->x.def * info->y.def;
+    datatype undef = info->undef;
+
+    // tempo das estações = t + st_ot
+    long st_ot = (long)info->t_from_date_i - st->info.t_from_date_i;
+    int ok = 1;
+
+    // cada quadrícula percorre toda a série: no msh as estações ao alcance são buscadas uma vez
+    #pragma omp parallel reduction(&&:ok)
+    {
+        size_t* idx = NULL;
+        double* d = NULL;
+        size_t cap = 0;
+
+        #pragma omp for schedule(dynamic, 16)
+        for (size_t c = 0; c < n_xy; c++){
+            size_t x = c % info->x.def, y = c / info->x.def;
+
+            coordtype lon = info->x.i + x * info->x.size;
+            coordtype lat = info->y.i + y * info->y.size;
+            int inside = inside_area(wrap_val(lon,MIN_X,MAX_X), wrap_val(lat,MIN_Y,MAX_Y), xi, xf, yi, yf);
+
+            long n = 0;
+            if (inside && g_method == MSH_FLAG && (n = kd_radius(st, lon, lat, MAJOR_RADIUS, &idx, &d, &cap)) < 0){
+                ok = 0;
+                continue;
+            }
+
+            for (size_t t = 0; t < info->tdef; t++){
+                int modified = 0;
+
+                // fora da área fica o secundário
+                if (!inside) cp_data_val(bin_data,s,x,y,t);
+                else if (g_method == MSH_FLAG) modified = station_msh(bin_data,s,st,x,y,t,t + st_ot,idx,d,n,ngauge);
+                else modified = station_idw(bin_data,s,st,x,y,t,t + st_ot,lon,lat,ngauge);
+
+                if(g_debug && !modified) set_data_val(bin_data,x,y,t,undef);
+            }
+        }
+
+        free(idx);
+        free(d);
+    }
+
+    if (!ok){
+        perro_com(MEM_ERR,"Busca de estações");
+        free_bin(bin_data);
+        return NULL;
     }
 
     return bin_data;
 }
 
 
+int station_msh(binary_data* dest, binary_data* s, station_data* st, size_t x, size_t y, size_t t, long t_st,
+                size_t* idx, double* d, long n, binary_data* ngauge){
+
+    datatype val = cp_data_val(dest,s,x,y,t);
+    double sum = 0, w_sum = 0;
+    int qt = 1;
+
+    for (long i = 0; i < n; i++){
+        if (!station_valid(st, t_st, idx[i])) continue;
+
+        double di = MAX(d[i], STATION_MIN_DIST);
+        if (di >= MAJOR_RADIUS) continue;
+
+        double w = pow((MAJOR_RADIUS - di)/(MAJOR_RADIUS*di), BETA);
+        sum += st->val[t_st * st->n + idx[i]] * w;
+        w_sum += w;
+
+        if (di < MINOR_RADIUS) qt++;
+    }
+
+    if (qt <= 1) return 0;
+
+    // como no msh do grid: o secundário entra com peso 1/qt
+    double w = 1/(double)qt;
+
+    // sem secundário fica apenas a interpolação das estações
+    if (EQ_FLOAT(val,dest->info.undef)) w = 0;
+    else if ((qt > MIN_GRIDPOINTS) && ngauge && (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) w = 0;
+
+    set_data_val(dest,x,y,t,(sum / w_sum)*(1-w) + val*w);
+
+    return 1;
+}
+
+
+int station_idw(binary_data* dest, binary_data* s, station_data* st, size_t x, size_t y, size_t t, long t_st,
+                double lon, double lat, binary_data* ngauge){
+
+    datatype val = cp_data_val(dest,s,x,y,t);
+
+    if (t_st < 0 || t_st >= (long)st->info.tdef) return 0;
+
+    size_t idx[STATION_K];
+    double d[STATION_K];
+    int n = kd_nearest(st, lon, lat, t_st, STATION_K, idx, d);
+
+    // apenas as estações a menos de MAJOR_RADIUS (estão em ordem de distância)
+    while (n > 0 && d[n - 1] >= MAJOR_RADIUS) n--;
+    if (n == 0) return 0;
+
+    double sum = 0, w_sum = 0, min_w = INFINITY;
+    for (int i = 0; i < n; i++){
+        double w = weight(MAX(d[i], STATION_MIN_DIST));
+
+        sum += st->val[t_st * st->n + idx[i]] * w;
+        w_sum += w;
+        if (w < min_w) min_w = w;
+    }
+
+    // o secundário entra com o menor peso entre as estações
+    if (EQ_FLOAT(val,dest->info.undef) || (ngauge && (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE))){
+        min_w = 0;
+        val = 0;
+    }
+
+    set_data_val(dest,x,y,t,(sum + val*min_w) / (w_sum + min_w));
+
+    return 1;
+}
+
+
+int primary_gap(binary_data* dest, binary_data* p, size_t x, size_t y, size_t t, size_t p_ox, size_t p_oy, size_t p_ot){
+
+    // Lacuna conhecida pelo mapa de bits do índice, sem consultar o dado
+    if(g_tiles && !tile_cell_valid(g_tiles, x - p_ox, y - p_oy, t - p_ot)) return 1;
+
+    // Se o valor copiado do dado principal 'p' for indefinido
+    return EQ_FLOAT(cp_data_val(dest,p,x,y,t),dest->info.undef);
+}
+
+
+size_t full_tile_end(size_t x, size_t y, size_t t, size_t p_ox, size_t p_oy, size_t p_ot){
+    if (!g_tiles || x < p_ox || y < p_oy || t < p_ot) return x;
+
+    size_t px = x - p_ox;
+    if (tile_state(g_tiles, px, y - p_oy, t - p_ot) != TILE_FULL) return x;
+
+    // quantidade de válidas do índice igual à de quadrículas: o bloco inteiro é cópia do primário
+    size_t end = (px / g_tiles->tx + 1) * g_tiles->tx;
+    return MIN(end, g_tiles->x) + p_ox;
+}
+
+
+/* Vizinho (x+dx,y+dy) do primário no tempo t de 'dest', NaN se for indefinido ou estiver fora do grid.
+ * Com --halo é lido direto da cópia com borda (já com NaN), sem testar os limites.
+**/
+static inline datatype p_neighbor(binary_data* dest, binary_data* p, size_t x, size_t y, int dx, int dy, size_t t){
+    if (g_halo) return halo_val(g_halo, (long)x + dx, (long)y + dy, t);
+
+    long t_src = p_time(dest, p, t);
+    long pc = p_cell(dest, p, x + dx, y + dy);
+    if (pc < 0 || !p_valid(p, t_src, pc)) return NAN;
+
+    return get_pos_val(p, t_src * p->info.x.def * p->info.y.def + pc);
+}
+
+
 /*
  * Interpolação simples utilizando a média das quadriculas adjacentes
  * Retorna 1 se ocorreu interpolação, retorna 0 caso contrário
@@ -528,7 +1548,7 @@ binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordty
 int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
 
     // copia o dado secundário 's_src' no ponto (x,y,t)
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
 
     if(!EQ_FLOAT(val,dest->info.undef)){
 
@@ -540,9 +1560,9 @@ int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_
             for(int j = -1; j <= 1; j++){
 
 
-                datatype new_val = get_data_val(dest, p_src, x+i, y+j, t);
+                datatype new_val = p_neighbor(dest, p_src, x, y, i, j, t);
 
-                if(!EQ_FLOAT(new_val,p_src->info.undef)){
+                if(!isnan(new_val)){
                     sum += new_val;
                     qt++;
                 }
@@ -551,7 +1571,7 @@ int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_
 
         if ( qt > 1){
             // se a quadricula do dado secundário não tem estações suficiente
-            if ( ngauge && (get_data_val(dest,ngauge,x,y,t)  < MIN_NGAUGE)){
+            if ( ngauge && (ngauge_val(dest,ngauge,x,y,t)  < MIN_NGAUGE)){
 
                 // valor do dado secundário não será adicionado à soma
                 val = 0;
@@ -579,7 +1599,7 @@ int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_
  * */
 int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
 
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
 
     // se o houver um valor na quadrícula
     if(!EQ_FLOAT(val,dest->info.undef)){
@@ -593,12 +1613,12 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
         for(int i = -1; i <= 1; i++){
             for(int j = -1; j <= 1; j++){
 
-                datatype neighbor = get_data_val(dest, p_src, x + i, y + j, t);
+                datatype neighbor = p_neighbor(dest, p_src, x, y, i, j, t);
                 coordtype w = 0;
 
                 // queremos o peso apenas se o valor da quadricula não for indefinido
                 // e se não for a própria quadricula
-                if(!EQ_FLOAT(neighbor, p_src->info.undef) && !(i == 0 && j == 0)){
+                if(!isnan(neighbor) && !(i == 0 && j == 0)){
 
                     //atribui o valor ao peso e salva o menor valor encontrado
                     if(min_w > (w = get_weight(x,y,i,j))){
@@ -616,7 +1636,7 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 
             // se a quadricula do dado secundário não tem estações suficiente
             // não iremos usar esse valor na conta
-            if ( ngauge && (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
+            if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
 
 
             // adicionamos o valor secundário com o menor peso encontrado
@@ -640,7 +1660,7 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
  * */
 int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
 
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
 
     // se o houver um valor na quadrícula
     if(!EQ_FLOAT(val,dest->info.undef)){
@@ -658,15 +1678,19 @@ int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
         int steps = (int) (MAJOR_RADIUS/dist(0,lat,dest->info.x.size,lat));
         int qt = 1;
 
+        // com --halo, até a largura da borda
+        int sx = g_halo ? MIN(steps, (int)g_halo->hx) : steps;
+        int sy = g_halo ? MIN(steps, (int)g_halo->hy) : steps;
+
         // buscamos nas quadrículas adjacentes
-        for(int i = -steps; i <= steps; i++){
-            for(int j = -steps; j <= steps; j++){
+        for(int i = -sx; i <= sx; i++){
+            for(int j = -sy; j <= sy; j++){
 
-                datatype neighbor = get_data_val(dest, p_src, x + i, y + j, t);
+                datatype neighbor = p_neighbor(dest, p_src, x, y, i, j, t);
 
                 // queremos o peso apenas se o valor da quadricula não for indefinido
                 // e se não for a própria quadricula
-                if(!EQ_FLOAT(neighbor, p_src->info.undef) && !(i == 0 && j == 0)){
+                if(!isnan(neighbor) && !(i == 0 && j == 0)){
 
                     double d = dist(lon, lat, lon + i*dest->info.x.size, lat + j*dest->info.y.size);
                     if (d < MAJOR_RADIUS){
@@ -694,7 +1718,7 @@ int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
             if ( (qt > MIN_GRIDPOINTS) && ngauge ){
 
                 // se a quadricula do dado secundário não tem estações suficiente
-                if (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE){
+                if (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE){
 
                     // valor do dado secundário não será adicionado à soma
                     w = 0;
@@ -725,117 +1749,1979 @@ int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 
 
 int none_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
-    cp_data_val(dest,s_src,x,y,t);
+    cp_sec_val(dest,s_src,x,y,t);
     return 0;
 }
 
 
-coordtype get_weight(size_t x, size_t y, int dx, int dy){
-    if (!g_dist_matrix) return 0;
+/* Reserva espaço para até 'n' vizinhos no estêncil
+**/
+int alloc_stencil(stencil* st, size_t n){
+    st->n = 0;
+    st->pts = malloc(n * sizeof(stencil_point));
+    return st->pts != NULL;
+}
 
-    if (dx == 0) return g_height;
 
+/* Média: todos os vizinhos adjacentes com o mesmo peso
+ * (a própria quadrícula é uma lacuna, não entra na soma)
+**/
+int average_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+
+    if (!alloc_stencil(st, 8)) return 0;
 
-    return g_dist_matrix[dy + 1][y];
+    for(int i = -1; i <= 1; i++){
+        for(int j = -1; j <= 1; j++){
+            if (i == 0 && j == 0) continue;
+
+            st->pts[st->n++] = (stencil_point){i, j, 1, 0};
+        }
+    }
+
+    return 1;
 }
 
-/*
-* Calculamos uma matriz de distâncias previamente,
-* uma vez que as distancias entre quadriculas
-* só variam em decorrência das latitudes.
-* Assim não precisamos recalcular o mesmo valor
-* para cada quadrícula individual
-**/
-coordtype** calc_dist(info_ctl* info,double (*dist)(double,double,double,double)){
-    int y = info->y.def;
-    coordtype** data;
 
-    if(! (data = alloc_dist_matrix(3,y))) return NULL;
+int average_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
 
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
 
-    coordtype lon_i = info->x.i;
-    coordtype lon_f = lon_i + info->x.size;
-    coordtype lat_i = info->y.i;
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
 
-    // salva a altura na variavel global
-    g_height = weight(dist(0, 0, 0, info->y.size));
+    datatype sum = 0;
+    int qt = 1;
 
-    for(size_t i = 0; i < y; i++){
+    for(size_t k = 0; k < st->n; k++){
+        datatype new_val = p_neighbor(dest, p_src, x, y, st->pts[k].dx, st->pts[k].dy, t);
 
-        // distancia para a quadricula na diagonal superior
-        data[0][i] = weight(dist(lon_i, lat_i, lon_f, lat_i - info->y.size));
+        if(!isnan(new_val)){
+            sum += new_val;
+            qt++;
+        }
+    }
 
-        // distancia para a quadricula ao lado
-        data[1][i] = weight(dist(lon_i, lat_i, lon_f, lat_i));
+    if ( qt > 1){
+        if ( ngauge && (ngauge_val(dest,ngauge,x,y,t)  < MIN_NGAUGE)){
+            val = 0;
+            qt--;
+        }
 
-        // distancia para a quadricula na diagonal inferior
-        data[2][i] = weight(dist(lon_i, lat_i, lon_f, lat_i + info->y.size));
+        sum += val;
+        set_data_val(dest,x,y,t, sum / (datatype)qt);
 
-        lat_i += info->y.size;
+        return 1;
     }
 
-    return data;
+    return 0;
 }
 
-coordtype** alloc_dist_matrix(int lin, int col){
-    coordtype** mat;
 
-    if(! (mat = malloc (lin * sizeof (coordtype*)))){
-        return NULL;
+/* IDW: pesos da matriz de distâncias
+**/
+int idweight_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+
+    if (!alloc_stencil(st, 8)) return 0;
+
+    for(int i = -1; i <= 1; i++){
+        for(int j = -1; j <= 1; j++){
+            if (i == 0 && j == 0) continue;
+
+            st->pts[st->n++] = (stencil_point){i, j, get_weight(x,y,i,j), 0};
+        }
     }
 
-    // aloca um vetor com todos os elementos da matriz
-    if (! (mat[0] = malloc(lin * col * sizeof(coordtype)))){
-        free (mat[0]);
-        return NULL;
+    return 1;
+}
+
+
+int idweight_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
+
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
+
+    datatype    sum = 0;
+    coordtype w_sum = 0;
+    coordtype min_w = 1;
+
+    for(size_t k = 0; k < st->n; k++){
+        datatype neighbor = p_neighbor(dest, p_src, x, y, st->pts[k].dx, st->pts[k].dy, t);
+
+        if(!isnan(neighbor)){
+            coordtype w = (coordtype)st->pts[k].w;
+
+            // o menor peso é o dos vizinhos definidos neste tempo
+            if(min_w > w) min_w = w;
+
+            sum += neighbor * w;
+            w_sum += w;
+        }
     }
 
-    // ajusta os demais ponteiros de linhas (i > 0)
-    for (int i = 1; i < lin; i++)
-        mat[i] = mat[0] + i * col;
+    if ( sum > 0){
+        if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
 
+        sum += val * min_w;
+        w_sum += min_w;
 
-    return mat;
-}
+        set_data_val(dest,x,y,t, sum / w_sum);
 
-void free_dist_matrix(coordtype** mat){
-    if (mat){
-        free (mat[0]);
-        free (mat);
+        return 1;
     }
+
+    return 0;
 }
 
 
-// ૮・ﻌ・ა
-int perro(int err_cod){
-    return perro_com(err_cod,"");
+/* Shepard modificado: apenas os vizinhos dentro do raio maior,
+ * as distâncias e potências são calculadas aqui uma única vez
+**/
+int mshepard_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+
+    coordtype lon  = dest->info.x.i + x*dest->info.x.size;
+    coordtype lat  = dest->info.y.i + y*dest->info.y.size;
+
+    int steps = (int) (MAJOR_RADIUS/dist(0,lat,dest->info.x.size,lat));
+
+    // com --halo, até a largura da borda
+    int sx = g_halo ? MIN(steps, (int)g_halo->hx) : steps;
+    int sy = g_halo ? MIN(steps, (int)g_halo->hy) : steps;
+
+    if (!alloc_stencil(st, (size_t)(2*sx + 1) * (2*sy + 1))) return 0;
+
+    for(int i = -sx; i <= sx; i++){
+        for(int j = -sy; j <= sy; j++){
+            if (i == 0 && j == 0) continue;
+
+            double d = dist(lon, lat, lon + i*dest->info.x.size, lat + j*dest->info.y.size);
+            if (d < MAJOR_RADIUS){
+                double w = pow((MAJOR_RADIUS - d)/(MAJOR_RADIUS*d), BETA);
+
+                st->pts[st->n++] = (stencil_point){i, j, w, d < MINOR_RADIUS};
+            }
+        }
+    }
+
+    return 1;
 }
 
 
-int perro_com (int err_cod, const char* comment){
-    switch (err_cod){
-        case ARG_ERR:
-            fprintf(stderr,"ERRO: argumentos inválidos.\n%s\n",comment);
-        break;
+int mshepard_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
 
-        case ARQ_ERR:
-            fprintf(stderr,"ERRO: não foi possível abrir arquivo.\n%s\n", comment);
-        break;
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
 
-        case MEM_ERR:
-            fprintf(stderr,"ERRO: falha na alocação.\n%s\n",comment);
-        break;
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
 
-        case FUN_ERR:
-            fprintf(stderr,"ERRO: função de juntar dados não pode ser executada.\n%s\n",comment);
-        break;
+    double sum = 0;
+    double w_sum = 0;
+    int qt = 1;
 
-        default:
-            //fprintf(stderr,"ERRO:%s\n.",comment);
-            return 0;
-        break;
+    for(size_t k = 0; k < st->n; k++){
+        datatype neighbor = p_neighbor(dest, p_src, x, y, st->pts[k].dx, st->pts[k].dy, t);
+
+        if(!isnan(neighbor)){
+            sum += neighbor * st->pts[k].w;
+            w_sum += st->pts[k].w;
+
+            if (st->pts[k].minor) qt++;
+        }
+    }
+
+    if(qt > 1){
+        double w = 1/(double)qt;
+
+        if ( (qt > MIN_GRIDPOINTS) && ngauge ){
+            if (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE) w = 0;
+        }
+
+        set_data_val(dest,x,y,t,(sum / w_sum)*(1-w) + val*w);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int none_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+    st->n = 0;
+    st->pts = NULL;
+    return 1;
+}
+
+
+int none_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+    return none_interpolation(dest,p_src,s_src,x,y,t,ngauge);
+}
+
+
+long read_cells(const char* name, coordtype** cells){
+    FILE* arq = fopen(name, "r");
+    if (!arq) return -1;
+
+    size_t n = 0, size = 64;
+    coordtype* data = malloc(2 * size * sizeof(coordtype));
+    double lon, lat;
+
+    while (data && fscanf(arq, "%lf %lf", &lon, &lat) == 2){
+        if (n == size){
+            coordtype* tmp = realloc(data, 4 * size * sizeof(coordtype));
+            if (!tmp){
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = tmp;
+            size *= 2;
+        }
+        data[2*n]     = lon;
+        data[2*n + 1] = lat;
+        n++;
+    }
+
+    // o arquivo deve terminar após a última coluna
+    if (data && !feof(arq)){
+        fprintf(stderr,"ERRO: linha inválida no arquivo de colunas após %lu colunas (%s:%d).\n", n, __FILE__, __LINE__);
+        free(data);
+        data = NULL;
+    }
+    fclose(arq);
+
+    if (!data) return -1;
+
+    *cells = data;
+    return n;
+}
+
+
+stencil* build_columns(binary_data* dest, coordtype xi, coordtype xf, coordtype yi, coordtype yf, size_t* n_active){
+    info_ctl* info = &(dest->info);
+    size_t n_xy = info->x.def * info->y.def;
+
+    stencil* columns = calloc(n_xy, sizeof(stencil));
+    if (!columns) return NULL;
+
+    *n_active = 0;
+    for (size_t c = 0; c < g_n_cells; c++){
+        long x = lround((g_cells[2*c] - info->x.i) / info->x.size);
+        long y = lround((g_cells[2*c + 1] - info->y.i) / info->y.size);
+
+        if (x < 0 || y < 0 || x >= info->x.def || y >= info->y.def){
+            fprintf(stderr,"AVISO: coluna (%.2f,%.2f) fora do grid, ignorada.\n", g_cells[2*c], g_cells[2*c + 1]);
+            continue;
+        }
+
+        // fora da área a quadrícula não é interpolada, segue o caminho normal
+        coordtype x_pos = wrap_val(x * info->x.size + info->x.i,MIN_X,MAX_X);
+        coordtype y_pos = wrap_val(y * info->y.size + info->y.i,MIN_Y,MAX_Y);
+        if (!inside_area(x_pos, y_pos, xi, xf, yi, yf)) continue;
+
+        stencil* st = &columns[y * info->x.def + x];
+        if (st->active) continue;
+
+        if (!build_stencil(st, dest, x, y)){
+            free_columns(columns, n_xy);
+            return NULL;
+        }
+        st->active = 1;
+        (*n_active)++;
+    }
+
+    return columns;
+}
+
+
+void free_columns(stencil* columns, size_t n){
+    if (columns){
+        for (size_t c = 0; c < n; c++) free(columns[c].pts);
+        free(columns);
+    }
+}
+
+
+/* Índice (y*x.def + x) no primário da quadrícula (x,y) de 'dest', -1 se estiver fora do primário
+ * (mesma conversão feita por get_data_val)
+**/
+long p_cell(binary_data* dest, binary_data* p, int x, int y){
+    // grid global com --halo: as colunas continuam do outro lado
+    if (g_halo && g_halo->periodic){
+        int x_def = dest->info.x.def;
+        x = (x % x_def + x_def) % x_def;
+    }
+
+    coordtype x_pos = dest->info.x.i + x * dest->info.x.size;
+    coordtype y_pos = dest->info.y.i + y * dest->info.y.size;
+
+    int x_src = (int)((x_pos - p->info.x.i) / p->info.x.size);
+    int y_src = (int)((y_pos - p->info.y.i) / p->info.y.size);
+
+    if (x_src < 0 || y_src < 0 || x_src >= (int)p->info.x.def || y_src >= (int)p->info.y.def) return -1;
+
+    return (long)y_src * p->info.x.def + x_src;
+}
+
+/* Tempo do primário correspondente ao tempo t de 'dest', -1 se estiver fora do primário
+**/
+long p_time(binary_data* dest, binary_data* p, size_t t){
+    long t_src = dest->info.t_from_date_i - p->info.t_from_date_i + (long)t;
+    return (t_src >= 0 && t_src < (long)p->info.tdef) ? t_src : -1;
+}
+
+// regradeamento do secundário 's' (ou do secundário de 'ngauge'): o da cadeia ou o principal
+regrid_op* sec_regrid(binary_data* s, binary_data* ngauge){
+    for (size_t k = 0; k < g_n_chain; k++)
+        if ((s && g_chain[k].s == s) || (ngauge && g_chain[k].ngauge == ngauge)) return g_chain[k].regrid;
+
+    return g_regrid;
+}
+
+datatype cp_sec_val(binary_data* dest, binary_data* s, int x, int y, int t){
+    regrid_op* rg = sec_regrid(s, NULL);
+    if (!rg) return cp_data_val(dest,s,x,y,t);
+
+    // apenas as quadrículas do secundário que cruzam (x,y) são lidas, e só agora
+    datatype val;
+    long t_src = dest->info.t_from_date_i - s->info.t_from_date_i + (long)t;
+
+    if (!regrid_val(rg, s, x, y, t_src, &val)) val = dest->info.undef;
+
+    return set_data_val(dest,x,y,t,val);
+}
+
+datatype ngauge_val(binary_data* dest, binary_data* ngauge, int x, int y, int t){
+    regrid_op* rg = sec_regrid(NULL, ngauge);
+    if (!rg) return get_data_val(dest,ngauge,x,y,t);
+
+    long xs = rg->x.near[x], ys = rg->y.near[y];
+    if (xs < 0 || ys < 0) return ngauge->info.undef;
+
+    // o 'ngauge' está no grid do secundário, mas pode começar em outro ponto
+    int xn = (int)floor((rg->x.src_i + xs * rg->x.src_size - ngauge->info.x.i) / ngauge->info.x.size + 0.5);
+    int yn = (int)floor((rg->y.src_i + ys * rg->y.src_size - ngauge->info.y.i) / ngauge->info.y.size + 0.5);
+    int tn = dest->info.t_from_date_i - ngauge->info.t_from_date_i + t;
+
+    if (!contains(ngauge, xn, yn, tn)) return ngauge->info.undef;
+
+    return get_pos_val(ngauge, get_pos(&(ngauge->info), xn, yn, tn));
+}
+
+
+int add_chain(char* arg){
+    if (g_n_chain >= MAX_SEC) return 0;
+
+    sec_source* c = &g_chain[g_n_chain];
+    memset(c, 0, sizeof(sec_source));
+    c->method = -1;
+
+    // arquivo[:metodo[:ngauge]]
+    char buff[3 * STR_SIZE];
+    strncpy(buff, arg, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+
+    char* method = strchr(buff, ':');
+    char* ngauge = NULL;
+
+    if (method){
+        *method++ = '\0';
+        if ((ngauge = strchr(method, ':'))) *ngauge++ = '\0';
+    }
+
+    if (!buff[0] || strlen(buff) >= STR_SIZE || (ngauge && (!ngauge[0] || strlen(ngauge) >= STR_SIZE))) return 0;
+
+    if (method && method[0] && (c->method = method_from_name(method)) < 0) return 0;
+
+    strcpy(c->name, buff);
+    if (ngauge) strcpy(c->ngauge_name, ngauge);
+
+    g_n_chain++;
+    return 1;
+}
+
+
+int open_chain(){
+    for (size_t k = 0; k < g_n_chain; k++){
+        sec_source* c = &g_chain[k];
+
+        if (!(c->s = open_bin_ctl_tile(c->name, NULL))){
+            fprintf(stderr,"ERRO: não foi possível abrir o secundário '%s'.\n", c->name);
+            return 0;
+        }
+
+        if (strlen(c->ngauge_name) > 0 && !(c->ngauge = open_bin_ctl_tile(c->ngauge_name, NULL))){
+            fprintf(stderr,"ERRO: não foi possível abrir o arquivo de estações '%s'.\n", c->ngauge_name);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+int prepare_chain(binary_data* dest, binary_data* p){
+    info_ctl* info = &(dest->info);
+
+    for (size_t k = 0; k < g_n_chain; k++){
+        sec_source* c = &g_chain[k];
+
+        if (c->s->info.ttype != p->info.ttype){
+            fprintf(stderr,"ERRO: secundário '%s' não tem o mesmo tipo de dado do primário.\n", c->name);
+            return 0;
+        }
+
+        if (c->ngauge && !compat_grid(&(c->s->info),&(c->ngauge->info))){
+            fprintf(stderr,"ERRO: (NUM_GAUGE) grids de '%s' e '%s' são incompatíveis.\n", c->name, c->ngauge_name);
+            return 0;
+        }
+
+        // fora do grid de saída: regradeado como o secundário principal
+        if (!EQ_FLOAT(info->x.size, c->s->info.x.size) || !EQ_FLOAT(info->y.size, c->s->info.y.size) ||
+            !compat_grid(info, &(c->s->info))){
+            if (!(c->regrid = build_regrid(info, &(c->s->info), g_regrid_method))){
+                perro_com(MEM_ERR,"Regradeamento do secundário");
+                return 0;
+            }
+            printf("  Secundário %lu será regradeado.\n", k + 2);
+        }
+    }
+
+    return 1;
+}
+
+
+int chain_uses(int method){
+    for (size_t k = 0; k < g_n_chain; k++)
+        if (g_chain[k].method == method) return 1;
+
+    return 0;
+}
+
+
+int chain_gap(binary_data* dest, binary_data* p, size_t x, size_t y, size_t t, int modified){
+    if (!g_n_chain) return modified;
+
+    datatype undef = dest->info.undef;
+    if (!EQ_FLOAT(get_pos_val(dest, get_pos(&(dest->info), x, y, t)), undef)) return modified;
+
+    // primeiro secundário definido, com seu método e 'ngauge'
+    for (size_t k = 0; k < g_n_chain; k++){
+        sec_source* c = &g_chain[k];
+
+        if (EQ_FLOAT(cp_sec_val(dest, c->s, x, y, t), undef)) continue;
+
+        return g_method_interp[c->method](dest, p, c->s, x, y, t, c->ngauge);
+    }
+
+    return modified;
+}
+
+
+datatype cp_chain_val(binary_data* dest, int x, int y, int t){
+    datatype val = dest->info.undef;
+
+    for (size_t k = 0; k < g_n_chain && EQ_FLOAT(val, dest->info.undef); k++)
+        val = cp_sec_val(dest, g_chain[k].s, x, y, t);
+
+    return val;
+}
+
+
+void free_chain(){
+    for (size_t k = 0; k < g_n_chain; k++){
+        free_bin(g_chain[k].s);
+        free_bin(g_chain[k].ngauge);
+        free_regrid(g_chain[k].regrid);
+    }
+    g_n_chain = 0;
+}
+
+// posição de 'name' em 'inputs' (acrescenta se ainda não estiver), -1 em erro de alocação
+static long batch_input_index(batch_input** inputs, size_t* n, size_t* size, const char* name){
+    for (size_t k = 0; k < *n; k++)
+        if (!strcmp((*inputs)[k].name, name)){
+            (*inputs)[k].uses++;
+            return k;
+        }
+
+    if (*n == *size){
+        batch_input* tmp = realloc(*inputs, 2 * (*size) * sizeof(batch_input));
+        if (!tmp) return -1;
+        *inputs = tmp;
+        *size *= 2;
+    }
+
+    batch_input* in = *inputs + *n;
+    strncpy(in->name, name, STR_SIZE - 1);
+    in->name[STR_SIZE-1] = '\0';
+    in->data = NULL;
+    in->tiles = NULL;
+    in->uses = 1;
+
+    return (*n)++;
+}
+
+long read_manifest(const char* name, batch_job** jobs, batch_input** inputs, size_t* n_inputs){
+    FILE* arq = fopen(name, "r");
+    if (!arq) return -1;
+
+    size_t n = 0, size = 16, in_size = 16, line_n = 0;
+    batch_job* data = malloc(size * sizeof(batch_job));
+    batch_input* in = malloc(in_size * sizeof(batch_input));
+    char line[4 * STR_SIZE + BUFF_SIZE];
+    int ok = (data && in);
+
+    *n_inputs = 0;
+
+    while (ok && fgets(line, sizeof(line), arq)){
+        char pri[STR_SIZE], sec[STR_SIZE], method[STR_SIZE], out[STR_SIZE], ngauge[STR_SIZE] = {'\0'};
+        float xi, xf, yi, yf;
+        char* c = line;
+
+        line_n++;
+
+        // linhas em branco e comentários
+        while (*c == ' ' || *c == '\t') c++;
+        if (*c == '#' || *c == '\n' || *c == '\r' || *c == '\0') continue;
+
+        int cols = sscanf(c, "%255s %255s %f %f %f %f %255s %255s %255s", pri, sec, &xi, &xf, &yi, &yf, method, out, ngauge);
+        int m = (cols >= 8) ? method_from_name(method) : -1;
+
+        if (m < 0){
+            fprintf(stderr,"ERRO: linha %lu do manifesto inválida "
+                    "(primario.ctl secundario.ctl xi xf yi yf metodo prefixo_saida [ngauge.ctl]).\n", line_n);
+            ok = 0;
+            break;
+        }
+
+        if (n == size){
+            batch_job* tmp = realloc(data, 2 * size * sizeof(batch_job));
+            if (!tmp){
+                ok = 0;
+                break;
+            }
+            data = tmp;
+            size *= 2;
+        }
+
+        batch_job* job = data + n;
+        job->line = line_n;
+        job->xi = xi;
+        job->xf = xf;
+        job->yi = yi;
+        job->yf = yf;
+        job->method = m;
+        strncpy(job->out, out, STR_SIZE - 1);
+        job->out[STR_SIZE-1] = '\0';
+        job->ok = 1;
+        job->result = NULL;
+
+        job->pri = batch_input_index(&in, n_inputs, &in_size, pri);
+        job->sec = batch_input_index(&in, n_inputs, &in_size, sec);
+        job->ngauge = (cols == 9) ? batch_input_index(&in, n_inputs, &in_size, ngauge) : -1;
+
+        if (job->pri < 0 || job->sec < 0 || (cols == 9 && job->ngauge < 0)) ok = 0;
+        n++;
+    }
+    fclose(arq);
+
+    if (!ok || !n){
+        if (ok) fprintf(stderr,"ERRO: manifesto sem jobs.\n");
+        free(data);
+        free(in);
+        return -1;
+    }
+
+    *jobs = data;
+    *inputs = in;
+    return n;
+}
+
+// leitura: abre os arquivos do job que ainda não estão na memória
+static void batch_load(batch_job* job, batch_input* inputs){
+    long idx[3] = {job->pri, job->sec, job->ngauge};
+
+    for (int k = 0; k < 3 && job->ok; k++){
+        if (idx[k] < 0 || inputs[idx[k]].data) continue;
+
+        batch_input* in = inputs + idx[k];
+
+        // só o primário usa o índice em blocos
+        in->data = open_bin_ctl_tile(in->name, (k == 0) ? &(in->tiles) : NULL);
+        if (!in->data){
+            fprintf(stderr,"ERRO: não foi possível abrir '%s' (linha %lu do manifesto).\n", in->name, job->line);
+            job->ok = 0;
+        }
+    }
+}
+
+// composição: usa o estado global (método, g_tiles), que só é alterado nesta etapa
+static void batch_compute(batch_job* job, batch_input* inputs, size_t csh_window){
+    if (job->ok){
+        binary_data* ngauge = (job->ngauge >= 0) ? inputs[job->ngauge].data : NULL;
+
+        printf("Job da linha %lu: %s + %s -> %s\n", job->line, inputs[job->pri].name, inputs[job->sec].name, job->out);
+
+        set_method(job->method);
+        g_csh_window = (job->method == CSH_FLAG) ? csh_window : 0;
+        g_tiles = inputs[job->pri].tiles;
+
+        job->result = compose_data(inputs[job->pri].data, inputs[job->sec].data, job->xi, job->xf, job->yi, job->yf, ngauge);
+        if (!job->result){
+            fprintf(stderr,"ERRO: falha ao compor o job da linha %lu.\n", job->line);
+            job->ok = 0;
+        }
+
+        // estado que depende dos dados do job (a geometria fica para o próximo)
+        free_cshepard();
+        free_regrid(g_regrid);
+        g_regrid = NULL;
+        g_tiles = NULL;
+        g_okr_systems = g_okr_rows = 0;
+    }
+
+    // libera os arquivos que nenhum job seguinte usa
+    long idx[3] = {job->pri, job->sec, job->ngauge};
+
+    for (int k = 0; k < 3; k++){
+        if (idx[k] < 0) continue;
+
+        batch_input* in = inputs + idx[k];
+        if (--(in->uses) == 0){
+            free_bin(in->data);
+            in->tiles = free_tile_index(in->tiles);
+            in->data = NULL;
+        }
+    }
+}
+
+// escrita
+static void batch_write(batch_job* job){
+    if (!job->result) return;
+
+    if (g_sparse && !bin_to_sparse(job->result)){
+        fprintf(stderr,"ERRO: saída esparsa do job da linha %lu.\n", job->line);
+        job->ok = 0;
+    }
+    else if (!write_files(job->result, job->out, "Composição de dados")){
+        fprintf(stderr,"ERRO: não foi possível escrever '%s'.\n", job->out);
+        job->ok = 0;
+    }
+    else printf("Saída: %s\n", job->result->info.bin_filename);
+
+    free_bin(job->result);
+    job->result = NULL;
+}
+
+int run_batch(const char* manifest, size_t csh_window){
+    batch_job* jobs;
+    batch_input* inputs;
+    size_t n_inputs;
+
+    long n = read_manifest(manifest, &jobs, &inputs, &n_inputs);
+    if (n < 0) return perro_com(ARQ_ERR, manifest);
+
+    printf("Lote: %ld jobs, %lu arquivos de entrada\n", n, n_inputs);
+
+    // um cache por geometria (grids, área e método), compartilhado pelos jobs que a repetem
+    g_cache_by_key = 1;
+
+    // as etapas usam as próprias threads dentro de cada seção: leitura e escrita uma thread cada
+    // e a composição o restante, de forma que o total não passe de omp_get_max_threads()
+    int compute_threads = MAX(1, omp_get_max_threads() - 2);
+    omp_set_max_active_levels(2);
+
+    for (long step = 0; step < n + 2; step++){
+        #pragma omp parallel sections num_threads(3)
+        {
+            #pragma omp section
+            {
+                omp_set_num_threads(1);
+                if (step < n) batch_load(jobs + step, inputs);
+            }
+
+            #pragma omp section
+            {
+                omp_set_num_threads(compute_threads);
+                if (step >= 1 && step - 1 < n) batch_compute(jobs + step - 1, inputs, csh_window);
+            }
+
+            #pragma omp section
+            {
+                omp_set_num_threads(1);
+                if (step >= 2) batch_write(jobs + step - 2);
+            }
+        }
+    }
+
+    size_t failed = 0;
+    for (long k = 0; k < n; k++){
+        if (!jobs[k].ok){
+            fprintf(stderr,"ERRO: job da linha %lu não foi concluído.\n", jobs[k].line);
+            failed++;
+        }
+    }
+
+    printf("Lote concluído: %ld de %ld jobs.\n", n - (long)failed, n);
+
+    free(jobs);
+    free(inputs);
+
+    return failed ? perro(FUN_ERR) : 0;
+}
+
+// 1 se a quadrícula c do primário está definida no tempo t_src
+int p_valid(binary_data* p, long t_src, long c){
+    if (t_src < 0) return 0;
+    if (p->valid) return is_valid(p, t_src, c);
+    return !EQ_FLOAT(get_pos_val(p, t_src * p->info.x.def * p->info.y.def + c), p->info.undef);
+}
+
+/* Hash (FNV-1a, em palavras de 64 quadrículas) da máscara do primário no tempo t_src
+**/
+uint64_t mask_hash(binary_data* p, long t_src){
+    size_t words = valid_words(&(p->info));
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    // fora do primário a máscara é vazia
+    const uint64_t* row = (t_src < 0) ? NULL : p->valid + t_src * words;
+
+    for (size_t w = 0; w < words; w++) h = (h ^ (row ? row[w] : 0)) * 0x100000001b3ULL;
+
+    return h;
+}
+
+int same_mask(binary_data* p, long t1, long t2){
+    size_t words = valid_words(&(p->info));
+
+    if (t1 < 0 || t2 < 0){
+        // uma máscara vazia é igual a outra fora do primário ou a um tempo sem quadrícula definida
+        long t = (t1 < 0) ? t2 : t1;
+        if (t < 0) return 1;
+
+        for (size_t w = 0; w < words; w++)
+            if (p->valid[t * words + w]) return 0;
+        return 1;
+    }
+
+    return !memcmp(p->valid + t1 * words, p->valid + t2 * words, words * sizeof(uint64_t));
+}
+
+typedef struct {
+    uint64_t hash;
+    size_t t;
+} mask_key;
+
+int compare_mask_key(const void* a, const void* b){
+    const mask_key* ka = a;
+    const mask_key* kb = b;
+
+    if (ka->hash != kb->hash) return (ka->hash > kb->hash) - (ka->hash < kb->hash);
+    return (ka->t > kb->t) - (ka->t < kb->t);
+}
+
+
+long group_masks(binary_data* dest, binary_data* p, long* group, size_t** rep){
+    size_t tdef = dest->info.tdef;
+
+    mask_key* keys = malloc(tdef * sizeof(mask_key));
+    *rep = malloc(tdef * sizeof(size_t));
+    if (!keys || !*rep){
+        free(keys);
+        free(*rep);
+        return -1;
+    }
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++){
+        keys[t].hash = mask_hash(p, p_time(dest, p, t));
+        keys[t].t = t;
+    }
+
+    // mesmo hash ficam juntos, o representante é o primeiro tempo do grupo
+    qsort(keys, tdef, sizeof(mask_key), compare_mask_key);
+
+    long n = 0;
+    for (size_t i = 0; i < tdef; i++){
+        if (i == 0 || keys[i].hash != keys[i-1].hash) (*rep)[n++] = keys[i].t;
+        group[keys[i].t] = n - 1;
+    }
+    free(keys);
+
+    // confirma as máscaras: em uma colisão de hash o tempo é interpolado quadrícula a quadrícula
+    #pragma omp parallel for
+    for (size_t t = 0; t < tdef; t++){
+        size_t r = (*rep)[group[t]];
+        if (r != t && !same_mask(p, p_time(dest, p, t), p_time(dest, p, r))) group[t] = -1;
+    }
+
+    return n;
+}
+
+
+int build_operator(csr_operator* op, binary_data* dest, binary_data* p, size_t rep, size_t* cells, size_t n_cells, dist_map* dm){
+    size_t x_def = dest->info.x.def;
+    long t_src = p_time(dest, p, rep);
+
+    memset(op, 0, sizeof(csr_operator));
+
+    // lacunas desta máscara
+    if (!(op->cell = malloc(n_cells * sizeof(size_t)))) return 0;
+
+    for (size_t i = 0; i < n_cells; i++){
+        long pc = p_cell(dest, p, cells[i] % x_def, cells[i] / x_def);
+        if (pc < 0 || !p_valid(p, t_src, pc)) op->cell[op->n_rows++] = cells[i];
+    }
+
+    if (dm) update_gap_map(dm, dest, p, t_src);
+
+    size_t n_rows = op->n_rows;
+    op->row_ptr = calloc(n_rows + 1, sizeof(size_t));
+    op->qt      = malloc(n_rows * sizeof(int));
+    op->w_sum   = malloc(n_rows * sizeof(double));
+    op->min_w   = malloc(n_rows * sizeof(double));
+
+    // vizinhos de cada linha, montados em paralelo e depois copiados para o CSR
+    size_t** row_col = calloc(n_rows, sizeof(size_t*));
+    double** row_val = calloc(n_rows, sizeof(double*));
+
+    int ok = op->row_ptr && op->qt && op->w_sum && op->min_w && row_col && row_val;
+    size_t n_build = (ok && g_method != OKR_FLAG) ? n_rows : 0;
+
+    // okr: linhas montadas por configuração de vizinhas
+    if (ok && g_method == OKR_FLAG) ok = okr_rows(op, dest, p, t_src, dm, row_col, row_val);
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (size_t r = 0; r < n_build; r++){
+        size_t x = op->cell[r] % x_def;
+        size_t y = op->cell[r] / x_def;
+        stencil st;
+
+        // lacuna sem vizinhos: linha vazia, o secundário é copiado
+        if (dm && dm->d[op->cell[r]] * DT_SLACK > g_skip_radius[y]){
+            op->qt[r] = 1;
+            op->w_sum[r] = 0;
+            op->min_w[r] = 1;
+            continue;
+        }
+
+        // csh: a seleção depende da máscara, a linha sai pronta
+        if (g_method == CSH_FLAG){
+            row_col[r] = malloc(CSH_N * sizeof(size_t));
+            row_val[r] = malloc(CSH_N * sizeof(double));
+            if (!row_col[r] || !row_val[r]){
+                ok = 0;
+                continue;
+            }
+
+            int n = cshepard_select(dest, p, x, y, t_src, row_col[r], row_val[r], dm);
+            double w_sum = 0, min_w = 1;
+            for (int i = 0; i < n; i++){
+                w_sum += row_val[r][i];
+                if (row_val[r][i] < min_w) min_w = row_val[r][i];
+            }
+
+            op->row_ptr[r + 1] = n;
+            op->qt[r] = 1 + n;
+            op->w_sum[r] = w_sum;
+            op->min_w[r] = min_w;
+            continue;
+        }
+
+        if (!build_stencil(&st, dest, x, y)){
+            ok = 0;
+            continue;
+        }
+
+        row_col[r] = malloc((st.n + 1) * sizeof(size_t));
+        row_val[r] = malloc((st.n + 1) * sizeof(double));
+        if (!row_col[r] || !row_val[r]){
+            free(st.pts);
+            ok = 0;
+            continue;
+        }
+
+        // acumuladores na mesma precisão da função de interpolação
+        size_t n = 0;
+        int qt = 1;
+        coordtype idw_sum = 0, min_w = 1;
+        double msh_sum = 0;
+
+        for (size_t k = 0; k < st.n; k++){
+            long pc = p_cell(dest, p, x + st.pts[k].dx, y + st.pts[k].dy);
+            if (pc < 0 || !p_valid(p, t_src, pc)) continue;
+
+            row_col[r][n] = pc;
+            row_val[r][n] = st.pts[k].w;
+            n++;
+
+            switch (g_method){
+                case AVG_FLAG:
+                    qt++;
+                    break;
+                case IDW_FLAG:
+                    if (min_w > (coordtype)st.pts[k].w) min_w = st.pts[k].w;
+                    idw_sum += (coordtype)st.pts[k].w;
+                    break;
+                case MSH_FLAG:
+                    msh_sum += st.pts[k].w;
+                    if (st.pts[k].minor) qt++;
+                    break;
+            }
+        }
+        free(st.pts);
+
+        op->row_ptr[r + 1] = n;
+        op->qt[r] = qt;
+        op->w_sum[r] = (g_method == IDW_FLAG) ? idw_sum : msh_sum;
+        op->min_w[r] = min_w;
+    }
+
+    if (ok){
+        for (size_t r = 0; r < n_rows; r++) op->row_ptr[r + 1] += op->row_ptr[r];
+
+        size_t nnz = op->row_ptr[n_rows];
+        op->col = malloc((nnz + 1) * sizeof(size_t));
+        op->val = malloc((nnz + 1) * sizeof(double));
+        ok = op->col && op->val;
+    }
+
+    if (ok){
+        #pragma omp parallel for
+        for (size_t r = 0; r < n_rows; r++){
+            size_t n = op->row_ptr[r + 1] - op->row_ptr[r];
+            // linhas sem vizinhos não têm vetores (NULL), memcpy não aceita NULL nem com n = 0
+            if (n){
+                memcpy(op->col + op->row_ptr[r], row_col[r], n * sizeof(size_t));
+                memcpy(op->val + op->row_ptr[r], row_val[r], n * sizeof(double));
+            }
+        }
+    }
+
+    for (size_t r = 0; row_col && row_val && r < n_rows; r++){
+        free(row_col[r]);
+        free(row_val[r]);
+    }
+    free(row_col);
+    free(row_val);
+
+    if (!ok) free_operator(op);
+
+    return ok;
+}
+
+
+/* Aplica a linha r do operador no tempo t, mesmo retorno das funções de interpolação.
+ * 'base' é o início do tempo correspondente no primário.
+**/
+int apply_row(csr_operator* op, size_t r, binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, size_t x, size_t y, size_t t, size_t base){
+
+    datatype val = cp_sec_val(dest,s,x,y,t);
+
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
+
+    size_t k0 = op->row_ptr[r], k1 = op->row_ptr[r + 1];
+    int qt = op->qt[r];
+
+    switch (g_method){
+        case AVG_FLAG: {
+            if (qt <= 1) return 0;
+
+            datatype sum = 0;
+            for (size_t k = k0; k < k1; k++) sum += get_pos_val(p, base + op->col[k]);
+
+            if ( ngauge && (ngauge_val(dest,ngauge,x,y,t)  < MIN_NGAUGE)){
+                val = 0;
+                qt--;
+            }
+
+            sum += val;
+            set_data_val(dest,x,y,t, sum / (datatype)qt);
+            return 1;
+        }
+
+        case IDW_FLAG: {
+            datatype sum = 0;
+            for (size_t k = k0; k < k1; k++) sum += get_pos_val(p, base + op->col[k]) * (coordtype)op->val[k];
+
+            if (sum > 0){
+                coordtype w_sum = op->w_sum[r];
+                coordtype min_w = op->min_w[r];
+
+                if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
+
+                sum += val * min_w;
+                w_sum += min_w;
+
+                set_data_val(dest,x,y,t, sum / w_sum);
+                return 1;
+            }
+            return 0;
+        }
+
+        case MSH_FLAG: {
+            if (qt <= 1) return 0;
+
+            double sum = 0;
+            for (size_t k = k0; k < k1; k++) sum += get_pos_val(p, base + op->col[k]) * op->val[k];
+
+            double w = 1/(double)qt;
+            if ( (qt > MIN_GRIDPOINTS) && ngauge ){
+                if (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE) w = 0;
+            }
+
+            set_data_val(dest,x,y,t,(sum / op->w_sum[r])*(1-w) + val*w);
+            return 1;
+        }
+
+        case CSH_FLAG: {
+            if (qt <= 1) return 0;
+
+            double sum = 0;
+            for (size_t k = k0; k < k1; k++) sum += get_pos_val(p, base + op->col[k]) * op->val[k];
+
+            double min_w = op->min_w[r];
+            if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
+
+            set_data_val(dest,x,y,t,(sum + val*min_w) / (op->w_sum[r] + min_w));
+            return 1;
+        }
+
+        case OKR_FLAG: {
+            if (qt <= 1) return 0;
+
+            double sum = 0;
+            for (size_t k = k0; k < k1; k++) sum += get_pos_val(p, base + op->col[k]) * op->val[k];
+
+            double w = 1/(double)qt;
+            if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) w = 0;
+
+            set_data_val(dest,x,y,t,sum*(1-w) + val*w);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void apply_operator(csr_operator* op, binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, size_t* times, size_t n_times){
+    size_t x_def = dest->info.x.def;
+    size_t p_xy = p->info.x.def * p->info.y.def;
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t r = 0; r < op->n_rows; r++){
+        size_t x = op->cell[r] % x_def;
+        size_t y = op->cell[r] / x_def;
+
+        // os pesos da linha são reaproveitados em todos os tempos do grupo
+        for (size_t i = 0; i < n_times; i++){
+            size_t t = times[i];
+            long t_src = p_time(dest, p, t);
+            size_t base = (t_src < 0) ? 0 : t_src * p_xy;
+
+            int modified = apply_row(op, r, dest, p, s, ngauge, x, y, t, base);
+            modified = chain_gap(dest, p, x, y, t, modified);
+
+            if(g_debug && !modified) set_data_val(dest,x,y,t,dest->info.undef);
+        }
+    }
+}
+
+
+int compose_operators(binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, coordtype xi, coordtype xf, coordtype yi, coordtype yf,
+                      stencil* columns, long* group, size_t* rep, long n_groups){
+    info_ctl* info = &(dest->info);
+    size_t n_xy = info->x.def * info->y.def;
+
+    size_t* cells = malloc(n_xy * sizeof(size_t));
+    size_t* start = calloc(n_groups + 1, sizeof(size_t));
+    size_t* times = malloc(info->tdef * sizeof(size_t));
+    int ok = cells && start && times;
+
+    if (ok){
+        // quadrículas dentro da área que não são colunas de --cells
+        size_t n_cells = 0;
+        for (size_t c = 0; c < n_xy; c++){
+            if (columns && columns[c].active) continue;
+
+            coordtype x_pos = wrap_val((c % info->x.def) * info->x.size + info->x.i,MIN_X,MAX_X);
+            coordtype y_pos = wrap_val((c / info->x.def) * info->y.size + info->y.i,MIN_Y,MAX_Y);
+            if (inside_area(x_pos, y_pos, xi, xf, yi, yf)) cells[n_cells++] = c;
+        }
+
+        // tempos de cada grupo, em ordem
+        for (size_t t = 0; t < info->tdef; t++)
+            if (group[t] >= 0) start[group[t] + 1]++;
+        for (long g = 0; g < n_groups; g++) start[g + 1] += start[g];
+        for (size_t t = 0; t < info->tdef; t++)
+            if (group[t] >= 0) times[start[group[t]]++] = t;
+        // 'start' foi deslocado pelo preenchimento, volta uma posição
+        for (long g = n_groups; g > 0; g--) start[g] = start[g - 1];
+        start[0] = 0;
+
+        // operadores de execuções anteriores com a mesma geometria
+        size_t words = (p->info.x.def * p->info.y.def + 63) / 64;
+        oper_cache* cache = NULL;
+        uint64_t* mask = NULL;
+        size_t reused = 0;
+
+        if (strlen(g_cache_name) > 0){
+            uint64_t key = operator_key(dest, p, xi, xf, yi, yf);
+            char cache_name[STR_SIZE + 17];
+
+            if (g_cache_by_key) snprintf(cache_name, sizeof(cache_name), "%s.%016llx", g_cache_name, (unsigned long long)key);
+            else strcpy(cache_name, g_cache_name);
+
+            cache = open_oper_cache(cache_name, key, words, n_xy, p->info.x.def * p->info.y.def);
+            if (cache && !(mask = malloc(words * sizeof(uint64_t)))) ok = 0;
+            if (!cache) fprintf(stderr,"AVISO: continuando sem cache de operadores.\n");
+        }
+
+        // transformada de distância da máscara de cada operador
+        dist_map* dm = gap_map(dest);
+
+        for (long g = 0; ok && g < n_groups; g++){
+            csr_operator op;
+            uint64_t hash = 0;
+            int found = 0;
+
+            if (cache){
+                mask_words(p, p_time(dest, p, rep[g]), mask, words);
+                hash = hash_bytes(HASH_INIT, mask, words * sizeof(uint64_t));
+                reused += (found = find_operator(cache, hash, mask, &op));
+            }
+
+            if (!found){
+                if (!(ok = build_operator(&op, dest, p, rep[g], cells, n_cells, dm))) break;
+
+                if (cache && !save_operator(cache, hash, mask, &op))
+                    fprintf(stderr,"AVISO: operador não foi salvo no cache.\n");
+            }
+
+            apply_operator(&op, dest, p, s, ngauge, times + start[g], start[g + 1] - start[g]);
+            free_operator(&op);
+        }
+        free_dist_map(dm);
+
+        if (g_method == OKR_FLAG) printf("  Sistemas de krigagem: %lu para %lu lacunas\n", g_okr_systems, g_okr_rows);
+
+        if (cache){
+            printf("  Cache de operadores: %lu reaproveitados, %lu novos\n", reused, cache->n_new);
+            close_oper_cache(cache);
+        }
+        free(mask);
+    }
+
+    free(cells);
+    free(start);
+    free(times);
+
+    return ok;
+}
+
+
+void compose_window(binary_data* dest, binary_data* p, binary_data* s, binary_data* ngauge, coordtype xi, coordtype xf, coordtype yi, coordtype yf,
+                    size_t p_ox, size_t p_oy, size_t p_ot){
+    info_ctl* info = &(dest->info);
+    size_t n_xy = info->x.def * info->y.def;
+    dist_map* dm = gap_map(dest);
+
+    for (size_t t = 0; t < info->tdef; t++){
+        // tempos consecutivos do primário: a janela perde um tempo e ganha outro
+        long t_src = p_time(dest, p, t);
+        if (t_src >= 0) corr_window_seek(g_window, t_src);
+        if (dm) update_gap_map(dm, dest, p, t_src);
+
+        #pragma omp parallel
+        {
+        g_dmap = dm;
+
+        #pragma omp for schedule(dynamic, 64)
+        for (size_t c = 0; c < n_xy; c++){
+            size_t x = c % info->x.def, y = c / info->x.def;
+
+            coordtype x_pos = wrap_val(x * info->x.size + info->x.i,MIN_X,MAX_X);
+            coordtype y_pos = wrap_val(y * info->y.size + info->y.i,MIN_Y,MAX_Y);
+            if (!inside_area(x_pos, y_pos, xi, xf, yi, yf)) continue;
+
+            if (primary_gap(dest,p,x,y,t,p_ox,p_oy,p_ot)){
+                int modified = 0;
+
+                if (dm && hopeless_gap(dm,dest,p,x,y,t_src)) cp_sec_val(dest,s,x,y,t);
+                else modified = cshepard_interpolation(dest,p,s,x,y,t,ngauge);
+
+                modified = chain_gap(dest,p,x,y,t,modified);
+
+                if (g_debug && !modified) set_data_val(dest,x,y,t,info->undef);
+            }
+        }
+
+        g_dmap = NULL;
+        }
+    }
+
+    free_dist_map(dm);
+}
+
+
+uint64_t operator_key(binary_data* dest, binary_data* p, coordtype xi, coordtype xf, coordtype yi, coordtype yf){
+    double geometry[] = {
+        dest->info.x.def, dest->info.x.i, dest->info.x.size,
+        dest->info.y.def, dest->info.y.i, dest->info.y.size,
+        p->info.x.def, p->info.x.i, p->info.x.size,
+        p->info.y.def, p->info.y.i, p->info.y.size,
+        xi, xf, yi, yf,
+        g_method, BETA, MAJOR_RADIUS, MINOR_RADIUS,
+        sizeof(coordtype)
+    };
+
+    uint64_t h = hash_bytes(HASH_INIT, geometry, sizeof(geometry));
+
+    // as colunas de --cells não fazem parte dos operadores
+    if (g_cells) h = hash_bytes(h, g_cells, 2 * g_n_cells * sizeof(coordtype));
+
+    // no csh os pesos dependem das correlações, ou seja, do próprio dado
+    if (g_corr) h = hash_bytes(h, g_corr->corr, g_corr->cell_start[g_corr->y] * sizeof(float));
+
+    // no okr dependem do variograma ajustado
+    if (g_method == OKR_FLAG){
+        double vario[] = {g_vario.nugget, g_vario.sill, g_vario.range, OKR_N, OKR_MIN};
+        h = hash_bytes(h, vario, sizeof(vario));
+    }
+
+    return h;
+}
+
+
+void mask_words(binary_data* p, long t_src, uint64_t* mask, size_t words){
+    // o mapa de validade já está nesse formato
+    if (t_src < 0) memset(mask, 0, words * sizeof(uint64_t));
+    else memcpy(mask, p->valid + t_src * words, words * sizeof(uint64_t));
+}
+
+
+int compare_near(const void* a, const void* b){
+    const corr_offset* oa = a;
+    const corr_offset* ob = b;
+
+    if (oa->d != ob->d) return (oa->d > ob->d) - (oa->d < ob->d);
+    if (oa->dy != ob->dy) return oa->dy - ob->dy;
+    return oa->dx - ob->dx;
+}
+
+
+int cshepard_prepare(binary_data* dest, binary_data* p){
+    // na janela móvel a tabela é atualizada pela janela a cada tempo
+    if (g_csh_window){
+        if (!(g_window = corr_window_init(p, MAJOR_RADIUS, dist, g_csh_window))) return 0;
+        g_corr = g_window->table;
+    }
+    else if (!(g_corr = corr_full(p, MAJOR_RADIUS, dist))) return 0;
+
+    return prepare_near(dest);
+}
+
+
+int prepare_near(binary_data* dest){
+    info_ctl* info = &(dest->info);
+
+    // já preparados por outro método (cadeia de secundários)
+    if (g_near) return 1;
+
+    // vizinhos de cada linha de 'dest' em ordem de distância (a própria quadrícula é a primeira)
+    if (!(g_near_start = calloc(info->y.def + 1, sizeof(size_t)))) return 0;
+
+    for (size_t y = 0; y < info->y.def; y++)
+        g_near_start[y + 1] = g_near_start[y] + radius_offsets(info, y, MAJOR_RADIUS, dist, NULL);
+
+    if (!(g_near = malloc(g_near_start[info->y.def] * sizeof(corr_offset)))) return 0;
+
+    for (size_t y = 0; y < info->y.def; y++){
+        corr_offset* near = g_near + g_near_start[y];
+        size_t n = g_near_start[y + 1] - g_near_start[y];
+
+        radius_offsets(info, y, MAJOR_RADIUS, dist, near);
+        qsort(near, n, sizeof(corr_offset), compare_near);
+    }
+
+    return 1;
+}
+
+
+// estação candidata do csh
+typedef struct {
+    float cc;
+    size_t col;
+} csh_item;
+
+// ordem do heap: menor correlação na raiz (em empate, maior índice)
+static int csh_less(csh_item a, csh_item b){
+    return (a.cc < b.cc) || (a.cc == b.cc && a.col > b.col);
+}
+
+static void csh_sift_down(csh_item* heap, int n, int i){
+    while (1){
+        int l = 2*i + 1, r = l + 1, m = i;
+
+        if (l < n && csh_less(heap[l], heap[m])) m = l;
+        if (r < n && csh_less(heap[r], heap[m])) m = r;
+        if (m == i) return;
+
+        csh_item tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+
+int cshepard_select(binary_data* dest, binary_data* p, size_t x, size_t y, long t_src, size_t* col, double* w, dist_map* dm){
+    if (t_src < 0) return 0;
+
+    size_t first = near_first(x, y, t_src, dm), end = g_near_start[y + 1];
+
+    // estação mais próxima definida neste tempo
+    long ns = -1;
+    for (size_t k = first; k < end && ns < 0; k++){
+        if (g_near[k].dx == 0 && g_near[k].dy == 0) continue;
+
+        long pc = p_cell(dest, p, x + g_near[k].dx, y + g_near[k].dy);
+        if (pc >= 0 && p_valid(p, t_src, pc)) ns = pc;
+    }
+    if (ns < 0) return 0;
+
+    size_t x_def = p->info.x.def;
+    size_t xn = ns % x_def, yn = ns / x_def;
+    corr_offset* off = g_corr->off + g_corr->off_start[yn];
+    size_t n_k = g_corr->off_start[yn + 1] - g_corr->off_start[yn];
+
+    // heap com as CSH_N maiores correlações: só é tocado quando a candidata supera a menor
+    csh_item heap[CSH_N];
+    int n = 0;
+
+    for (size_t k = 0; k < n_k; k++){
+        long xb = (long)xn + off[k].dx, yb = (long)yn + off[k].dy;
+        if (xb < 0 || yb < 0 || xb >= (long)x_def || yb >= (long)p->info.y.def) continue;
+
+        size_t cb = yb * x_def + xb;
+        if (!p_valid(p, t_src, cb)) continue;
+
+        // a própria NS tem correlação 1
+        float cc = (off[k].dx == 0 && off[k].dy == 0) ? 1 : corr_get(g_corr, xn, yn, k);
+        if (isnan(cc)) continue;
+
+        csh_item item = {cc, cb};
+
+        if (n < CSH_N){
+            // sobe o novo item até a posição
+            int i = n++;
+            heap[i] = item;
+            while (i > 0 && csh_less(heap[i], heap[(i - 1) / 2])){
+                csh_item tmp = heap[i];
+                heap[i] = heap[(i - 1) / 2];
+                heap[(i - 1) / 2] = tmp;
+                i = (i - 1) / 2;
+            }
+        }
+        else if (csh_less(heap[0], item)){
+            heap[0] = item;
+            csh_sift_down(heap, n, 0);
+        }
+    }
+
+    // retira do heap da menor para a maior, preenchendo do fim para o início
+    for (int i = n - 1; i >= 0; i--){
+        col[i] = heap[0].col;
+        w[i] = exp(-(1 - (double)heap[0].cc));
+
+        heap[0] = heap[i];
+        csh_sift_down(heap, i, 0);
+    }
+
+    return n;
+}
+
+
+int cshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
+
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
+
+    size_t col[CSH_N];
+    double w[CSH_N];
+    long t_src = p_time(dest, p_src, t);
+
+    int n = cshepard_select(dest, p_src, x, y, t_src, col, w, g_dmap);
+    if (n == 0) return 0;
+
+    size_t base = t_src * p_src->info.x.def * p_src->info.y.def;
+    double sum = 0, w_sum = 0, min_w = 1;
+
+    for (int i = 0; i < n; i++){
+        sum += get_pos_val(p_src, base + col[i]) * w[i];
+        w_sum += w[i];
+        if (w[i] < min_w) min_w = w[i];
+    }
+
+    // o secundário entra com o menor peso entre as estações escolhidas
+    if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
+
+    set_data_val(dest,x,y,t,(sum + val*min_w) / (w_sum + min_w));
+
+    return 1;
+}
+
+
+// no csh não há estêncil fixo: as estações mudam com a máscara de cada tempo
+int cshepard_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+    return none_stencil(st, dest, x, y);
+}
+
+
+int cshepard_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+    return cshepard_interpolation(dest,p_src,s_src,x,y,t,ngauge);
+}
+
+
+size_t near_first(size_t x, size_t y, long t_src, dist_map* dm){
+    size_t first = g_near_start[y];
+
+    // mais perto que a distância da transformada não há quadrícula definida:
+    // busca binária pelo primeiro vizinho a essa distância
+    if (dm && dm->ready && dm->t == t_src){
+        double d_min = dm->d[y * dm->x + x] * DT_SLACK;
+        size_t lo = first, hi = g_near_start[y + 1];
+
+        while (lo < hi){
+            size_t mid = lo + (hi - lo) / 2;
+            if (g_near[mid].d < d_min) lo = mid + 1;
+            else hi = mid;
+        }
+        first = lo;
+    }
+
+    return first;
+}
+
+
+// g_near depende apenas do grid, é liberado com as demais tabelas de geometria
+void free_cshepard(){
+    if (g_window) free_corr_window(g_window);
+    else free_corr_table(g_corr);
+
+    g_window = NULL;
+    g_corr = NULL;
+}
+
+
+int same_geometry(info_ctl* info){
+    static info_ctl last;
+    static int last_method = -1;
+
+    if (g_dist_matrix && last_method == g_method &&
+        last.x.def == info->x.def && EQ_FLOAT(last.x.i, info->x.i) && EQ_FLOAT(last.x.size, info->x.size) &&
+        last.y.def == info->y.def && EQ_FLOAT(last.y.i, info->y.i) && EQ_FLOAT(last.y.size, info->y.size)) return 1;
+
+    free_geometry();
+    cp_ctl(&last, info);
+    last_method = g_method;
+
+    return 0;
+}
+
+
+void free_geometry(){
+    free_dist_matrix(g_dist_matrix);
+    free(g_skip_radius);
+    free(g_near);
+    free(g_near_start);
+
+    g_dist_matrix = NULL;
+    g_skip_radius = NULL;
+    g_near = NULL;
+    g_near_start = NULL;
+}
+
+
+int okr_prepare(binary_data* dest, binary_data* p){
+    if (!fit_variogram(p, MAJOR_RADIUS, dist, &g_vario)) return 0;
+
+    printf("  Variograma exponencial: pepita %g, patamar %g, alcance %.1f km\n", g_vario.nugget, g_vario.sill, g_vario.range);
+
+    return prepare_near(dest);
+}
+
+
+int okr_select(binary_data* dest, binary_data* p, size_t x, size_t y, long t_src, size_t* col, int* off, dist_map* dm){
+    if (t_src < 0) return 0;
+
+    int n = 0;
+    for (size_t k = near_first(x, y, t_src, dm); k < g_near_start[y + 1] && n < OKR_N; k++){
+        if (g_near[k].dx == 0 && g_near[k].dy == 0) continue;
+
+        long pc = p_cell(dest, p, x + g_near[k].dx, y + g_near[k].dy);
+        if (pc < 0 || !p_valid(p, t_src, pc)) continue;
+
+        col[n] = pc;
+        off[2 * n] = g_near[k].dx;
+        off[2 * n + 1] = g_near[k].dy;
+        n++;
+    }
+
+    return n;
+}
+
+
+int okr_system(binary_data* dest, size_t y, const int* off, int n, double* lambda){
+    // as distâncias só dependem da latitude, a lacuna é posta na primeira coluna
+    double lon = dest->info.x.i;
+    double lat = dest->info.y.i + y * dest->info.y.size;
+    double lon_k[OKR_N], lat_k[OKR_N], d0[OKR_N], d[OKR_N * OKR_N];
+
+    for (int i = 0; i < n; i++){
+        lon_k[i] = lon + off[2 * i] * dest->info.x.size;
+        lat_k[i] = lat + off[2 * i + 1] * dest->info.y.size;
+        d0[i] = dist(lon, lat, lon_k[i], lat_k[i]);
+    }
+
+    for (int i = 0; i < n; i++){
+        d[i * n + i] = 0;
+        for (int j = 0; j < i; j++)
+            d[i * n + j] = d[j * n + i] = dist(lon_k[i], lat_k[i], lon_k[j], lat_k[j]);
+    }
+
+    return krig_weights(&g_vario, d, d0, n, lambda);
+}
+
+
+// configuração das vizinhas de uma linha do operador
+typedef struct {
+    uint64_t hash;
+    size_t r;
+} okr_key;
+
+int compare_okr_key(const void* a, const void* b){
+    const okr_key* ka = a;
+    const okr_key* kb = b;
+
+    if (ka->hash != kb->hash) return (ka->hash > kb->hash) - (ka->hash < kb->hash);
+    return (ka->r > kb->r) - (ka->r < kb->r);
+}
+
+
+int okr_rows(csr_operator* op, binary_data* dest, binary_data* p, long t_src, dist_map* dm, size_t** row_col, double** row_val){
+    size_t n_rows = op->n_rows, x_def = dest->info.x.def;
+
+    okr_key* keys = malloc((n_rows + 1) * sizeof(okr_key));
+    size_t* sys = malloc((n_rows + 1) * sizeof(size_t));
+    int* off = malloc((n_rows + 1) * 2 * OKR_N * sizeof(int));
+    int* n_sel = malloc((n_rows + 1) * sizeof(int));
+    int ok = keys && sys && off && n_sel;
+    size_t n_build = ok ? n_rows : 0;
+
+    // vizinhas de cada lacuna e hash da configuração (linha e deslocamentos)
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (size_t r = 0; r < n_build; r++){
+        size_t x = op->cell[r] % x_def;
+        size_t y = op->cell[r] / x_def;
+
+        op->qt[r] = 1;
+        op->w_sum[r] = 0;
+        op->min_w[r] = 1;
+        n_sel[r] = 0;
+        keys[r] = (okr_key){0, r};
+
+        // lacuna sem vizinhos: linha vazia, o secundário é copiado
+        if (dm && dm->d[op->cell[r]] * DT_SLACK > g_skip_radius[y]) continue;
+
+        if (!(row_col[r] = malloc(OKR_N * sizeof(size_t)))){
+            ok = 0;
+            continue;
+        }
+
+        int* o = off + r * 2 * OKR_N;
+        int n = okr_select(dest, p, x, y, t_src, row_col[r], o, dm);
+        if (n < OKR_MIN) continue;
+
+        n_sel[r] = n;
+        keys[r].hash = hash_bytes(hash_bytes(HASH_INIT, &y, sizeof(y)), o, 2 * n * sizeof(int));
+    }
+
+    // linhas com a mesma configuração ficam juntas, cada sistema começa na primeira delas
+    // (em uma colisão de hash a configuração diferente começa outro sistema)
+    size_t n_sys = 0;
+    if (ok){
+        qsort(keys, n_rows, sizeof(okr_key), compare_okr_key);
+
+        for (size_t i = 0; i < n_rows; i++){
+            size_t r = keys[i].r;
+            if (!n_sel[r]) continue;
+
+            if (n_sys > 0){
+                size_t l = keys[sys[n_sys - 1]].r;
+                if (keys[i].hash == keys[sys[n_sys - 1]].hash && op->cell[r] / x_def == op->cell[l] / x_def &&
+                    n_sel[r] == n_sel[l] && !memcmp(off + r * 2 * OKR_N, off + l * 2 * OKR_N, 2 * n_sel[r] * sizeof(int))) continue;
+            }
+            sys[n_sys++] = i;
+        }
+        sys[n_sys] = n_rows;
+    }
+
+    // um sistema por configuração, pesos copiados para as linhas
+    size_t n_used = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok) reduction(+:n_used)
+    for (size_t j = 0; j < n_sys; j++){
+        size_t l = keys[sys[j]].r;
+        int n = n_sel[l];
+        double lambda[OKR_N];
+
+        int solved = okr_system(dest, op->cell[l] / x_def, off + l * 2 * OKR_N, n, lambda);
+
+        for (size_t i = sys[j]; i < sys[j + 1]; i++){
+            size_t r = keys[i].r;
+            if (!n_sel[r]) continue;
+
+            // sistema singular: linha vazia
+            if (!solved){
+                n_sel[r] = 0;
+                continue;
+            }
+
+            if (!(row_val[r] = malloc(n * sizeof(double)))){
+                ok = 0;
+                continue;
+            }
+            memcpy(row_val[r], lambda, n * sizeof(double));
+
+            op->row_ptr[r + 1] = n;
+            op->qt[r] = 1 + n;
+            op->w_sum[r] = 1;
+            n_used++;
+        }
+    }
+
+    g_okr_systems += n_sys;
+    g_okr_rows += n_used;
+
+    free(keys);
+    free(sys);
+    free(off);
+    free(n_sel);
+
+    return ok;
+}
+
+
+int okr_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+
+    datatype val = cp_sec_val(dest,s_src,x,y,t);
+
+    if(EQ_FLOAT(val,dest->info.undef)) return 0;
+
+    size_t col[OKR_N];
+    int off[2 * OKR_N];
+    double lambda[OKR_N];
+    long t_src = p_time(dest, p_src, t);
+
+    int n = okr_select(dest, p_src, x, y, t_src, col, off, g_dmap);
+    if (n < OKR_MIN || !okr_system(dest, y, off, n, lambda)) return 0;
+
+    size_t base = t_src * p_src->info.x.def * p_src->info.y.def;
+    double sum = 0;
+
+    for (int i = 0; i < n; i++) sum += get_pos_val(p_src, base + col[i]) * lambda[i];
+
+    // o secundário entra como no msh, com peso 1/qt
+    double w = 1/(double)(1 + n);
+    if ( ngauge && (ngauge_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) w = 0;
+
+    set_data_val(dest,x,y,t,sum*(1-w) + val*w);
+
+    return 1;
+}
+
+
+// no okr não há estêncil fixo: as vizinhas mudam com a máscara de cada tempo
+int okr_stencil(stencil* st, binary_data* dest, size_t x, size_t y){
+    return none_stencil(st, dest, x, y);
+}
+
+
+int okr_apply(stencil* st, binary_data* dest, binary_data* p_src, binary_data* s_src, size_t x, size_t y, size_t t, binary_data* ngauge){
+    return okr_interpolation(dest,p_src,s_src,x,y,t,ngauge);
+}
+
+
+
+int method_from_name(const char* name){
+    const char* names[] = {"none", "avg", "idw", "msh", "csh", "okr"};
+
+    for (int m = 0; m <= OKR_FLAG; m++)
+        if (!strcmp(name, names[m])) return m;
+
+    return -1;
+}
+
+
+void set_method(int method){
+    printf("Método de interpolação:");
+
+    switch (method){
+        case NON_FLAG:
+            printf(" **SEM** Interpolação.\n");
+            interpolation = none_interpolation;
+            build_stencil = none_stencil;
+            apply_stencil = none_apply;
+            break;
+        case AVG_FLAG:
+            interpolation = average_interpolation;
+            build_stencil = average_stencil;
+            apply_stencil = average_apply;
+            printf(" Média de quadriculas adjacentes.\n");
+            break;
+        case IDW_FLAG:
+            interpolation = idweight_interpolation;
+            build_stencil = idweight_stencil;
+            apply_stencil = idweight_apply;
+            printf(" Inverse distance weighting (IDW).\n");
+            break;
+        case MSH_FLAG:
+            printf(" Modified Shepard.\n");
+            interpolation = mshepard_interpolation;
+            build_stencil = mshepard_stencil;
+            apply_stencil = mshepard_apply;
+            break;
+        case CSH_FLAG:
+            printf(" Shepard por correlação (%d estações).\n", CSH_N);
+            if (g_csh_window) printf("  Correlações em janelas de %lu tempos.\n", g_csh_window);
+            interpolation = cshepard_interpolation;
+            build_stencil = cshepard_stencil;
+            apply_stencil = cshepard_apply;
+            break;
+        case OKR_FLAG:
+            printf(" Krigagem ordinária (%d vizinhas).\n", OKR_N);
+            interpolation = okr_interpolation;
+            build_stencil = okr_stencil;
+            apply_stencil = okr_apply;
+            break;
+    }
+
+    g_method = method;
+}
+
+coordtype get_weight(size_t x, size_t y, int dx, int dy){
+    if (!g_dist_matrix) return 0;
+
+    if (dx == 0) return g_height;
+
+
+    return g_dist_matrix[dy + 1][y];
+}
+
+/*
+* Calculamos uma matriz de distâncias previamente,
+* uma vez que as distancias entre quadriculas
+* só variam em decorrência das latitudes.
+* Assim não precisamos recalcular o mesmo valor
+* para cada quadrícula individual
+**/
+coordtype** calc_dist(info_ctl* info,double (*dist)(double,double,double,double)){
+    int y = info->y.def;
+    coordtype** data;
+
+    if(! (data = alloc_dist_matrix(3,y))) return NULL;
+
+
+    coordtype lon_i = info->x.i;
+    coordtype lon_f = lon_i + info->x.size;
+    coordtype lat_i = info->y.i;
+
+    // salva a altura na variavel global
+    g_height = weight(dist(0, 0, 0, info->y.size));
+
+    for(size_t i = 0; i < y; i++){
+
+        // distancia para a quadricula na diagonal superior
+        data[0][i] = weight(dist(lon_i, lat_i, lon_f, lat_i - info->y.size));
+
+        // distancia para a quadricula ao lado
+        data[1][i] = weight(dist(lon_i, lat_i, lon_f, lat_i));
+
+        // distancia para a quadricula na diagonal inferior
+        data[2][i] = weight(dist(lon_i, lat_i, lon_f, lat_i + info->y.size));
+
+        lat_i += info->y.size;
+    }
+
+    return data;
+}
+
+coordtype** alloc_dist_matrix(int lin, int col){
+    coordtype** mat;
+
+    if(! (mat = malloc (lin * sizeof (coordtype*)))){
+        return NULL;
+    }
+
+    // aloca um vetor com todos os elementos da matriz
+    if (! (mat[0] = malloc(lin * col * sizeof(coordtype)))){
+        free (mat[0]);
+        return NULL;
+    }
+
+    // ajusta os demais ponteiros de linhas (i > 0)
+    for (int i = 1; i < lin; i++)
+        mat[i] = mat[0] + i * col;
+
+
+    return mat;
+}
+
+void free_dist_matrix(coordtype** mat){
+    if (mat){
+        free (mat[0]);
+        free (mat);
+    }
+}
+
+
+// ૮・ﻌ・ა
+int perro(int err_cod){
+    return perro_com(err_cod,"");
+}
+
+
+int perro_com (int err_cod, const char* comment){
+    switch (err_cod){
+        case ARG_ERR:
+            fprintf(stderr,"ERRO: argumentos inválidos.\n%s\n",comment);
+        break;
+
+        case ARQ_ERR:
+            fprintf(stderr,"ERRO: não foi possível abrir arquivo.\n%s\n", comment);
+        break;
+
+        case MEM_ERR:
+            fprintf(stderr,"ERRO: falha na alocação.\n%s\n",comment);
+        break;
+
+        case FUN_ERR:
+            fprintf(stderr,"ERRO: função de juntar dados não pode ser executada.\n%s\n",comment);
+        break;
+
+        default:
+            //fprintf(stderr,"ERRO:%s\n.",comment);
+            return 0;
+        break;
     }
 
     fprintf(stderr,"Abortando.\n");
     return err_cod;
 }
+
+
+int prepare_skip(binary_data* dest){
+    info_ctl* info = &(dest->info);
+
+    if (!(g_skip_radius = malloc(info->y.def * sizeof(double)))) return 0;
+
+    for (size_t y = 0; y < info->y.def; y++){
+        double lon = info->x.i;
+        double lat = info->y.i + y * info->y.size;
+
+        switch (g_method){
+            // msh só interpola com alguma quadrícula a menos de MINOR_RADIUS
+            case MSH_FLAG:
+                g_skip_radius[y] = MINOR_RADIUS;
+                break;
+            // csh precisa de uma NS a menos de MAJOR_RADIUS, okr de vizinhas a menos de MAJOR_RADIUS
+            case CSH_FLAG:
+            case OKR_FLAG:
+                g_skip_radius[y] = MAJOR_RADIUS;
+                break;
+            // avg e idw usam as quadrículas adjacentes: a mais distante é a diagonal
+            default:
+                g_skip_radius[y] = MAX(dist(lon, lat, lon + info->x.size, lat + info->y.size),
+                                       dist(lon, lat, lon + info->x.size, lat - info->y.size));
+                break;
+        }
+    }
+
+    return 1;
+}
+
+
+dist_map* gap_map(binary_data* dest){
+    double radius = 0;
+
+    // a transformada não dá a volta no globo: com borda periódica todas as lacunas são percorridas
+    if (g_halo && g_halo->periodic) return NULL;
+
+    for (size_t y = 0; y < dest->info.y.def; y++) radius = MAX(radius, g_skip_radius[y]);
+
+    return alloc_dist_map(&(dest->info), radius, dist);
+}
+
+
+void update_gap_map(dist_map* dm, binary_data* dest, binary_data* p, long t_src){
+    if (dm->ready && dm->t == t_src) return;
+
+    for (size_t y = 0; y < dm->y; y++){
+        for (size_t x = 0; x < dm->x; x++){
+            long pc = p_cell(dest, p, x, y);
+            dm->mask[y * dm->x + x] = (pc >= 0) && p_valid(p, t_src, pc);
+        }
+    }
+
+    dist_transform(dm, t_src);
+}
+
+
+int hopeless_gap(dist_map* dm, binary_data* dest, binary_data* p, size_t x, size_t y, long t_src){
+    update_gap_map(dm, dest, p, t_src);
+
+    return dm->d[y * dm->x + x] * DT_SLACK > g_skip_radius[y];
+}
+
+
+halo_grid* build_p_halo(binary_data* dest, binary_data* p, coordtype yi, coordtype yf){
+    info_ctl* info = &(dest->info);
+    size_t w = 1;   // avg e idw: quadrículas adjacentes
+
+    // msh: o maior alcance entre as linhas da área
+    if (g_method == MSH_FLAG || chain_uses(MSH_FLAG)){
+        for (size_t y = 0; y < info->y.def; y++){
+            coordtype lat = info->y.i + y * info->y.size;
+            if (!inside_axis(wrap_val(lat,MIN_Y,MAX_Y), yi, yf)) continue;
+
+            size_t steps = (size_t)(MAJOR_RADIUS/dist(0,lat,info->x.size,lat));
+            w = MAX(w, steps);
+        }
+    }
+
+    // indefinidos viram NaN: os estênceis testam a validade sem comparar com undef
+    halo_grid* h = alloc_halo(info->x.def, info->y.def, info->tdef, w, w, periodic_grid(info), NAN);
+    if (!h) return NULL;
+
+    size_t p_xy = p->info.x.def * p->info.y.def;
+
+    #pragma omp parallel for
+    for (size_t t = 0; t < info->tdef; t++){
+        long t_src = p_time(dest, p, t);
+        if (t_src < 0) continue;
+
+        for (size_t y = 0; y < info->y.def; y++){
+            datatype* row = halo_ptr(h, 0, y, t);
+
+            for (size_t x = 0; x < info->x.def; x++){
+                long pc = p_cell(dest, p, x, y);
+                if (pc >= 0 && p_valid(p, t_src, pc)) row[x] = get_pos_val(p, t_src * p_xy + pc);
+            }
+        }
+    }
+
+    wrap_halo(h);
+
+    return h;
+}
@@ -0,0 +1,182 @@
+/*
+Programa para converter arquivos binários (.bin do GrADS)
+para o formato em blocos (c_tile) e vice-versa.
+Também mostra um resumo do índice de um arquivo em blocos
+sem ler os dados.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>     //getopt
+#include <string.h>     //strncpy
+#include "c_ctl.h"
+#include "c_tile.h"
+
+
+//Códigos de erro
+#define ARG_ERR 2   //Erro com parâmetros
+#define ARQ_ERR 3   //Erro com arquivos
+
+// modos do programa
+#define TO_TILE 1
+#define TO_BIN  2
+#define INFO    3
+
+
+#define EXEC_MSG "(--tile | --bin) entrada.ctl prefixo_saida\n\t%s --info entrada.ctl"
+#define OPTS_MSG "OPTIONS"\
+    "\n\t-t, --tile\t\tConverte .bin para o formato em blocos."\
+    "\n\t-b, --bin\t\tConverte do formato em blocos para .bin."\
+    "\n\t-s, --info\t\tMostra o resumo do índice (quadrículas válidas por tempo)."\
+    "\n\t--tx N, --ty N\t\tTamanho dos blocos (padrão " STR(TILE_DEF_X) "x" STR(TILE_DEF_Y) ")."\
+    "\n\t--x0 N --y0 N --t0 N\tInício da região lida com --bin (índices)."\
+    "\n\t--nx N --ny N --nt N\tTamanho da região lida com --bin (padrão: arquivo todo).\n"
+
+
+// Imprime o resumo do índice do arquivo em blocos
+int print_index(char* ctl_name){
+    info_ctl info;
+    tile_index* index;
+
+    if (!open_ctl(&info, ctl_name)) return ARQ_ERR;
+
+    if (!(index = open_tile_index(info.bin_filename, info.x.def, info.y.def, info.tdef))) return ARQ_ERR;
+
+    size_t empty = 0, full = 0, n = index->nx * index->ny * index->t;
+    for (size_t k = 0; k < n; k++){
+        if (!index->entries[k].valid) empty++;
+        else if (index->entries[k].valid == index->entries[k].cells) full++;
+    }
+
+    printf("Arquivo: %s\n", index->filename);
+    printf("Dimensões: %lu x %lu x %lu\n", index->x, index->y, index->t);
+    printf("Blocos: %lu x %lu de %lux%lu (%lu por tempo)\n", index->nx, index->ny, index->tx, index->ty, index->nx * index->ny);
+    printf("Blocos vazios: %lu, cheios: %lu, mistos: %lu\n", empty, full, n - empty - full);
+
+    printf("t, validas, lacunas\n");
+    for (size_t t = 0; t < index->t; t++){
+        size_t gaps = tile_count_gaps(index, t, 0, index->x, 0, index->y);
+        printf("%lu, %lu, %lu\n", t + 1, index->x * index->y - gaps, gaps);
+    }
+
+    free_tile_index(index);
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    binary_data* data = NULL;
+
+    char in_name[STR_SIZE] = {'\0'};
+    char out_name[STR_SIZE] = {'\0'};
+
+    int mode = 0;
+    size_t tx = TILE_DEF_X, ty = TILE_DEF_Y;
+
+    // região lida no modo --bin (0 = arquivo todo)
+    size_t x0 = 0, y0 = 0, t0 = 0, nx = 0, ny = 0, nt = 0;
+
+    while(1){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, NULL, 'h'},
+            {"tile", no_argument, NULL, 't'},
+            {"bin" , no_argument, NULL, 'b'},
+            {"info", no_argument, NULL, 's'},
+
+            {"tx", required_argument, NULL, 'X'},
+            {"ty", required_argument, NULL, 'Y'},
+
+            {"x0", required_argument, NULL, '1'},
+            {"y0", required_argument, NULL, '2'},
+            {"t0", required_argument, NULL, '3'},
+            {"nx", required_argument, NULL, '4'},
+            {"ny", required_argument, NULL, '5'},
+            {"nt", required_argument, NULL, '6'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        int opt = getopt_long (argc, argv, "tbsh", long_options, &option_index);
+
+        if (opt == -1) break;
+
+        switch (opt){
+            case 't': mode = TO_TILE; break;
+            case 'b': mode = TO_BIN;  break;
+            case 's': mode = INFO;    break;
+
+            case 'X': tx = atol(optarg); break;
+            case 'Y': ty = atol(optarg); break;
+
+            case '1': x0 = atol(optarg); break;
+            case '2': y0 = atol(optarg); break;
+            case '3': t0 = atol(optarg); break;
+            case '4': nx = atol(optarg); break;
+            case '5': ny = atol(optarg); break;
+            case '6': nt = atol(optarg); break;
+
+            case 'h':
+                fprintf(stderr, "Uso: %s " EXEC_MSG "\n" OPTS_MSG, argv[0], argv[0]);
+                return 1;
+
+            default:
+                fprintf(stderr, "Uso: %s " EXEC_MSG "\n", argv[0], argv[0]);
+                return ARG_ERR;
+        }
+    }
+
+    if (!mode || optind > argc - ((mode == INFO) ? 1 : 2) || !tx || !ty){
+        fprintf(stderr, "Uso: %s " EXEC_MSG "\n", argv[0], argv[0]);
+        return ARG_ERR;
+    }
+
+    strncpy(in_name, argv[optind++], STR_SIZE - 1);
+
+    if (mode == INFO)
+        return print_index(in_name);
+
+    strncpy(out_name, argv[optind++], STR_SIZE - 1);
+
+    if (mode == TO_TILE){
+        if (!(data = open_bin_ctl_tile(in_name, NULL))){
+            fprintf(stderr, "ERRO: não foi possível abrir %s.\n", in_name);
+            return ARQ_ERR;
+        }
+
+        if (!write_tile_files(data, out_name, "Dados em blocos", tx, ty)){
+            free_bin(data);
+            return ARQ_ERR;
+        }
+    }
+    else {
+        info_ctl info;
+        tile_index* index;
+
+        if (!open_ctl(&info, in_name) || !(index = open_tile_index(info.bin_filename, info.x.def, info.y.def, info.tdef))){
+            fprintf(stderr, "ERRO: não foi possível abrir %s.\n", in_name);
+            return ARQ_ERR;
+        }
+
+        if (!nx) nx = index->x - x0;
+        if (!ny) ny = index->y - y0;
+        if (!nt) nt = index->t - t0;
+
+        // apenas os blocos que cruzam a região são lidos
+        data = open_tile_region(index, &info, x0, y0, t0, nx, ny, nt);
+        free_tile_index(index);
+
+        if (!data) return ARQ_ERR;
+
+        if (!write_files(data, out_name, "Dados convertidos")){
+            free_bin(data);
+            return ARQ_ERR;
+        }
+    }
+
+    printf("Saída: %s\n", data->info.bin_filename);
+
+    free_bin(data);
+    return 0;
+}
@@ -12,6 +12,8 @@ Lucas Nogueira 2024
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <omp.h>        //mult thread
+#include <getopt.h>     //getopt
 #include <string.h>     //strncpy
 #include "c_ctl.h"
 #include "geodist.h"
@@ -42,8 +44,25 @@ Lucas Nogueira 2024
 #define MIN_NGAUGE      1                           //Quantidade minima de estações (gauges) permitidas ao usar arquivo 'ngauge'
 #endif
 #ifndef POINTS_QT
-#define POINTS_QT       100000
+#define POINTS_QT       100000                      //Quantidade padrão de pontos testados
 #endif
+#ifndef MAX_ATTEMPTS
+#define MAX_ATTEMPTS    100                         //Tentativas de sorteio por ponto antes de desistir
+#endif
+
+
+#define EXEC_MSG "[OPÇÕES] primario.ctl secundario.ctl saida"
+#define HELP_MSG "Use '-h' para ajuda."
+#define OPTS_MSG "OPÇÕES"\
+    "\n\t-n, --points N\tQuantidade de pontos testados (padrão " STR(POINTS_QT) ")."\
+    "\n\t-s, --seed N\tSemente dos pontos sorteados (padrão: relógio)."\
+    "\n\t--major R\tRaio maior de busca em km (padrão " STR(MAJOR_RADIUS) ")."\
+    "\n\t--minor R\tRaio menor em km (padrão " STR(MINOR_RADIUS) ")."\
+    "\n\t-a, --avg\tInterpolação por média simples."\
+    "\n\t-i, --idw\tInterpolação Inverse Distance Weighting."\
+    "\n\t-m, --msh\tInterpolação Modified Shepard (padrão)."\
+    "\n\t-N, --none\tApenas o valor do dado secundário."\
+    "\n\nA saída 'saida.csv' tem uma linha por ponto testado (x, y, t, lon, lat, real, previsto, erro)."
 
 
 
@@ -53,16 +72,30 @@ typedef struct struct_idx3{
     size_t z;
 } idx3;
 
+// Resultado de um ponto testado (tabela esparsa: apenas os pontos sorteados)
+typedef struct struct_point_result{
+    idx3 pos;               // posição no dado primário
+    datatype real;          // valor retirado do primário
+    datatype predicted;     // valor interpolado (undef se não houve interpolação)
+} point_result;
+
+/* Sorteia 'qt' quadrículas definidas de 'ref_data'
+ * Retorna o vetor de posições ou NULL em erro
+**/
 idx3* sel_rand_points(binary_data* ref_data, size_t qt);
-datatype metric(datatype obs,datatype predicted);
 
 
-/* Função principal do programa, junta dados de 'p' (primario) e 's' (secundario)
- * preferencia para dados de 'p' delimitados pelo quadrado xi a xf e yi a yf
- * dados faltantes de 'p' são completados com valores de 's'
- * para cada valor 's' é feita cum calculo dependendo da função de interpolação escolhida
+/* Função principal do programa: para cada ponto de 'points' o valor de 'p' (primário)
+ * é retirado e interpolado a partir de 's' (secundário) e dos vizinhos em 'p'.
+ * Os pontos são independentes e avaliados em paralelo, sem alocar a grade de saída.
+ * Retorna a tabela com um resultado por ponto ou NULL em erro
+**/
+point_result* verify_data (binary_data* p, binary_data* s, idx3* points, size_t qt);
+
+/* Escreve a tabela de resultados 'results' no arquivo csv 'name'
+ * Retorna 1 em sucesso ou 0 em erro
 **/
-binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordtype xf, coordtype yi, coordtype yf, idx3* points);
+int write_point_table(binary_data* p, point_result* results, size_t qt, char* name);
 
 
 /* Calcula a distancia entre quadriculas para latitudes diferentes.
@@ -96,24 +129,28 @@ int perro_com (int err_cod, const char* comment);
 
 
 /*= FUNÇÕES DE INTERPOLAÇÃO =*/
+/* As funções recebem a posição (x,y,t) na grade de 'ref' e retornam o valor
+ * interpolado, ou 'ref->info.undef' se não houve interpolação.
+ * Apenas leem os dados, então podem ser chamadas em paralelo.
+**/
 
 /* Método mais simples, utilizado nas primeiras versões do programa.
  * Quadrícula resultante é a média simples entre valor da quadrícula do dado secundário
  * com as quadrículas adjacentes do dado primário
 **/
-int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t);
+datatype average_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t);
 
 /* Inverse Distance Weighting (IDW)
 **/
-int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t);
+datatype idweight_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t);
 
 /* Modified Shepard
 **/
-int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t);
+datatype mshepard_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t);
 
 /* Nenhuma
  * */
-int none_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t);
+datatype none_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t);
 
 /* Mais informações:
  * https://en.wikipedia.org/wiki/Inverse_distance_weighting
@@ -135,7 +172,7 @@ coordtype inverse_value(double value)   {return 1/(coordtype)value;}
 // for not all global variables are an evil.
 
 // armazena a função que será usada na interpolação
-int (*interpolation) (binary_data*,binary_data*,binary_data*,int,int,int);
+datatype (*interpolation) (binary_data*,binary_data*,binary_data*,int,int,int);
 
 // armazena a função de distancia
 double (*dist) (double, double, double, double);
@@ -149,7 +186,9 @@ coordtype** g_dist_matrix;
 // altura da quadrícula
 coordtype g_height;
 
-int g_debug = 0;
+// raios de busca (km) do Modified Shepard
+double g_major_radius = MAJOR_RADIUS;
+double g_minor_radius = MINOR_RADIUS;
 
 /* ======================= */
 
@@ -158,42 +197,75 @@ int main(int argc, char *argv[]) {
 
     binary_data* pri_bin = NULL;
     binary_data* sec_bin = NULL;
-    binary_data* out_bin = NULL;
 
     char pri_name[STR_SIZE] = {'\0'};
     char sec_name[STR_SIZE] = {'\0'};
     char out_name[STR_SIZE] = {'\0'};
 
-    //coordenadas da america do sul
-    coordtype xi = -89.5f,
-        xf = -31.5f,
-        yi = -56.5f,
-        yf = 14.5f;
+    size_t qt = POINTS_QT;
+    unsigned int seed = time(NULL);
 
-    //if (argc < 4){
-    if (argc < 4){
-        fprintf(stderr,"Uso: %s primario.ctl secundario.ctl\n",argv[0]);
-        return 1;
-    }
-    else{
-        strncpy(pri_name,argv[1],STR_SIZE-1);
-        pri_name[STR_SIZE-1]='\0';
-
-        strncpy(sec_name,argv[2],STR_SIZE-1);
-        sec_name[STR_SIZE-1]='\0';
+    // por padrão usa a interpolação Modified Shepard
+    interpolation = mshepard_interpolation;
 
-        strncpy(out_name,argv[3],STR_SIZE-1);
-        out_name[STR_SIZE-1]='\0';
+    while(1){
+        static struct option long_options[] =
+        {
+            {"help" , no_argument, NULL, 'h'},
+
+            {"avg"  , no_argument, NULL, 'a'},
+            {"idw"  , no_argument, NULL, 'i'},
+            {"msh"  , no_argument, NULL, 'm'},
+            {"none" , no_argument, NULL, 'N'},
+
+            {"points", required_argument, NULL, 'n'},
+            {"seed"  , required_argument, NULL, 's'},
+            {"major" , required_argument, NULL, 'R'},
+            {"minor" , required_argument, NULL, 'r'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        int opt = getopt_long (argc, argv, "aimNn:s:h", long_options, &option_index);
+
+        if (opt == -1) break;
+
+        switch (opt){
+            case 'a': interpolation = average_interpolation;  break;
+            case 'i': interpolation = idweight_interpolation; break;
+            case 'm': interpolation = mshepard_interpolation; break;
+            case 'N': interpolation = none_interpolation;     break;
+
+            case 'n': qt = atol(optarg);           break;
+            case 's': seed = atol(optarg);         break;
+            case 'R': g_major_radius = atof(optarg); break;
+            case 'r': g_minor_radius = atof(optarg); break;
+
+            case 'h':
+                fprintf(stderr,"Uso: %s " EXEC_MSG "\n" OPTS_MSG "\n", argv[0]);
+                return 1;
+
+            default:
+                fprintf(stderr,"Uso: %s " EXEC_MSG "\n", argv[0]);
+                return perro(ARG_ERR);
+        }
+    }
 
+    if (optind > (argc-3) || !qt || g_major_radius <= 0 || g_minor_radius < 0){
+        fprintf(stderr,"Uso: %s " EXEC_MSG "\n" HELP_MSG "\n", argv[0]);
+        return ARG_ERR;
     }
 
+    strncpy(pri_name,argv[optind++],STR_SIZE-1);
+    strncpy(sec_name,argv[optind++],STR_SIZE-1);
+    strncpy(out_name,argv[optind++],STR_SIZE-1);
+
 
     if (!(pri_bin = open_bin_ctl(pri_name))){
         fprintf(stderr,"ERRO: falha na alocação (%s).\n",pri_name);
         return 1;
     }
 
-    ;
     if (!(sec_bin = open_bin_ctl(sec_name))){
         free_bin(pri_bin);
         fprintf(stderr,"ERRO: falha na alocação (%s).\n",sec_name);
@@ -201,43 +273,43 @@ int main(int argc, char *argv[]) {
     }
 
     // funções adicionais
-    interpolation = mshepard_interpolation;
     dist = haversine_distance;
     weight = inverse_power_2;
 
-    srandom(time(NULL));
+    srandom(seed);
+    printf("Semente: %u\n", seed);
 
     idx3* points;
-    if(!(points = sel_rand_points(pri_bin,POINTS_QT))){
-        fprintf(stderr,"Alguma coisa ai deu ruim viu\n");
+    if(!(points = sel_rand_points(pri_bin,qt))){
+        free_bin(pri_bin);
+        free_bin(sec_bin);
+        fprintf(stderr,"ERRO: não foi possível sortear %lu pontos definidos em %s.\n",qt,pri_name);
         return 1;
     }
 
-    //junta os dois dados
-    out_bin = compose_data(pri_bin,sec_bin,xi,xf,yi,yf,points);
-
+    // avalia os pontos
+    point_result* results = verify_data(pri_bin,sec_bin,points,qt);
 
-    //erro ao ler arquivo
-    if (!out_bin){
+    if (!results){
         free_bin(pri_bin);
         free_bin(sec_bin);
+        free(points);
 
-        fprintf(stderr,"ERRO: falha na composição.\n");
+        fprintf(stderr,"ERRO: falha na verificação.\n");
         return 1;
     }
 
-
     //saida
-    write_files(out_bin,out_name);
+    int ret = write_point_table(pri_bin,results,qt,out_name) ? 0 : ARQ_ERR;
 
 
     free_bin(pri_bin);
     free_bin(sec_bin);
-    free_bin(out_bin);
+    free(results);
     free(points);
     free_dist_matrix(g_dist_matrix);
 
-    return 0;
+    return ret;
 }
 
 idx3* sel_rand_points(binary_data* ref_data, size_t qt){
@@ -251,30 +323,32 @@ idx3* sel_rand_points(binary_data* ref_data, size_t qt){
 
     size_t att = 0;
     for(size_t i = 0; i < qt;att++){
+
+        // grade (quase) sem dados
+        if (att > MAX_ATTEMPTS * qt){
+            free(idx_array);
+            return NULL;
+        }
+
         idx_array[i].x = random()%x_max;
         idx_array[i].y = random()%y_max;
         idx_array[i].z = random()%t_max;
 
         size_t pos = get_pos(&(ref_data->info),idx_array[i].x,idx_array[i].y,idx_array[i].z);
-        if(!EQ_FLOAT(ref_data->data[pos],ref_data->info.undef)) i++;
+        if(!EQ_FLOAT(get_pos_val(ref_data,pos),ref_data->info.undef)) i++;
     }
-    
-    printf("%d pontos de grade gerados após %lu tentatativas",POINTS_QT,att);
+
+    printf("%lu pontos de grade gerados após %lu tentativas\n",qt,att);
     return idx_array;
 }
 
 
-/* Junta dados de 'p' (primário) com 's' (secundário), dando preferencia para os
- * os dados primários. Quando não houver dado em 'p', faz uma interpolação em 's' com os
- * dados de 'p' que estão em volta. A operação apenas será realizada dentro da área
- * delimitada pelo quadrado com inicio em (xi,yi) e final em (xf,yf)
- * retorna uma estrutura com os dados já unificados
+/* Retira cada ponto de 'points' de 'p' (primário) e o interpola com 's' (secundário)
+ * e os vizinhos em 'p'. As posições são as da grade de 'p', que é usada como
+ * referência pelas funções de interpolação, então nenhuma grade é alocada.
+ * retorna a tabela com o valor real e o interpolado de cada ponto
 **/
-binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordtype xf, coordtype yi, coordtype yf, idx3* points){
-
-    info_ctl ctl;
-
-    binary_data* bin_data; //dado que será retornado pela função
+point_result* verify_data (binary_data* p, binary_data* s, idx3* points, size_t qt){
 
     if(p->info.ttype != s->info.ttype){
         fprintf(stderr,"ERRO: Arquivos não tem o mesmo tipo de dado.\n");
@@ -302,116 +376,112 @@ binary_data* compose_data (binary_data* p, binary_data* s, coordtype xi, coordty
         return NULL;
     }
 
-
-    // Garantindo que as coordenadas estão dentro do globo
-    xi = wrap_val(xi,MIN_X,MAX_X);
-    xf = wrap_val(xf,MIN_X,MAX_X);
-    yi = wrap_val(yi,MIN_Y,MAX_Y);
-    yf = wrap_val(yf,MIN_Y,MAX_Y);
-
-
-    // inicializa o ctl com valores da entrada primária
-    cp_ctl(&(ctl),&(p->info));
-
-    // ponto mais à esquerda
-    ctl.x.i = MIN(p->info.x.i,s->info.x.i);
-    ctl.y.i = MIN(p->info.y.i,s->info.y.i);
-    // ponto mais à direita
-    ctl.x.f = MAX(p->info.x.f, s->info.x.f);
-    ctl.y.f = MAX(p->info.y.f, s->info.y.f);
-    // quantidade de quadriculas entre o ponto inicial e o ponto final
-    ctl.x.def = (int)((ctl.x.f - ctl.x.i) / ctl.x.size);
-    ctl.y.def = (int)((ctl.y.f - ctl.y.i) / ctl.y.size);
-
-    // caso o dado secundário comece antes do primário
-    if(s->info.t_from_date_i < p->info.t_from_date_i){
-        cp_date_ctl(&ctl,&(s->info));
-    }
-
-
-    // final - inicial
-    ctl.tdef = MAX(p->info.t_from_date_i + p->info.tdef, s->info.t_from_date_i + s->info.tdef) - ctl.t_from_date_i;
-
-    // aloca a matriz de dados
-    bin_data = aloca_bin_fill(ctl.x.def,ctl.y.def,ctl.tdef,ctl.undef);
-
-    if(!bin_data->data){
-        perro_com(MEM_ERR,"Matriz de resultados");
+    point_result* results = malloc(sizeof(point_result) * qt);
+    if (!results){
+        perro_com(MEM_ERR,"Tabela de resultados");
         return NULL;
     }
 
-    // copia as dimensões obtidas para a estrutura de dados
-    cp_ctl(&(bin_data->info),&(ctl));
-
-
-    g_dist_matrix = calc_dist(&(bin_data->info),dist);
+    g_dist_matrix = calc_dist(&(p->info),dist);
     if (!g_dist_matrix){
+        free(results);
         perro_com(MEM_ERR,"Matriz de distâncias");
         return NULL;
     }
 
 
-    
-    double sum=0, sqr_sum=0;
-
-    // preenchendo dados
-    for (size_t i = 0; i < POINTS_QT; i++){
+    // acumuladores de cada thread, somados ao final do laço
+    double sum = 0, sqr_sum = 0;
+    size_t count = 0;
 
-        size_t x = get_equivalent_x(p,bin_data,points[i].x);
-        size_t y = get_equivalent_y(p,bin_data,points[i].y);
-        size_t t = get_equivalent_t(p,bin_data,points[i].z);
+    #pragma omp parallel for schedule(dynamic,256) reduction(+:sum,sqr_sum,count)
+    for (size_t i = 0; i < qt; i++){
+        int x = points[i].x;
+        int y = points[i].y;
+        int t = points[i].z;
 
+        results[i].pos = points[i];
+        results[i].real = get_pos_val(p, get_pos(&(p->info), x, y, t));
 
-        // Executa a função de interpolação
-        interpolation(bin_data,p,s,x,y,t);
-        
-        datatype real_val = p->data[get_pos(&(p->info), points[i].x, points[i].y, points[i].z)];
-        datatype predicted_val = bin_data->data[get_pos(&(bin_data->info),x,y,t)];
+        // o próprio ponto nunca é usado pela interpolação
+        results[i].predicted = interpolation(p,p,s,x,y,t);
 
-        // calc RMSE e |BIAS|
-        sum += fabs(predicted_val - real_val);
-        sqr_sum += (predicted_val - real_val)*(predicted_val - real_val);
+        if (!EQ_FLOAT(results[i].predicted, p->info.undef)){
+            double diff = results[i].predicted - results[i].real;
 
-        set_data_val(bin_data,x,y,t,metric(real_val,predicted_val));
+            // calc RMSE e |BIAS|
+            sum += fabs(diff);
+            sqr_sum += diff * diff;
+            count++;
+        }
     }
 
 
     // Resumo
     printf("\n==================\n");
-    printf("Tamanho da amostra: %d\n|BIAS|: %f\nRMSE: %f\n",POINTS_QT,sum/POINTS_QT,sqrt(sqr_sum/POINTS_QT));
+    printf("Tamanho da amostra: %lu\nInterpolados: %lu\n",qt,count);
+    if (count)
+        printf("|BIAS|: %f\nRMSE: %f\n",sum/count,sqrt(sqr_sum/count));
     printf("==================\n");
 
-    return bin_data;
+    return results;
 }
 
-datatype metric(datatype obs,datatype predicted){
-    //return fabs(predicted-obs)/obs;
-    return (EQ_FLOAT(0,obs)) ? (predicted-obs)/(double)obs : 0;
+int write_point_table(binary_data* p, point_result* results, size_t qt, char* name){
+    char file_name[STR_SIZE + 4];
+    FILE* table;
+
+    snprintf(file_name, sizeof(file_name), "%s.csv", name);
+
+    if (!(table = fopen(file_name, "w"))){
+        perro_com(ARQ_ERR, file_name);
+        return 0;
+    }
+
+    fprintf(table, "x, y, t, lon, lat, real, previsto, erro\n");
+    for (size_t i = 0; i < qt; i++){
+        point_result* r = &(results[i]);
+        int interpolated = !EQ_FLOAT(r->predicted, p->info.undef);
+
+        fprintf(table, "%lu, %lu, %lu, %f, %f, %f, ", r->pos.x, r->pos.y, r->pos.z,
+                p->info.x.i + r->pos.x * p->info.x.size,
+                p->info.y.i + r->pos.y * p->info.y.size,
+                r->real);
+
+        // pontos não interpolados ficam sem previsão
+        if (interpolated)
+            fprintf(table, "%f, %f\n", r->predicted, r->predicted - r->real);
+        else
+            fprintf(table, ", \n");
+    }
+
+    fclose(table);
+    printf("Saída: %s\n", file_name);
+    return 1;
 }
 
 
 /*
  * Interpolação simples utilizando a média das quadriculas adjacentes
- * Retorna 1 se ocorreu interpolação, retorna 0 caso contrário
+ * Retorna o valor interpolado ou undef se não ocorreu interpolação
 **/
-int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t){
+datatype average_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t){
 
-    // copia o dado secundário 's_src' no ponto (x,y,t)
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    // valor do dado secundário 's_src' no ponto (x,y,t)
+    datatype val = get_data_val(ref,s_src,x,y,t);
 
-    if(!EQ_FLOAT(val,dest->info.undef)){
+    if(!EQ_FLOAT(val,s_src->info.undef)){
 
         datatype sum = 0;
         int qt = 1;
 
-        // somatório com valores adjacentes de 'p_src'
+        // somatório com valores adjacentes de 'p_src' (sem a própria quadrícula)
         for(int i = -1; i <= 1; i++){
             for(int j = -1; j <= 1; j++){
 
+                datatype new_val = get_data_val(ref, p_src, x+i, y+j, t);
 
-                datatype new_val = get_data_val(dest, p_src, x+i, y+j, t);
-
-                if(!EQ_FLOAT(new_val,p_src->info.undef)){
+                if(!EQ_FLOAT(new_val,p_src->info.undef) && !(i == 0 && j == 0)){
                     sum += new_val;
                     qt++;
                 }
@@ -419,25 +489,15 @@ int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_
         }
 
         if ( qt > 1){
-            //// se a quadricula do dado secundário não tem estações suficiente
-            //if ( ngauge && (get_data_val(dest,ngauge,x,y,t)  < MIN_NGAUGE)){
-
-            //    // valor do dado secundário não será adicionado à soma
-            //    val = 0;
-            //    qt--;
-            //}
-
             // soma o valor do dado secundário com os valores do primário
             sum += val;
 
             // valor final é a média dos valores
-            set_data_val(dest,x,y,t, sum / (datatype)qt);
-
-            return 1;
+            return sum / (datatype)qt;
         }
     }
 
-    return 0;
+    return ref->info.undef;
 }
 
 
@@ -446,12 +506,12 @@ int average_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_
  * utilizamos um peso inverso à distância, ou seja
  * quadrículas na diagonal tem peso menor que quadrículas diretamente do lado
  * */
-int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t){
+datatype idweight_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t){
 
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    datatype val = get_data_val(ref,s_src,x,y,t);
 
     // se o houver um valor na quadrícula
-    if(!EQ_FLOAT(val,dest->info.undef)){
+    if(!EQ_FLOAT(val,s_src->info.undef)){
 
         // acumuladores (somatório) & valor mínimo
         datatype    sum = 0;
@@ -462,7 +522,7 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
         for(int i = -1; i <= 1; i++){
             for(int j = -1; j <= 1; j++){
 
-                datatype neighbor = get_data_val(dest, p_src, x + i, y + j, t);
+                datatype neighbor = get_data_val(ref, p_src, x + i, y + j, t);
                 coordtype w = 0;
 
                 // queremos o peso apenas se o valor da quadricula não for indefinido
@@ -483,23 +543,15 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 
         if ( sum > 0){
 
-            //// se a quadricula do dado secundário não tem estações suficiente
-            //// não iremos usar esse valor na conta
-            //if ( ngauge && (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE)) min_w = 0;
-
-
             // adicionamos o valor secundário com o menor peso encontrado
             sum += val * min_w;
             w_sum += min_w;
 
-            set_data_val(dest,x,y,t, sum / w_sum);
-
-            // retorna 1 apenas se o valor foi modificado
-            return 1;
+            return sum / w_sum;
         }
     }
 
-    return 0;
+    return ref->info.undef;
 }
 
 
@@ -507,46 +559,46 @@ int idweight_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 /* Tendo um raio maximo de busca, encontra as quadrículas ao redor
  * e faz uma função que da peso maior para as quadrículas mais próximas
  * */
-int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t){
+datatype mshepard_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t){
 
-    datatype val = cp_data_val(dest,s_src,x,y,t);
+    datatype val = get_data_val(ref,s_src,x,y,t);
 
     // se o houver um valor na quadrícula
-    if(!EQ_FLOAT(val,dest->info.undef)){
+    if(!EQ_FLOAT(val,s_src->info.undef)){
 
         // acumuladores (somatório)
         datatype    sum = 0;
         coordtype w_sum = 0;
 
         // lon e lat da quadrícula
-        coordtype lon  = dest->info.x.i + x*dest->info.x.size;
-        coordtype lat  = dest->info.y.i + y*dest->info.y.size;
+        coordtype lon  = ref->info.x.i + x*ref->info.x.size;
+        coordtype lat  = ref->info.y.i + y*ref->info.y.size;
 
 
         // RADIUS/width
-        int steps = (int) (MAJOR_RADIUS/dist(0,lat,dest->info.x.size,lat));
+        int steps = (int) (g_major_radius/dist(0,lat,ref->info.x.size,lat));
         int qt = 1;
 
         // buscamos nas quadrículas adjacentes
         for(int i = -steps; i <= steps; i++){
             for(int j = -steps; j <= steps; j++){
 
-                datatype neighbor = get_data_val(dest, p_src, x + i, y + j, t);
+                datatype neighbor = get_data_val(ref, p_src, x + i, y + j, t);
 
                 // queremos o peso apenas se o valor da quadricula não for indefinido
                 // e se não for a própria quadricula
                 if(!EQ_FLOAT(neighbor, p_src->info.undef) && !(i == 0 && j == 0)){
 
-                    double d = dist(lon, lat, lon + i*dest->info.x.size, lat + j*dest->info.y.size);
-                    if (d < MAJOR_RADIUS){
+                    double d = dist(lon, lat, lon + i*ref->info.x.size, lat + j*ref->info.y.size);
+                    if (d < g_major_radius){
 
-                        double w = pow((MAJOR_RADIUS - d)/(MAJOR_RADIUS*d), BETA);
+                        double w = pow((g_major_radius - d)/(g_major_radius*d), BETA);
 
                         // somatório dos valores e dos pesos
                         sum += neighbor * w;
                         w_sum += w;
 
-                        if (d < MINOR_RADIUS) qt++;
+                        if (d < g_minor_radius) qt++;
                     }
                 }
             }
@@ -556,34 +608,18 @@ int mshepard_interpolation(binary_data* dest, binary_data* p_src, binary_data* s
 
             double w = 1/(double)qt;
 
-
-            //// Se houver pelo menos outras MIN_GRIDPOINTS quadrículas
-            //// além do dado secundário, testamos se foi
-            //// passado o arquivo de numgauge
-            //if ( (qt > MIN_GRIDPOINTS) && ngauge ){
-
-            //    // se a quadricula do dado secundário não tem estações suficiente
-            //    if (get_data_val(dest,ngauge,x,y,t) < MIN_NGAUGE){
-
-            //        // valor do dado secundário não será adicionado à soma
-            //        w = 0;
-            //    }
-            //}
-
             //((sum / w_sum)*qt + val)/qt
-            set_data_val(dest,x,y,t,(sum / w_sum)*(1-w) + val*w);
-
-            return 1;
+            return (sum / w_sum)*(1-w) + val*w;
         }
     }
 
-    return 0;
+    return ref->info.undef;
 }
 
 
-int none_interpolation(binary_data* dest, binary_data* p_src, binary_data* s_src, int x, int y, int t){
-    cp_data_val(dest,s_src,x,y,t);
-    return 0;
+datatype none_interpolation(binary_data* ref, binary_data* p_src, binary_data* s_src, int x, int y, int t){
+    datatype val = get_data_val(ref,s_src,x,y,t);
+    return EQ_FLOAT(val,s_src->info.undef) ? ref->info.undef : val;
 }
 
 
@@ -9,15 +9,19 @@ percentages = []
 rmse_avg = []
 rmse_idw = []
 rmse_msh = []
+rmse_okr = []
 mae_avg = []
 mae_idw = []
 mae_msh = []
+mae_okr = []
 perror_avg = []
 perror_idw = []
 perror_msh = []
+perror_okr = []
 mse_avg = []
 mse_idw = []
 mse_msh = []
+mse_okr = []
 
 with open(file_path, 'r') as file:
     reader = csv.DictReader(file)
@@ -48,21 +52,30 @@ with open(file_path, 'r') as file:
             mae_msh.append(mae)
             perror_msh.append(perror)
             mse_msh.append(mse)
+        elif method == '--okr':
+            rmse_okr.append(rmse)
+            mae_okr.append(mae)
+            perror_okr.append(perror)
+            mse_okr.append(mse)
 
 # Debugging: Print the collected data
 print("Percentages:", percentages)
 print("RMSE Avg:", rmse_avg)
 print("RMSE IDW:", rmse_idw)
 print("RMSE MSH:", rmse_msh)
+print("RMSE OKR:", rmse_okr)
 print("MAE Avg:", mae_avg)
 print("MAE IDW:", mae_idw)
 print("MAE MSH:", mae_msh)
+print("MAE OKR:", mae_okr)
 print("PERROR Avg:", perror_avg)
 print("PERROR IDW:", perror_idw)
 print("PERROR MSH:", perror_msh)
+print("PERROR OKR:", perror_okr)
 print("MSE Avg:", mse_avg)
 print("MSE IDW:", mse_idw)
 print("MSE MSH:", mse_msh)
+print("MSE OKR:", mse_okr)
 
 # Plotting
 plt.figure(figsize=(10, 12))
@@ -72,6 +85,7 @@ plt.subplot(4, 1, 1)
 plt.plot(percentages, rmse_avg, label='--avg (RMSE)', marker='o')
 plt.plot(percentages, rmse_idw, label='--idw (RMSE)', marker='o')
 plt.plot(percentages, rmse_msh, label='--msh (RMSE)', marker='o')
+plt.plot(percentages, rmse_okr, label='--okr (RMSE)', marker='o')
 plt.ylabel('RMSE')
 plt.title('RMSE, MAE, PERROR, and MSE Comparison between Methods')
 plt.legend()
@@ -81,6 +95,7 @@ plt.subplot(4, 1, 2)
 plt.plot(percentages, mae_avg, label='--avg (MAE)', marker='o')
 plt.plot(percentages, mae_idw, label='--idw (MAE)', marker='o')
 plt.plot(percentages, mae_msh, label='--msh (MAE)', marker='o')
+plt.plot(percentages, mae_okr, label='--okr (MAE)', marker='o')
 plt.ylabel('MAE')
 plt.legend()
 
@@ -89,6 +104,7 @@ plt.subplot(4, 1, 3)
 plt.plot(percentages, perror_avg, label='--avg (PERROR)', marker='o')
 plt.plot(percentages, perror_idw, label='--idw (PERROR)', marker='o')
 plt.plot(percentages, perror_msh, label='--msh (PERROR)', marker='o')
+plt.plot(percentages, perror_okr, label='--okr (PERROR)', marker='o')
 plt.ylabel('PERROR')
 plt.legend()
 
@@ -97,6 +113,7 @@ plt.subplot(4, 1, 4)
 plt.plot(percentages, mse_avg, label='--avg (MSE)', marker='o')
 plt.plot(percentages, mse_idw, label='--idw (MSE)', marker='o')
 plt.plot(percentages, mse_msh, label='--msh (MSE)', marker='o')
+plt.plot(percentages, mse_okr, label='--okr (MSE)', marker='o')
 plt.xlabel('Percentage')
 plt.ylabel('MSE')
 plt.legend()
@@ -18,8 +18,20 @@ typedef struct {
     int help;
     int runs;
     int print_csv;
+    int error_maps;
+    float threshold;    // CI half-width that stops the runs (0 = always do all runs)
+    int stop_metric;    // METRIC_* checked against the threshold
+    int bootstrap;      // bootstrap resamples for the CI (0 = Student's t)
+    int quantiles;
+    int columns;        // hold out whole (x,y) columns instead of single points
 } Arguments;
 
+// Runs always done before early stopping is considered
+#define MIN_RUNS 5
+
+// Held-out columns passed to compose with --cells
+#define COLUMNS_FILE "columns.txt"
+
 void show_help() {
     printf("Usage: MIE -f [Original] [Interpolated] [OPTIONS]\n");
     printf("Options:\n");
@@ -29,14 +41,29 @@ void show_help() {
     printf("  -p [%%]                       | Percentage for training (default: 2%%)\n");
     printf("  -r [Runs]                    | Number of runs (default: 1)\n");
     printf("  -c                           | Print results in CSV format\n");
+    printf("  -e                           | Write per-cell error maps (.ctl/.bin) and per-timestep errors (.csv)\n");
+    printf("  -t [Threshold]               | Stop once the 95%% CI half-width of the metric is below this (max: -r runs)\n");
+    printf("  -m [Metric]                  | Metric for -t: rmse, mae, mse or perror (default: rmse)\n");
+    printf("  -b [Resamples]               | Bootstrap CI with this many resamples (default: Student's t CI)\n");
+    printf("  -q                           | Write error quantiles (P50/P90/P99) and log-binned histograms (.csv)\n");
+    printf("  -w                           | Hold out whole stations: %% of the (x,y) columns, at every timestep\n");
+    printf("  --print-isa                  | Show the variant of the vectorized kernels selected for this CPU\n");
 }
 
 Arguments parse_arguments(int argc, char *argv[]) {
     srand(time(NULL));
-    Arguments args = {NULL, NULL, rand(), 2.0, 0, 1, 0};
+    Arguments args = {NULL, NULL, rand(), 2.0, 0, 1, 0, 0, 0.0, METRIC_RMSE, 0, 0, 0};
+
+    // Long option outside getopt: only reports the variant and exits
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--print-isa")) {
+            printf("%s\n", isa_variant());
+            exit(0);
+        }
+    }
 
     int opt;
-    while ((opt = getopt(argc, argv, "hf:s:p:r:c")) != -1) {
+    while ((opt = getopt(argc, argv, "hf:s:p:r:cet:m:b:qw")) != -1) {
         switch (opt) {
             case 'h':
                 args.help = 1;
@@ -58,6 +85,28 @@ Arguments parse_arguments(int argc, char *argv[]) {
             case 'c':
                 args.print_csv = 1;
                 break;
+            case 'e':
+                args.error_maps = 1;
+                break;
+            case 't':
+                args.threshold = atof(optarg);
+                break;
+            case 'm':
+                args.stop_metric = metric_from_name(optarg);
+                if (args.stop_metric < 0) {
+                    fprintf(stderr, "Error: unknown metric %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'b':
+                args.bootstrap = atoi(optarg);
+                break;
+            case 'q':
+                args.quantiles = 1;
+                break;
+            case 'w':
+                args.columns = 1;
+                break;
             default:
                 fprintf(stderr, "Error: invalid option\n");
                 show_help();
@@ -98,17 +147,146 @@ void free_resources(binary_data *original_bin_data, binary_data *interpolated_bi
     if (metrics_file) fclose(metrics_file);
 }
 
-void calculate_and_log_metrics(FILE *metrics_file, binary_data *original_bin_data, binary_data *final_bin_data, long int *train_data_points, long int n_train, int run, float *total_rmse, float *total_mae, float *total_mse, float *total_percentage_error) {
-    float rmsev = rmse(original_bin_data, final_bin_data, train_data_points, n_train);
-    float maev = mae(original_bin_data, final_bin_data, train_data_points, n_train);
-    float msev = mse(original_bin_data, final_bin_data, train_data_points, n_train);
-    float percentage_errorv = percentage_error(original_bin_data, final_bin_data, train_data_points, n_train);
-
-    fprintf(metrics_file, "%d, %f, %f, %f, %f\n", run + 1, rmsev, maev, msev, percentage_errorv);
-    *total_rmse += rmsev;
-    *total_mae += maev;
-    *total_mse += msev;
-    *total_percentage_error += percentage_errorv;
+// Returns 0 if the metrics could not be calculated (allocation error)
+int calculate_and_log_metrics(FILE *metrics_file, binary_data *original_bin_data, binary_data *final_bin_data, long int *train_data_points, long int n_train, int run, MetricStats *stats, double *run_values, ErrorMaps *maps, ErrorSketch *sketch) {
+    ErrorMetrics metrics = calculate_all_errors(original_bin_data, final_bin_data, train_data_points, n_train, maps, sketch);
+    if (metrics.count < 0) {
+        fprintf(stderr, "Error: could not allocate memory for the error metrics\n");
+        return 0;
+    }
+
+    fprintf(metrics_file, "%d, %f, %f, %f, %f\n", run + 1, metrics.rmse, metrics.mae, metrics.mse, metrics.percentage_error);
+    metric_stats_add(stats, &metrics);
+    for (int k = 0; k < N_METRICS; k++) {
+        run_values[run * N_METRICS + k] = metric_value(&metrics, k);
+    }
+    return 1;
+}
+
+// Holds out n_pick random columns of 'columns' (cells with data at some timestep): writes their
+// lon/lat to COLUMNS_FILE and stores every defined point of them, in increasing order, in 'points'.
+// Returns the number of points, or -1 if the file can not be written.
+long int hold_out_columns(binary_data *original, long int *columns, long int n_columns, long int n_pick, long int *points) {
+    size_t n_xy = original->info.x.def * original->info.y.def;
+
+    // partial Fisher-Yates: the first n_pick entries become the sample
+    for (long int i = 0; i < n_pick; i++) {
+        long int r = i + rand() % (n_columns - i);
+        long int tmp = columns[i];
+        columns[i] = columns[r];
+        columns[r] = tmp;
+    }
+    qsort(columns, n_pick, sizeof(long int), compare_points);
+
+    FILE *cells = fopen(COLUMNS_FILE, "w");
+    if (!cells) return -1;
+    for (long int i = 0; i < n_pick; i++) {
+        fprintf(cells, "%f %f\n",
+                original->info.x.i + (columns[i] % original->info.x.def) * original->info.x.size,
+                original->info.y.i + (columns[i] / original->info.x.def) * original->info.y.size);
+    }
+    fclose(cells);
+
+    long int n = 0;
+    for (size_t t = 0; t < original->info.tdef; t++) {
+        for (long int i = 0; i < n_pick; i++) {
+            if (is_valid(original, t, columns[i])) points[n++] = t * n_xy + columns[i];
+        }
+    }
+    return n;
+}
+
+// 95% CI half-width of metric k over the runs done so far (bootstrap if requested)
+double ci_half_width(Arguments *args, MetricStats *stats, double *run_values, int k, unsigned long long *bootstrap_state) {
+    if (!args->bootstrap) return metric_stats_ci(stats, k);
+
+    double values[stats->n];
+    for (long int run = 0; run < stats->n; run++) {
+        values[run] = run_values[run * N_METRICS + k];
+    }
+    return bootstrap_ci(values, stats->n, args->bootstrap, bootstrap_state);
+}
+
+// Writes the per-cell maps as a single-time GrADS file with the variables count, bias, rmse and mae.
+// Cells never held out are undef.
+int write_error_maps(ErrorMaps *maps, info_ctl *original_info, char *name) {
+    size_t n_cells = maps->n_cells;
+    binary_data *map_data = aloca_bin(original_info->x.def, original_info->y.def, 4);
+    if (!map_data) return 0;
+
+    cp_ctl(&map_data->info, original_info);
+    datatype undef = map_data->info.undef;
+
+    for (size_t c = 0; c < n_cells; c++) {
+        unsigned int count = maps->cell_count[c];
+        map_data->data[c] = count;
+        map_data->data[n_cells + c] = count ? maps->cell_bias[c] / count : undef;
+        map_data->data[2 * n_cells + c] = count ? sqrt(maps->cell_squared[c] / count) : undef;
+        map_data->data[3 * n_cells + c] = count ? maps->cell_absolute[c] / count : undef;
+    }
+
+    char name_bin[STR_SIZE], name_ctl[STR_SIZE];
+    snprintf(name_bin, STR_SIZE, "%s.bin", name);
+    snprintf(name_ctl, STR_SIZE, "%s.ctl", name);
+    strcpy(map_data->info.bin_filename, name_bin);
+
+    // the four variables are stored one after the other, like four timesteps
+    map_data->info.tdef = 4;
+    int ok = write_bin(map_data);
+
+    map_data->info.tdef = 1;
+    snprintf(map_data->info.dump, BUFF_SIZE,
+             "vars 4\n"
+             "count 0 99 times the cell was held out\n"
+             "bias 0 99 mean error (predicted - original)\n"
+             "rmse 0 99 root mean squared error\n"
+             "mae 0 99 mean absolute error\n"
+             "endvars\n");
+    ok = ok && write_ctl(&map_data->info, name_ctl, "MIE error maps");
+
+    free_bin(map_data);
+    return ok;
+}
+
+// Writes one line per timestep with the error statistics of the points held out at that time.
+int write_error_table(ErrorMaps *maps, char *filename) {
+    FILE *table = fopen(filename, "w");
+    if (!table) return 0;
+
+    fprintf(table, "t, count, bias, RMSE, MAE\n");
+    for (size_t t = 0; t < maps->n_times; t++) {
+        unsigned int count = maps->time_count[t];
+        if (count)
+            fprintf(table, "%lu, %u, %f, %f, %f\n", t + 1, count, maps->time_bias[t] / count, sqrt(maps->time_squared[t] / count), maps->time_absolute[t] / count);
+        else
+            fprintf(table, "%lu, 0, , , \n", t + 1);
+    }
+
+    fclose(table);
+    return 1;
+}
+
+// Writes the P50/P90/P99 of the absolute and relative errors summarized by 'sketch' as one CSV line.
+void write_quantiles(FILE *quantiles_file, const char *label, ErrorSketch *sketch) {
+    fprintf(quantiles_file, "%s, %f, %f, %f, %f, %f, %f\n", label,
+            tdigest_quantile(&sketch->absolute, 0.50), tdigest_quantile(&sketch->absolute, 0.90), tdigest_quantile(&sketch->absolute, 0.99),
+            tdigest_quantile(&sketch->relative, 0.50), tdigest_quantile(&sketch->relative, 0.90), tdigest_quantile(&sketch->relative, 0.99));
+}
+
+// Writes the log-binned histograms of the absolute and relative errors summarized by 'sketch'.
+int write_histogram(ErrorSketch *sketch, char *filename) {
+    FILE *hist_file = fopen(filename, "w");
+    if (!hist_file) return 0;
+
+    fprintf(hist_file, "low, high, absolute, relative\n");
+    for (int b = 0; b < HIST_BINS; b++) {
+        double low, high;
+        hist_bin_edges(b, &low, &high);
+        fprintf(hist_file, "%g, %g, %llu, %llu\n", low, high, sketch->absolute_hist.count[b], sketch->relative_hist.count[b]);
+    }
+
+    fclose(hist_file);
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
@@ -131,17 +309,56 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    char *methods[] = {"--avg", "--idw", "--msh"};
+    // the original is copied into the intermediary grid with memcpy and indexed directly: a sparse one is expanded once
+    if (!bin_to_dense(original_bin_data)) {
+        fprintf(stderr, "Error: could not allocate memory\n");
+        exit(1);
+    }
+
+    char *methods[] = {"--avg", "--idw", "--msh", "--okr"};
     int num_methods = sizeof(methods) / sizeof(methods[0]);
     clock_t start, end;
 
-    long int n_data_points = original_bin_data->info.tdef * original_bin_data->info.x.def * original_bin_data->info.y.def;
-    long int n = 0;
-    for (int i = 0; i < n_data_points; i++) {
-        if (original_bin_data->data[i] != original_bin_data->info.undef) n++;
+    // validity bitmap of the original, built once: counts, column scans and sampling read its bits
+    if (!build_valid(original_bin_data)) {
+        fprintf(stderr, "Error: could not allocate memory\n");
+        exit(1);
     }
+
+    long int n_data_points = original_bin_data->info.tdef * original_bin_data->info.x.def * original_bin_data->info.y.def;
+    long int n = count_valid(original_bin_data);
     long int n_train = n * (args.percentage / 100.0);
 
+    // station hold-out: the percentage applies to the columns that have data
+    size_t n_xy = original_bin_data->info.x.def * original_bin_data->info.y.def;
+    long int *columns = NULL, n_columns = 0, n_pick = 0;
+    if (args.columns) {
+        columns = malloc(n_xy * sizeof(long int));
+        if (!columns) {
+            fprintf(stderr, "Error: could not allocate memory\n");
+            exit(1);
+        }
+
+        // a column has data if its bit is set at any timestep: OR the bitmap words over time
+        size_t words = valid_words(&original_bin_data->info);
+        for (size_t w = 0; w < words; w++) {
+            uint64_t any = 0;
+            for (size_t t = 0; t < original_bin_data->info.tdef; t++) {
+                any |= original_bin_data->valid[t * words + w];
+            }
+            for (; any; any &= any - 1) {
+                columns[n_columns++] = w * 64 + __builtin_ctzll(any);
+            }
+        }
+
+        n_pick = n_columns * (args.percentage / 100.0);
+        if (n_pick < 1) n_pick = 1;
+        if (n_pick > n_columns) n_pick = n_columns;
+
+        // the points of the held-out columns are only known at each run
+        n_train = n;
+    }
+
     long int *train_data_points = malloc(n_train * sizeof(long int));
     bool *selected = calloc(n_data_points, sizeof(bool));
 
@@ -151,6 +368,33 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    // per-run metrics, kept for the bootstrap CI
+    double *run_values = malloc((size_t)args.runs * N_METRICS * sizeof(double));
+    unsigned long long bootstrap_state = 0x9E3779B97F4A7C15ULL ^ (unsigned long long)args.seed;
+    if (!run_values) {
+        fprintf(stderr, "Error: could not allocate memory\n");
+        free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, NULL, NULL);
+        exit(1);
+    }
+
+    // run_sketch holds the errors of one run, method_sketch of all runs of a method
+    ErrorSketch *run_sketch = NULL, *method_sketch = NULL;
+    if (args.quantiles && (!(run_sketch = alloc_error_sketch()) || !(method_sketch = alloc_error_sketch()))) {
+        fprintf(stderr, "Error: could not allocate memory\n");
+        free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, NULL, NULL);
+        exit(1);
+    }
+
+    ErrorMaps *maps = NULL;
+    if (args.error_maps) {
+        maps = alloc_error_maps(original_bin_data->info.x.def * original_bin_data->info.y.def, original_bin_data->info.tdef);
+        if (!maps) {
+            fprintf(stderr, "Error: could not allocate memory\n");
+            free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, NULL, NULL);
+            exit(1);
+        }
+    }
+
     start = clock(); // Start the clock before the loop
 
     for (int method_idx = 0; method_idx < num_methods; method_idx++) {
@@ -179,21 +423,51 @@ int main(int argc, char *argv[]) {
         }
         fprintf(metrics_file, "run, RMSE, MAE, MSE, PERROR\n");
 
-        float total_rmse = 0.0, total_mae = 0.0, total_mse = 0.0, total_percentage_error = 0.0;
+        MetricStats stats;
+        metric_stats_init(&stats);
+
+        FILE *quantiles_file = NULL;
+        if (args.quantiles) {
+            char quantiles_filename[100];
+            sprintf(quantiles_filename, "quantiles_%.2f%%_%d_runs_%s.csv", args.percentage, args.runs, method);
+            quantiles_file = fopen(quantiles_filename, "w");
+            if (!quantiles_file) {
+                fprintf(stderr, "Error: unable to create quantiles file\n");
+                free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, csv_file, metrics_file);
+                exit(1);
+            }
+            fprintf(quantiles_file, "run, ABS_P50, ABS_P90, ABS_P99, REL_P50, REL_P90, REL_P99\n");
+            reset_error_sketch(method_sketch);
+        }
+        if (maps) reset_error_maps(maps);
 
         for (int run = 0; run < args.runs; run++) {
             printf("Run %d/%d Metric %s/%d\n", run + 1, args.runs, method, args.runs);
-            printf("using %ld of %ld stations (%.2f%%)\n", n_train, n_data_points, args.percentage);
-
-            memset(selected, 0, n_data_points * sizeof(bool));
-            long int j = 0;
-            
-            while (j < n_train) {
-                long int r = rand() % n_data_points;
-                if (original_bin_data->data[r] != original_bin_data->info.undef && !selected[r]) {
-                    train_data_points[j++] = r;
-                    selected[r] = true;
+
+            if (args.columns) {
+                n_train = hold_out_columns(original_bin_data, columns, n_columns, n_pick, train_data_points);
+                if (n_train < 0) {
+                    fprintf(stderr, "Error: unable to write %s\n", COLUMNS_FILE);
+                    free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, csv_file, metrics_file);
+                    exit(1);
                 }
+                printf("using %ld of %ld columns, %ld points (%.2f%%)\n", n_pick, n_columns, n_train, args.percentage);
+            } else {
+                printf("using %ld of %ld stations (%.2f%%)\n", n_train, n_data_points, args.percentage);
+
+                memset(selected, 0, n_data_points * sizeof(bool));
+                long int j = 0;
+
+                while (j < n_train) {
+                    long int r = rand() % n_data_points;
+                    if (is_valid(original_bin_data, r / n_xy, r % n_xy) && !selected[r]) {
+                        train_data_points[j++] = r;
+                        selected[r] = true;
+                    }
+                }
+
+                // sorted indices make the metric gathers walk memory forward
+                qsort(train_data_points, n_train, sizeof(long int), compare_points);
             }
 
             info_ctl intermediary_info;
@@ -212,7 +486,12 @@ int main(int argc, char *argv[]) {
 
             pid_t pid = fork();
             if (pid == 0) {
-                char *argv[] = {"junta_dados/compose", "intermediary.ctl", args.interpolated_file, "final", method, "--debug", NULL};
+                char *argv[] = {"junta_dados/compose", "intermediary.ctl", args.interpolated_file, "final", method, "--debug", "--sparse", NULL, NULL, NULL};
+                // the held-out columns are interpolated with weights computed once per column
+                if (args.columns) {
+                    argv[7] = "--cells";
+                    argv[8] = COLUMNS_FILE;
+                }
                 execvp(argv[0], argv);
                 perror("execvp failed");
                 exit(127);
@@ -230,21 +509,68 @@ int main(int argc, char *argv[]) {
 
             if (args.print_csv) {
                 for (long int i = 0; i < n_train; i++) {
-                    fprintf(csv_file, "%d, %ld, %f, %f, %f\n", run + 1, train_data_points[i], original_bin_data->data[train_data_points[i]], final_bin_data->data[train_data_points[i]], final_bin_data->data[train_data_points[i]] - original_bin_data->data[train_data_points[i]]);
+                    datatype predicted = get_pos_val(final_bin_data, train_data_points[i]);
+                    fprintf(csv_file, "%d, %ld, %f, %f, %f\n", run + 1, train_data_points[i], original_bin_data->data[train_data_points[i]], predicted, predicted - original_bin_data->data[train_data_points[i]]);
                 }
             }
 
-            calculate_and_log_metrics(metrics_file, original_bin_data, final_bin_data, train_data_points, n_train, run, &total_rmse, &total_mae, &total_mse, &total_percentage_error);
+            if (!calculate_and_log_metrics(metrics_file, original_bin_data, final_bin_data, train_data_points, n_train, run, &stats, run_values, maps, run_sketch)) {
+                free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, csv_file, metrics_file);
+                free_bin(intermediary_bin_data);
+                free_bin(final_bin_data);
+                exit(1);
+            }
+
+            if (quantiles_file) {
+                char run_label[16];
+                sprintf(run_label, "%d", run + 1);
+                write_quantiles(quantiles_file, run_label, run_sketch);
+                sketch_merge(method_sketch, run_sketch);
+                reset_error_sketch(run_sketch);
+            }
 
             free_bin(intermediary_bin_data);
             free_bin(final_bin_data);
+
+            // sequential stopping: enough runs once the mean of the chosen metric is precise enough
+            if (args.threshold > 0 && stats.n >= MIN_RUNS &&
+                ci_half_width(&args, &stats, run_values, args.stop_metric, &bootstrap_state) < args.threshold) {
+                printf("CI below %f after %ld runs, stopping\n", args.threshold, stats.n);
+                break;
+            }
+        }
+
+        // means, 95% CI half-widths and number of runs done
+        double ci[N_METRICS];
+        for (int k = 0; k < N_METRICS; k++) {
+            ci[k] = ci_half_width(&args, &stats, run_values, k, &bootstrap_state);
+        }
+        fprintf(metrics_file, "Average, %f, %f, %f, %f, %f, %f, %f, %f, %ld\n",
+                stats.mean[METRIC_RMSE], stats.mean[METRIC_MAE], stats.mean[METRIC_MSE], stats.mean[METRIC_PERROR],
+                ci[METRIC_RMSE], ci[METRIC_MAE], ci[METRIC_MSE], ci[METRIC_PERROR], stats.n);
+
+        if (quantiles_file) {
+            char hist_filename[100];
+            write_quantiles(quantiles_file, "All", method_sketch);
+            fclose(quantiles_file);
+
+            sprintf(hist_filename, "histogram_%.2f%%_%d_runs_%s.csv", args.percentage, args.runs, method);
+            if (!write_histogram(method_sketch, hist_filename))
+                fprintf(stderr, "Error: unable to write histogram for %s\n", method);
         }
 
-        fprintf(metrics_file, "Average, %f, %f, %f, %f\n", total_rmse / args.runs, total_mae / args.runs, total_mse / args.runs, total_percentage_error / args.runs);
+        if (maps) {
+            char maps_name[100], table_filename[100];
+            sprintf(maps_name, "errmap_%.2f%%_%d_runs_%s", args.percentage, args.runs, method);
+            sprintf(table_filename, "errtime_%.2f%%_%d_runs_%s.csv", args.percentage, args.runs, method);
+            if (!write_error_maps(maps, &original_info, maps_name) || !write_error_table(maps, table_filename))
+                fprintf(stderr, "Error: unable to write error maps for %s\n", method);
+        }
         remove("intermediary.ctl");
         remove("intermediary.bin");
         remove("final.ctl");
         remove("final.bin");
+        remove(COLUMNS_FILE);
 
         if (csv_file) fclose(csv_file);
         fclose(metrics_file);
@@ -258,11 +584,19 @@ int main(int argc, char *argv[]) {
     FILE *details = fopen("details.dat", "a");
     fprintf(details, "Seed: %d\n", args.seed);
     fprintf(details, "Percentage: %.2f\n", args.percentage);
-    fprintf(details, "Used %ld of %ld stations\n", n_train, n_data_points);
+    if (args.columns)
+        fprintf(details, "Held out %ld of %ld columns per run\n", n_pick, n_columns);
+    else
+        fprintf(details, "Used %ld of %ld stations\n", n_train, n_data_points);
     fprintf(details, "Time: %.2f seconds\n", seconds);
     fprintf(details, "\n");
     fclose(details);
 
+    free_error_maps(maps);
+    free(run_values);
+    free(run_sketch);
+    free(method_sketch);
+    free(columns);
     free_resources(original_bin_data, interpolated_bin_data, train_data_points, selected, NULL, NULL);
 
     return 0;
@@ -1,83 +1,355 @@
+#include <string.h>
+#include <strings.h>
+#include <omp.h>
+#include <stdio.h>
 #include "error_metrics.h"
 
-float rmse(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation) {
-    float sum = 0.0;
-    long int count = 0;
-    for (long int i = 0; i < original->info.x.def * original->info.y.def * original->info.tdef; i++) {
-        if (original->data[i] != original->info.undef && predicted->data[i] != predicted->info.undef) {
-            sum += (original->data[i] - predicted->data[i]) * (original->data[i] - predicted->data[i]);
-            count++;
+int compare_points(const void *a, const void *b) {
+    long int pa = *(const long int *)a;
+    long int pb = *(const long int *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+ErrorMaps *alloc_error_maps(size_t n_cells, size_t n_times) {
+    ErrorMaps *maps = calloc(1, sizeof(ErrorMaps));
+    if (!maps) return NULL;
+
+    maps->n_cells = n_cells;
+    maps->n_times = n_times;
+    maps->cell_count = calloc(n_cells, sizeof(unsigned int));
+    maps->cell_bias = calloc(n_cells, sizeof(double));
+    maps->cell_squared = calloc(n_cells, sizeof(double));
+    maps->cell_absolute = calloc(n_cells, sizeof(double));
+    maps->time_count = calloc(n_times, sizeof(unsigned int));
+    maps->time_bias = calloc(n_times, sizeof(double));
+    maps->time_squared = calloc(n_times, sizeof(double));
+    maps->time_absolute = calloc(n_times, sizeof(double));
+
+    if (!maps->cell_count || !maps->cell_bias || !maps->cell_squared || !maps->cell_absolute ||
+        !maps->time_count || !maps->time_bias || !maps->time_squared || !maps->time_absolute) {
+        free_error_maps(maps);
+        return NULL;
+    }
+    return maps;
+}
+
+void reset_error_maps(ErrorMaps *maps) {
+    memset(maps->cell_count, 0, maps->n_cells * sizeof(unsigned int));
+    memset(maps->cell_bias, 0, maps->n_cells * sizeof(double));
+    memset(maps->cell_squared, 0, maps->n_cells * sizeof(double));
+    memset(maps->cell_absolute, 0, maps->n_cells * sizeof(double));
+    memset(maps->time_count, 0, maps->n_times * sizeof(unsigned int));
+    memset(maps->time_bias, 0, maps->n_times * sizeof(double));
+    memset(maps->time_squared, 0, maps->n_times * sizeof(double));
+    memset(maps->time_absolute, 0, maps->n_times * sizeof(double));
+}
+
+void free_error_maps(ErrorMaps *maps) {
+    if (!maps) return;
+    free(maps->cell_count);
+    free(maps->cell_bias);
+    free(maps->cell_squared);
+    free(maps->cell_absolute);
+    free(maps->time_count);
+    free(maps->time_bias);
+    free(maps->time_squared);
+    free(maps->time_absolute);
+    free(maps);
+}
+
+// Values of n sorted points of sparse data, merging the points of each timestep with its sorted 'idx'.
+// Points that are not stored get the undef value
+static void merge_sparse(binary_data *bin, const long int *points, long int n, datatype *dest) {
+    sparse_data *sp = bin->sparse;
+    size_t n_xy = bin->info.x.def * bin->info.y.def;
+    long int i = 0;
+
+    while (i < n) {
+        size_t t = points[i] / n_xy;
+        size_t end = sp->offset[t + 1];
+        size_t lo = sp->offset[t], hi = end;
+
+        // first stored entry of the timestep at or after the first point, then a linear merge
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (sp->idx[mid] < points[i] % n_xy) lo = mid + 1;
+            else hi = mid;
+        }
+
+        size_t k = lo;
+        for (; i < n && (size_t)points[i] / n_xy == t; i++) {
+            uint32_t cell = points[i] % n_xy;
+            while (k < end && sp->idx[k] < cell) k++;
+            dest[i] = (k < end && sp->idx[k] == cell) ? sp->val[k] : bin->info.undef;
         }
     }
-    if (count == 0) {
-        return 0.0; // Return 0 if there are no valid data points
+}
+
+// Sums of the errors of a run of validation points
+typedef struct {
+    double squared_error;
+    double absolute_error;
+    double percentage_error;
+    long int count;
+    long int percentage_count;
+} PointSums;
+
+// Validation points handled per chunk (one unit of work of the parallel loop)
+#define GATHER_CHUNK 4096
+
+// Errors of n points, one variant per instruction set (ISA_CLONES): point i is original[orig_points[i]]
+// against predicted[pred_points[i]]. Branchless body: invalid points contribute zero, so the loop
+// vectorizes into gathers
+static ISA_CLONES PointSums gather_errors(const datatype *original, const long int *orig_points, const datatype *predicted, const long int *pred_points,
+                                          long int n, datatype undef_original, datatype undef_predicted) {
+    double sum_squared_error = 0.0;
+    double sum_absolute_error = 0.0;
+    double sum_percentage_error = 0.0;
+    long int count = 0;
+    long int percentage_count = 0;
+
+    #pragma omp simd reduction(+:sum_squared_error, sum_absolute_error, sum_percentage_error, count, percentage_count)
+    for (long int i = 0; i < n; i++) {
+        datatype orig_val = original[orig_points[i]];
+        datatype pred_val = predicted[pred_points[i]];
+        int valid = (orig_val != undef_original) & (pred_val != undef_predicted);
+        int valid_percentage = valid & (orig_val != 0);
+        double diff = valid ? (double)orig_val - (double)pred_val : 0.0;
+        double abs_diff = fabs(diff);
+
+        sum_squared_error += diff * diff;
+        sum_absolute_error += abs_diff;
+        sum_percentage_error += valid_percentage ? abs_diff / fabs((double)orig_val) : 0.0;
+        count += valid;
+        percentage_count += valid_percentage;
     }
-    return sqrt(sum / count);
+
+    PointSums sums = {sum_squared_error, sum_absolute_error, sum_percentage_error, count, percentage_count};
+    return sums;
 }
 
-float mae(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation) {
-    float sum = 0.0;
+ErrorMetrics calculate_all_errors(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation, ErrorMaps *maps, ErrorSketch *sketch) {
+    double sum_squared_error = 0.0;
+    double sum_absolute_error = 0.0;
+    double sum_percentage_error = 0.0;
     long int count = 0;
-    for (long int i = 0; i < original->info.x.def * original->info.y.def * original->info.tdef; i++) {
-        if (original->data[i] != original->info.undef && predicted->data[i] != predicted->info.undef) {
-            sum += fabs(original->data[i] - predicted->data[i]);
-            count++;
+    long int percentage_count = 0;
+    ErrorMetrics metrics = {0.0, 0.0, 0.0, 0.0, -1};
+
+    // positions 0..GATHER_CHUNK-1: index of the values of a chunk read from sparse data
+    long int chunk_index[GATHER_CHUNK];
+    for (long int i = 0; i < GATHER_CHUNK; i++) chunk_index[i] = i;
+
+    size_t n_cells = maps ? maps->n_cells : 1;
+    int n_threads = omp_get_max_threads();
+    ErrorSketch **thread_sketch = NULL;
+    int allocated = 1;
+
+    // one sketch per thread, merged in thread order at the end of the pass
+    if (sketch) {
+        allocated = (thread_sketch = calloc(n_threads, sizeof(ErrorSketch *))) != NULL;
+        for (int t = 0; allocated && t < n_threads; t++) {
+            allocated = (thread_sketch[t] = alloc_error_sketch()) != NULL;
+        }
+    }
+
+    // error of each point, added to the maps after the parallel pass
+    double *point_diff = maps ? malloc(n_validation * sizeof(double)) : NULL;
+    unsigned char *point_valid = maps ? malloc(n_validation) : NULL;
+    if (maps && (!point_diff || !point_valid)) allocated = 0;
+
+    if (allocated) {
+        // Chunks of validation points: sparse data is merged into the chunk buffers, then the errors
+        // are gathered by the variant selected for this CPU, or point by point to feed the maps and sketches
+        #pragma omp parallel reduction(+:sum_squared_error, sum_absolute_error, sum_percentage_error, count, percentage_count)
+        {
+            ErrorSketch *local_sketch = thread_sketch ? thread_sketch[omp_get_thread_num()] : NULL;
+            datatype orig_buffer[GATHER_CHUNK], pred_buffer[GATHER_CHUNK];
+
+            #pragma omp for schedule(static)
+            for (long int c = 0; c < n_validation; c += GATHER_CHUNK) {
+                long int n = (n_validation - c < GATHER_CHUNK) ? n_validation - c : GATHER_CHUNK;
+                const long int *points = validation_points + c;
+                const datatype *orig_values = original->data, *pred_values = predicted->data;
+                const long int *orig_points = points, *pred_points = points;
+
+                if (original->sparse) {
+                    merge_sparse(original, points, n, orig_buffer);
+                    orig_values = orig_buffer;
+                    orig_points = chunk_index;
+                }
+                if (predicted->sparse) {
+                    merge_sparse(predicted, points, n, pred_buffer);
+                    pred_values = pred_buffer;
+                    pred_points = chunk_index;
+                }
+
+                if (!maps && !local_sketch) {
+                    PointSums sums = gather_errors(orig_values, orig_points, pred_values, pred_points, n,
+                                                   original->info.undef, predicted->info.undef);
+
+                    sum_squared_error += sums.squared_error;
+                    sum_absolute_error += sums.absolute_error;
+                    sum_percentage_error += sums.percentage_error;
+                    count += sums.count;
+                    percentage_count += sums.percentage_count;
+                    continue;
+                }
+
+                for (long int i = 0; i < n; i++) {
+                    datatype orig_val = orig_values[orig_points[i]];
+                    datatype pred_val = pred_values[pred_points[i]];
+                    int valid = (orig_val != original->info.undef) & (pred_val != predicted->info.undef);
+                    int valid_percentage = valid & (orig_val != 0);
+                    double orig_abs = fabs((double)orig_val);
+                    double diff = valid ? (double)orig_val - (double)pred_val : 0.0;
+                    double abs_diff = fabs(diff);
+
+                    sum_squared_error += diff * diff;
+                    sum_absolute_error += abs_diff;
+                    sum_percentage_error += valid_percentage ? abs_diff / orig_abs : 0.0;
+                    count += valid;
+                    percentage_count += valid_percentage;
+
+                    if (point_valid) {
+                        point_valid[c + i] = valid;
+                        point_diff[c + i] = diff;
+                    }
+
+                    if (valid && local_sketch) sketch_add(local_sketch, -diff, orig_abs);
+                }
+            }
+        }
+
+        // cell and timestep accumulators in validation point order, as a single thread would add them:
+        // the maps are the same for any number of threads
+        if (maps) {
+            for (long int i = 0; i < n_validation; i++) {
+                if (!point_valid[i]) continue;
+
+                double diff = point_diff[i];
+                size_t cell = validation_points[i] % n_cells;
+                size_t t = validation_points[i] / n_cells;
+
+                maps->cell_count[cell]++;
+                maps->cell_bias[cell] -= diff;
+                maps->cell_squared[cell] += diff * diff;
+                maps->cell_absolute[cell] += fabs(diff);
+
+                maps->time_count[t]++;
+                maps->time_bias[t] -= diff;
+                maps->time_squared[t] += diff * diff;
+                maps->time_absolute[t] += fabs(diff);
+            }
+        }
+
+        metrics.count = count;
+        if (count > 0) {
+            metrics.mse = sum_squared_error / count;
+            metrics.rmse = sqrt(sum_squared_error / count);
+            metrics.mae = sum_absolute_error / count;
+        }
+        if (percentage_count > 0) {
+            metrics.percentage_error = (sum_percentage_error / percentage_count) * 100;
         }
     }
-    if (count == 0) {
-        return 0.0; // Return 0 if there are no valid data points
+    free(point_diff);
+    free(point_valid);
+
+    if (thread_sketch) {
+        for (int t = 0; t < n_threads; t++) {
+            if (allocated) sketch_merge(sketch, thread_sketch[t]);
+            free(thread_sketch[t]);
+        }
+        free(thread_sketch);
     }
-    return sum / count;
+
+    return metrics;
 }
 
-float mse(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation) {
-    float sum = 0.0;
-    long int count = 0;
-    for (long int i = 0; i < original->info.x.def * original->info.y.def * original->info.tdef; i++) {
-        if (original->data[i] != original->info.undef && predicted->data[i] != predicted->info.undef) {
-            sum += (original->data[i] - predicted->data[i]) * (original->data[i] - predicted->data[i]);
-            count++;
-        }
+double metric_value(const ErrorMetrics *metrics, int k) {
+    switch (k) {
+        case METRIC_RMSE: return metrics->rmse;
+        case METRIC_MAE: return metrics->mae;
+        case METRIC_MSE: return metrics->mse;
+        default: return metrics->percentage_error;
     }
-    if (count == 0) {
-        return 0.0; // Return 0 if there are no valid data points
+}
+
+int metric_from_name(const char *name) {
+    const char *names[N_METRICS] = {"rmse", "mae", "mse", "perror"};
+
+    for (int k = 0; k < N_METRICS; k++) {
+        if (!strcasecmp(name, names[k])) return k;
     }
-    return sum / count;
+    return -1;
 }
 
-float percentage_error(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation) {
-    float sum = 0.0;
-    long int count = 0;
-    for (long int i = 0; i < n_validation; i++) {
-        long int index = validation_points[i];
-        if (original->data[index] != original->info.undef && predicted->data[index] != predicted->info.undef) {
-            if (original->data[index] != 0) {
-                float error = fabs(original->data[index] - predicted->data[index]) / (fabs(original->data[index]));
-                sum += error;
-                count++;
-            }
-        }
+void metric_stats_init(MetricStats *stats) {
+    memset(stats, 0, sizeof(MetricStats));
+}
+
+void metric_stats_add(MetricStats *stats, const ErrorMetrics *metrics) {
+    stats->n++;
+    for (int k = 0; k < N_METRICS; k++) {
+        double x = metric_value(metrics, k);
+        double delta = x - stats->mean[k];
+        stats->mean[k] += delta / stats->n;
+        stats->m2[k] += delta * (x - stats->mean[k]);
     }
-    if (count == 0) {
-        return 0.0; // Return 0 if there are no valid data points
+}
+
+// Two-sided 95% quantile of Student's t with df degrees of freedom
+static double t_quantile_95(long int df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    if (df <= 30) return table[df - 1];
+    return 1.96 + 2.4 / df; // within 0.002 of the exact value for df > 30
+}
+
+double metric_stats_ci(const MetricStats *stats, int k) {
+    if (stats->n < 2) return 0.0;
+
+    double variance = stats->m2[k] / (stats->n - 1);
+    return t_quantile_95(stats->n - 1) * sqrt(variance / stats->n);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// xorshift64*, so resampling does not disturb the rand() sequence used for sampling
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+double bootstrap_ci(const double *values, long int n, int resamples, unsigned long long *state) {
+    if (n < 2 || resamples < 2) return 0.0;
+
+    double *means = malloc(resamples * sizeof(double));
+    if (!means) return 0.0;
+
+    for (int b = 0; b < resamples; b++) {
+        double sum = 0.0;
+        for (long int i = 0; i < n; i++) {
+            sum += values[next_random(state) % n];
+        }
+        means[b] = sum / n;
     }
-    return (sum / count) * 100;
-}
-
-// float percentage_error(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation) {
-//     float sum = 0.0;
-//     long int count = 0;
-//     for (long int i = 0; i < original->info.x.def * original->info.y.def * original->info.tdef; i++) {
-//         if (original->data[i] != original->info.undef && predicted->data[i] != predicted->info.undef) {
-//             if (original->data[i] != 0) {
-//                 float error = fabs(original->data[i] - predicted->data[i]) / (fabs(original->data[i]));
-//                 sum += error;
-//                 count++;
-//             }
-//         }
-//     }
-//     if (count == 0) {
-//         return 0.0; // Return 0 if there are no valid data points
-//     }
-//     return (sum / count) * 100;
-// }
+
+    qsort(means, resamples, sizeof(double), compare_doubles);
+    double low = means[(int)(0.025 * (resamples - 1))];
+    double high = means[(int)(0.975 * (resamples - 1))];
+
+    free(means);
+    return (high - low) / 2.0;
+}
@@ -3,38 +3,125 @@
 
 #include <math.h>
 #include "c_ctl.h"
+#include "sketch.h"
 
 /**
- * @brief Calculate the Root Mean Squared Error (RMSE) between two binary data structs.
- * 
- * @param original The original binary data struct.
- * @param predicted The predicted binary data struct.
- * @return The RMSE value.
+ * @brief All error metrics of one evaluation, computed together.
  */
-float rmse(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation);
+typedef struct {
+    float rmse;             // Root Mean Squared Error
+    float mae;              // Mean Absolute Error
+    float mse;              // Mean Squared Error
+    float percentage_error; // Mean |error| / |original|, in % (points with original == 0 are skipped)
+    long int count;         // Validation points defined in both datasets
+} ErrorMetrics;
+
+/**
+ * @brief Running error statistics per grid cell (x,y) and per timestep, accumulated across runs.
+ *
+ * Errors are predicted - original, so bias is positive when the interpolation overestimates.
+ */
+typedef struct {
+    size_t n_cells;         // x * y
+    size_t n_times;         // t
+    unsigned int *cell_count;
+    double *cell_bias;      // sum of errors
+    double *cell_squared;   // sum of squared errors
+    double *cell_absolute;  // sum of absolute errors
+    unsigned int *time_count;
+    double *time_bias;
+    double *time_squared;
+    double *time_absolute;
+} ErrorMaps;
+
+/**
+ * @brief Allocate zeroed error maps for a grid with n_cells cells and n_times timesteps.
+ * @return The maps, or NULL on allocation error.
+ */
+ErrorMaps *alloc_error_maps(size_t n_cells, size_t n_times);
+
+/**
+ * @brief Zero all accumulators of the maps.
+ */
+void reset_error_maps(ErrorMaps *maps);
+
+/**
+ * @brief Free the maps (NULL is accepted).
+ */
+void free_error_maps(ErrorMaps *maps);
+
+/**
+ * @brief Calculate RMSE, MAE, MSE and percentage error in a single pass over the validation points.
+ *
+ * Only the held-out points are visited, so the cost is proportional to n_validation. Sparse data is
+ * merged with the sorted points, one timestep at a time, so only its stored entries are read.
+ * Sums are accumulated in double and reduced across OpenMP threads.
+ *
+ * @param original The original binary data struct (dense or sparse).
+ * @param predicted The predicted binary data struct (dense or sparse).
+ * @param validation_points Indices (see get_pos) of the held-out points, sorted in ascending order.
+ * @param n_validation Number of validation points.
+ * @param maps If not NULL, each valid point is also added to its cell and timestep accumulators.
+ * @param sketch If not NULL, the error of each valid point is also added to it (through per-thread sketches).
+ * @return The metrics of the points defined in both datasets (all zero if there are none),
+ *         with count -1 on allocation error.
+ */
+ErrorMetrics calculate_all_errors(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation, ErrorMaps *maps, ErrorSketch *sketch);
+
+/**
+ * @brief Comparison function for qsort, sorts validation indices in ascending order.
+ */
+int compare_points(const void *a, const void *b);
+
+/**
+ * @brief Metrics tracked across runs, in the column order of the metrics CSV.
+ */
+enum { METRIC_RMSE, METRIC_MAE, METRIC_MSE, METRIC_PERROR, N_METRICS };
+
+/**
+ * @brief Online (Welford) mean and variance of the per-run metrics.
+ */
+typedef struct {
+    long int n;                 // Runs added so far
+    double mean[N_METRICS];
+    double m2[N_METRICS];       // Sum of squared deviations from the mean
+} MetricStats;
+
+/**
+ * @brief Value of metric k (METRIC_*) of one run.
+ */
+double metric_value(const ErrorMetrics *metrics, int k);
+
 /**
- * @brief Calculate the Mean Absolute Error (MAE) between two binary data structs.
- * 
- * @param original The original binary data struct.
- * @param predicted The predicted binary data struct.
- * @return The MAE value.
+ * @brief Index (METRIC_*) of a metric given its name (rmse, mae, mse or perror), or -1 if unknown.
  */
-float mae(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation);
+int metric_from_name(const char *name);
+
+/**
+ * @brief Reset the statistics to zero runs.
+ */
+void metric_stats_init(MetricStats *stats);
+
 /**
- * @brief Calculate the Mean Squared Error (MSE) between two binary data structs.
- * 
- * @param original The original binary data struct.
- * @param predicted The predicted binary data struct.
- * @return The MSE value.
+ * @brief Add the metrics of one run to the statistics.
  */
-float mse(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation);
+void metric_stats_add(MetricStats *stats, const ErrorMetrics *metrics);
 
 /**
- * @brief Calculate the percentage error between two binary data structs.
- * 
- * @param original The original binary data struct.
- * @param predicted The predicted binary data struct.
- * @return The percentage error value.
+ * @brief Half-width of the 95% confidence interval of the mean of metric k (Student's t).
+ * @return The half-width, or 0 with fewer than two runs.
  */
-float percentage_error(binary_data *original, binary_data *predicted, long int *validation_points, long int n_validation);
-#endif // ERROR_METRICS_H
\ No newline at end of file
+double metric_stats_ci(const MetricStats *stats, int k);
+
+/**
+ * @brief Half-width of the 95% percentile bootstrap interval of the mean of n values.
+ *
+ * @param values Per-run values of one metric.
+ * @param n Number of values.
+ * @param resamples Number of bootstrap resamples.
+ * @param state State of the generator used for resampling (kept apart from rand()).
+ * @return The half-width, or 0 with fewer than two values or on allocation error.
+ */
+double bootstrap_ci(const double *values, long int n, int resamples, unsigned long long *state);
+
+#endif // ERROR_METRICS_H
@@ -0,0 +1,199 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sketch.h"
+
+typedef struct {
+    double mean;
+    double weight;
+} Centroid;
+
+static int compare_centroids(const void *a, const void *b) {
+    double ma = ((const Centroid *)a)->mean;
+    double mb = ((const Centroid *)b)->mean;
+    return (ma > mb) - (ma < mb);
+}
+
+// Scale function k1: centroids near the tails are kept small, so extreme quantiles stay accurate
+static double scale_k(double q) {
+    return TDIGEST_COMPRESSION / (2.0 * M_PI) * asin(2.0 * q - 1.0);
+}
+
+static double scale_k_inverse(double k) {
+    if (k >= TDIGEST_COMPRESSION / 4.0) return 1.0;
+    return (sin(k * 2.0 * M_PI / TDIGEST_COMPRESSION) + 1.0) / 2.0;
+}
+
+void tdigest_init(TDigest *td) {
+    td->n_centroids = 0;
+    td->n_buffered = 0;
+    td->total_weight = 0.0;
+    td->min = INFINITY;
+    td->max = -INFINITY;
+}
+
+// Merge the buffered points into the centroids
+static void tdigest_compress(TDigest *td) {
+    if (!td->n_buffered) return;
+
+    Centroid items[TDIGEST_CAPACITY + TDIGEST_BUFFER];
+    int n = 0;
+
+    for (int i = 0; i < td->n_centroids; i++) {
+        items[n++] = (Centroid){td->mean[i], td->weight[i]};
+    }
+    for (int i = 0; i < td->n_buffered; i++) {
+        items[n++] = (Centroid){td->buffer_mean[i], td->buffer_weight[i]};
+    }
+    qsort(items, n, sizeof(Centroid), compare_centroids);
+
+    double total = td->total_weight;
+    double weight_before = 0.0;     // weight of the centroids already emitted
+    double q_limit = scale_k_inverse(scale_k(0.0) + 1.0);
+    Centroid current = items[0];
+
+    td->n_centroids = 0;
+    for (int i = 1; i < n; i++) {
+        double proposed = current.weight + items[i].weight;
+
+        if ((weight_before + proposed) / total <= q_limit) {
+            current.mean += (items[i].mean - current.mean) * items[i].weight / proposed;
+            current.weight = proposed;
+        } else {
+            td->mean[td->n_centroids] = current.mean;
+            td->weight[td->n_centroids] = current.weight;
+            td->n_centroids++;
+
+            weight_before += current.weight;
+            q_limit = scale_k_inverse(scale_k(weight_before / total) + 1.0);
+            current = items[i];
+        }
+    }
+    td->mean[td->n_centroids] = current.mean;
+    td->weight[td->n_centroids] = current.weight;
+    td->n_centroids++;
+
+    td->n_buffered = 0;
+}
+
+void tdigest_add(TDigest *td, double value, double weight) {
+    if (td->n_buffered == TDIGEST_BUFFER) tdigest_compress(td);
+
+    td->buffer_mean[td->n_buffered] = value;
+    td->buffer_weight[td->n_buffered] = weight;
+    td->n_buffered++;
+    td->total_weight += weight;
+
+    if (value < td->min) td->min = value;
+    if (value > td->max) td->max = value;
+}
+
+void tdigest_merge(TDigest *dest, TDigest *src) {
+    double min = src->min, max = src->max;
+
+    for (int i = 0; i < src->n_centroids; i++) {
+        tdigest_add(dest, src->mean[i], src->weight[i]);
+    }
+    for (int i = 0; i < src->n_buffered; i++) {
+        tdigest_add(dest, src->buffer_mean[i], src->buffer_weight[i]);
+    }
+
+    // the centroid means lie inside [min, max], keep the exact extremes
+    if (min < dest->min) dest->min = min;
+    if (max > dest->max) dest->max = max;
+}
+
+double tdigest_quantile(TDigest *td, double q) {
+    tdigest_compress(td);
+
+    if (!td->n_centroids) return 0.0;
+    if (q <= 0.0) return td->min;
+    if (q >= 1.0) return td->max;
+    if (td->n_centroids == 1) return td->mean[0];
+
+    double index = q * td->total_weight;
+
+    // before the center of the first centroid: between the minimum and its mean
+    double first_center = td->weight[0] / 2.0;
+    if (index < first_center) {
+        return td->min + (td->mean[0] - td->min) * index / first_center;
+    }
+
+    double weight_before = 0.0;
+    for (int i = 0; i < td->n_centroids - 1; i++) {
+        double center = weight_before + td->weight[i] / 2.0;
+        double next_center = weight_before + td->weight[i] + td->weight[i + 1] / 2.0;
+
+        if (index <= next_center) {
+            return td->mean[i] + (td->mean[i + 1] - td->mean[i]) * (index - center) / (next_center - center);
+        }
+        weight_before += td->weight[i];
+    }
+
+    // after the center of the last centroid: between its mean and the maximum
+    int last = td->n_centroids - 1;
+    double last_center = td->total_weight - td->weight[last] / 2.0;
+    double rest = td->total_weight - last_center;
+    return td->mean[last] + (td->max - td->mean[last]) * (index - last_center) / rest;
+}
+
+void hist_add(LogHistogram *hist, double value) {
+    int b;
+
+    if (value < HIST_MIN) {
+        b = 0;
+    } else {
+        b = 1 + (int)floor(log10(value / HIST_MIN) * HIST_PER_DECADE);
+        if (b > HIST_BINS - 1) b = HIST_BINS - 1;
+    }
+    hist->count[b]++;
+}
+
+void hist_bin_edges(int b, double *low, double *high) {
+    if (b == 0) {
+        *low = 0.0;
+        *high = HIST_MIN;
+    } else if (b == HIST_BINS - 1) {
+        *low = HIST_MIN * pow(10.0, HIST_DECADES);
+        *high = INFINITY;
+    } else {
+        *low = HIST_MIN * pow(10.0, (double)(b - 1) / HIST_PER_DECADE);
+        *high = HIST_MIN * pow(10.0, (double)b / HIST_PER_DECADE);
+    }
+}
+
+ErrorSketch *alloc_error_sketch(void) {
+    ErrorSketch *sketch = malloc(sizeof(ErrorSketch));
+    if (sketch) reset_error_sketch(sketch);
+    return sketch;
+}
+
+void reset_error_sketch(ErrorSketch *sketch) {
+    tdigest_init(&sketch->absolute);
+    tdigest_init(&sketch->relative);
+    memset(&sketch->absolute_hist, 0, sizeof(LogHistogram));
+    memset(&sketch->relative_hist, 0, sizeof(LogHistogram));
+}
+
+void sketch_add(ErrorSketch *sketch, double error, double original) {
+    double absolute = fabs(error);
+
+    tdigest_add(&sketch->absolute, absolute, 1.0);
+    hist_add(&sketch->absolute_hist, absolute);
+
+    if (original != 0) {
+        double relative = 100.0 * absolute / fabs(original);  // percent, like PERROR
+        tdigest_add(&sketch->relative, relative, 1.0);
+        hist_add(&sketch->relative_hist, relative);
+    }
+}
+
+void sketch_merge(ErrorSketch *dest, ErrorSketch *src) {
+    tdigest_merge(&dest->absolute, &src->absolute);
+    tdigest_merge(&dest->relative, &src->relative);
+
+    for (int b = 0; b < HIST_BINS; b++) {
+        dest->absolute_hist.count[b] += src->absolute_hist.count[b];
+        dest->relative_hist.count[b] += src->relative_hist.count[b];
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+
+/**
+ * @brief Compression of the t-digest: larger values keep more centroids and give more accurate quantiles.
+ */
+#ifndef TDIGEST_COMPRESSION
+#define TDIGEST_COMPRESSION 100
+#endif
+
+#define TDIGEST_CAPACITY (2 * TDIGEST_COMPRESSION)  // Upper bound on merged centroids
+#define TDIGEST_BUFFER (5 * TDIGEST_COMPRESSION)    // Unmerged points kept before compressing
+
+/**
+ * @brief Log-binned histogram layout: bin 0 holds [0, HIST_MIN), then HIST_PER_DECADE bins per
+ * decade up to HIST_MIN * 10^HIST_DECADES, and the last bin holds everything above.
+ */
+#define HIST_MIN 1e-4
+#define HIST_DECADES 8
+#define HIST_PER_DECADE 8
+#define HIST_BINS (HIST_DECADES * HIST_PER_DECADE + 2)
+
+/**
+ * @brief Merging t-digest: a mergeable summary of a stream of values that answers quantile queries.
+ */
+typedef struct {
+    int n_centroids;
+    int n_buffered;
+    double total_weight;            // Weight of merged centroids and buffer
+    double min, max;
+    double mean[TDIGEST_CAPACITY];
+    double weight[TDIGEST_CAPACITY];
+    double buffer_mean[TDIGEST_BUFFER];
+    double buffer_weight[TDIGEST_BUFFER];
+} TDigest;
+
+/**
+ * @brief Histogram of non-negative values with logarithmic bins.
+ */
+typedef struct {
+    unsigned long long count[HIST_BINS];
+} LogHistogram;
+
+/**
+ * @brief Distribution of the absolute error |predicted - original| and of the relative
+ * error 100 * |predicted - original| / |original|, in percent as PERROR (points with original == 0 are skipped).
+ */
+typedef struct {
+    TDigest absolute;
+    TDigest relative;
+    LogHistogram absolute_hist;
+    LogHistogram relative_hist;
+} ErrorSketch;
+
+/**
+ * @brief Reset the digest to an empty stream.
+ */
+void tdigest_init(TDigest *td);
+
+/**
+ * @brief Add a value with the given weight to the digest.
+ */
+void tdigest_add(TDigest *td, double value, double weight);
+
+/**
+ * @brief Add all values summarized by src to dest.
+ */
+void tdigest_merge(TDigest *dest, TDigest *src);
+
+/**
+ * @brief Estimate the q-quantile (0 <= q <= 1) of the values added to the digest.
+ * @return The estimate, or 0 if the digest is empty.
+ */
+double tdigest_quantile(TDigest *td, double q);
+
+/**
+ * @brief Add a value to the histogram.
+ */
+void hist_add(LogHistogram *hist, double value);
+
+/**
+ * @brief Lower and upper edge of bin b of the histograms.
+ */
+void hist_bin_edges(int b, double *low, double *high);
+
+/**
+ * @brief Allocate an empty error sketch.
+ * @return The sketch, or NULL on allocation error.
+ */
+ErrorSketch *alloc_error_sketch(void);
+
+/**
+ * @brief Reset the sketch to an empty stream.
+ */
+void reset_error_sketch(ErrorSketch *sketch);
+
+/**
+ * @brief Add the error of one point.
+ *
+ * @param error predicted - original.
+ * @param original The original value, the relative error (in percent) is only added when it is not zero.
+ */
+void sketch_add(ErrorSketch *sketch, double error, double original);
+
+/**
+ * @brief Add all points summarized by src to dest.
+ */
+void sketch_merge(ErrorSketch *dest, ErrorSketch *src);
+
+#endif // SKETCH_H